@@ -4,28 +4,277 @@
 # include "config.h"
 #endif
 
+#include <time.h>
+#include <unistd.h>
+
 #include <php.h>
+#include <SAPI.h>
 #include <ext/standard/info.h>
 #include <Zend/zend_extensions.h>
 #include <Zend/zend_observer.h>
 
 #include "php_3d.h"
+#include "php_3d_arginfo.h"
+#include "aggregate.h"
+#include "arena.h"
+#include "clock.h"
+#include "filter.h"
+#include "sampler.h"
 #include "sketchup.h"
+#include "trace.h"
+#include "writer.h"
 
 ZEND_DECLARE_MODULE_GLOBALS(php_3d)
 
 #define PHP3D_OP_ARRAY_EXTENSION(op_array) ZEND_OP_ARRAY_EXTENSION(op_array, php3d_op_array_extension)
 
 int php3d_op_array_extension = 0;
+#if PHP_VERSION_ID >= 80200
+// Internal functions have a run-time cache of their own, sized by the internal handles
+int php3d_internal_function_extension = 0;
+#endif
+
+// Chosen once in MINIT from php_3d.backend
+static const sketchup_backend *php3d_backend = &sketchup_backend_null;
+static const char *php3d_output_extension = "skp";
+// php_3d.output=trace saves the trace for tools/render.c instead of building the town here
+static bool php3d_output_trace;
+// php_3d.output=aggregate only counts calls and variable types into shared memory, see aggregate.h
+static bool php3d_output_aggregate;
+// Parsed once in MINIT from php_3d.include and php_3d.exclude
+static filter php3d_filter;
+// php_3d.mode=sample replaces the observer with a stack sampler
+static bool php3d_sampling;
+static uint64_t php3d_sample_period_ns;
+static void (*php3d_prev_interrupt_function)(zend_execute_data *execute_data);
+
+// Everything the hot path needs to know about a function, built on its first call so that no
+// names have to be formatted or interned again.
+typedef struct php3d_function_s {
+	zend_function *func;
+	// Late static binding gives every called scope of a method its own room
+	zend_class_entry *called_scope;
+	uint32_t next_scope; // Registry index + 1, 0 ends the chain
+	uint32_t name_id;
+	uint32_t room_index;
+	uint32_t visit_count;
+	uint32_t cv_count;
+	uint32_t *cv_name_ids;
+	// What the CVs looked like when they were last recorded, only used with php_3d.delta_snapshots
+	struct php3d_fingerprint_s *snapshot;
+	// Aggregated over the request, only used with php_3d.heatmap
+	sketchup_room_profile profile;
+	// The visits past php_3d.max_floors, folded into one summary floor
+	uint64_t summary_calls;
+	trace_var_summary *summary_vars;
+	// The shared counters of the function, only used with php_3d.output=aggregate
+	aggregate_entry *aggregate;
+} php3d_function;
+
+// Cheap identity of a value: the type plus the scalar value or the pointer of a refcounted value
+typedef struct php3d_fingerprint_s {
+	uint64_t value;
+	uint32_t type;
+} php3d_fingerprint;
+
+#define PHP3D_FINGERPRINT_NONE UINT32_MAX
+
+// The records live in a per-request registry, much like the run-time cache. The op_array extension slot
+// only holds a handle made of the request epoch and the registry index, never a pointer. A slot left
+// behind by an earlier request (e.g. of an op_array persisted by opcache) therefore can't be followed
+// into freed memory; its epoch doesn't match and the slot is simply overwritten.
+#define PHP3D_REGISTRY_CHUNK 256
+#define PHP3D_HANDLE_SHIFT (sizeof(uintptr_t) * 4)
+#define PHP3D_HANDLE_INDEX_MASK (((uintptr_t) 1 << PHP3D_HANDLE_SHIFT) - 1)
+#define PHP3D_HANDLE(epoch, index) ((void *) ((((uintptr_t) (epoch) & PHP3D_HANDLE_INDEX_MASK) << PHP3D_HANDLE_SHIFT) | ((uintptr_t) (index) + 1)))
+
+typedef struct php3d_registry_s {
+	php3d_function **chunks;
+	size_t chunk_count;
+	size_t count;
+} php3d_registry;
+
+// A frame of the shadow stack, pushed by the begin handler and popped by the end handler
+typedef struct php3d_frame_s {
+	zend_execute_data *execute_data;
+	php3d_function *fn;
+	uint32_t visit_index;
+	uint64_t start_ns;
+	uint64_t child_ns;
+	size_t start_memory;
+	// Index + 1 of the edge from the caller, 0 unless php_3d.call_graph recorded one
+	uint32_t edge;
+} php3d_frame;
+
+typedef struct php3d_stack_s {
+	php3d_frame *frames;
+	size_t depth;
+	size_t cap;
+} php3d_stack;
+
+ZEND_TLS trace_buffer *php3d_trace;
+ZEND_TLS php3d_registry php3d_functions;
+// Per-request state that is released in one go in RSHUTDOWN, the first chunk is reused by the next request
+ZEND_TLS arena php3d_arena;
+// Bumped for every captured request, never reset
+ZEND_TLS uint32_t php3d_epoch;
+// Kept across requests so that its frames are only allocated once
+ZEND_TLS php3d_stack php3d_frames;
+
+// A unique call stack, root first, and how often it was sampled
+typedef struct php3d_folded_s {
+	uint64_t hash;
+	uint64_t count;
+	uint32_t depth;
+	uint32_t rooms[];
+} php3d_folded;
+
+// Open addressing, allocated from the request arena
+typedef struct php3d_folded_table_s {
+	php3d_folded **slots;
+	size_t cap;
+	size_t count;
+} php3d_folded_table;
+
+#define PHP3D_SAMPLE_MAX_DEPTH 128
+
+ZEND_TLS php3d_folded_table php3d_samples;
+
+// The call graph of php_3d.call_graph, open addressing over the dense edges, both allocated from
+// the request arena. Once it has seen every distinct edge, recording a call allocates nothing.
+typedef struct php3d_edge_table_s {
+	trace_edge *edges;  // Room for cap / 2 edges, in the order they were first taken
+	uint32_t *slots;    // Edge index + 1, 0 is empty
+	size_t cap;
+	size_t count;
+} php3d_edge_table;
+
+ZEND_TLS php3d_edge_table php3d_edges;
+
+// The handles of the functions without a run-time cache slot of ours: internal functions before
+// PHP 8.2, or before their cache is allocated
+typedef struct php3d_slot_table_s {
+	zend_function **funcs;
+	void **handles;
+	size_t cap;
+	size_t count;
+} php3d_slot_table;
+
+ZEND_TLS php3d_slot_table php3d_slots;
+
+#define PHP3D_CAPTURE_MAX_DEPTH 16
+
+// What the deep captures of the current request have added to its trace so far
+ZEND_TLS size_t php3d_capture_bytes;
+// Raised by the sampler thread, consumed by the interrupt function at the next safe point
+static volatile bool php3d_sample_pending;
+
+// Long-running requests are cut into segments by php_3d.flush_*, each saved to a file of its own
+#define PHP3D_FLUSH_CHECK_EVENTS 1024
+static bool php3d_flushing;
+ZEND_TLS uint64_t php3d_segment_start_ns;
+// The flush policy is only looked at every PHP3D_FLUSH_CHECK_EVENTS events
+ZEND_TLS size_t php3d_flush_check_at;
+// Numbers the output files of the process for %s
+static uint64_t php3d_output_seq;
+static size_t php3d_segments_flushed;
+
+// The process-wide counters are shared by all threads of a ZTS build
+#define PHP3D_COUNT(counter) __atomic_fetch_add(&(counter), 1, __ATOMIC_RELAXED)
+
+// What the capture of the current request cost, see php_3d_stats(). Added to the totals of the
+// process when the request is over.
+typedef struct php3d_request_stats_s {
+	size_t rooms;
+	size_t visits;
+	size_t floors_folded;       // Visits past php_3d.max_floors, folded into the summary floor
+	size_t variables;
+	size_t captures_skipped;    // Deep captures over php_3d.capture_max_bytes
+	size_t failures;
+} php3d_request_stats;
+
+ZEND_TLS php3d_request_stats php3d_stats;
+static php3d_request_stats php3d_process_stats;
+// From the end of the request to the trace being handed to the writer
+static sketchup_histogram php3d_finish_histogram;
+
+// Every failure of the request path ends up in the error log and in the stats
+static void php3d_failure(const char *message) {
+	php3d_stats.failures++;
+	php_log_err(message);
+}
+
+static void php3d_request_stats_add(void) {
+	size_t *total = (size_t *) &php3d_process_stats;
+	const size_t *request = (const size_t *) &php3d_stats;
+	for (size_t i = 0; i < sizeof(php3d_request_stats) / sizeof(size_t); i++) {
+		__atomic_fetch_add(&total[i], request[i], __ATOMIC_RELAXED);
+	}
+}
+
+#ifdef ZTS
+// Threads share the process id, only the sequence number tells their files apart
+# define PHP3D_OUTPUT_SEQ_REQUIRED true
+#else
+# define PHP3D_OUTPUT_SEQ_REQUIRED php3d_flushing
+#endif
+
+static zend_always_inline php3d_function *php3d_registry_at(uint32_t index) {
+	return &php3d_functions.chunks[index / PHP3D_REGISTRY_CHUNK][index % PHP3D_REGISTRY_CHUNK];
+}
+
+static php3d_function *php3d_registry_add(uint32_t *index) {
+	php3d_registry *registry = &php3d_functions;
+	if (registry->count == registry->chunk_count * PHP3D_REGISTRY_CHUNK) {
+		php3d_function **chunks = arena_alloc(&php3d_arena, sizeof(php3d_function *) * (registry->chunk_count + 1));
+		php3d_function *chunk = arena_alloc(&php3d_arena, sizeof(php3d_function) * PHP3D_REGISTRY_CHUNK);
+		if (!chunks || !chunk) return NULL;
+		if (registry->chunk_count) {
+			memcpy(chunks, registry->chunks, sizeof(php3d_function *) * registry->chunk_count);
+		}
+		chunks[registry->chunk_count++] = chunk;
+		registry->chunks = chunks;
+	}
+	*index = (uint32_t) registry->count++;
+	return php3d_registry_at(*index);
+}
+
+static php3d_frame *php3d_stack_push(void) {
+	php3d_stack *stack = &php3d_frames;
+	if (stack->depth == stack->cap) {
+		size_t cap = stack->cap ? stack->cap * 2 : 64;
+		php3d_frame *frames = (php3d_frame *)realloc(stack->frames, cap * sizeof(php3d_frame));
+		if (!frames) return NULL;
+		stack->frames = frames;
+		stack->cap = cap;
+	}
+	return &stack->frames[stack->depth++];
+}
 
-typedef struct php3d_visit_info_s {
-	size_t room_index;
-	size_t visit_count;
-} php3d_visit_info;
+// Frames that never got their end handler (e.g. after a bailout) are popped along with the frame
+static zend_always_inline php3d_frame *php3d_stack_pop(zend_execute_data *execute_data) {
+	php3d_stack *stack = &php3d_frames;
+	for (size_t depth = stack->depth; depth > 0; depth--) {
+		if (stack->frames[depth - 1].execute_data == execute_data) {
+			stack->depth = depth - 1;
+			return &stack->frames[depth - 1];
+		}
+	}
+	return NULL;
+}
 
-ZEND_TLS sketchup_town php3d_town;
-ZEND_TLS size_t php3d_room_next_index;
-ZEND_TLS php3d_visit_info php3d_room_visit_info[SUP_MAX_ROOMS];
+static void php3d_stack_free(void) {
+	free(php3d_frames.frames);
+	memset(&php3d_frames, 0, sizeof(php3d_stack));
+}
+
+static void php3d_registry_free(void) {
+	memset(&php3d_functions, 0, sizeof(php3d_registry));
+	memset(&php3d_slots, 0, sizeof(php3d_slot_table));
+	memset(&php3d_samples, 0, sizeof(php3d_folded_table));
+	memset(&php3d_edges, 0, sizeof(php3d_edge_table));
+	arena_reset(&php3d_arena);
+}
 
 void static php3d_zval_to_sval(zval *zval, sketchup_val *sval) {
 	sval->ptr = NULL;
@@ -76,100 +325,1319 @@ void static php3d_zval_to_sval(zval *zval, sketchup_val *sval) {
 	}
 }
 
-void static php3d_cv_to_3d(zend_execute_data *execute_data, size_t room_index, size_t visit_index) {
-	if (!EX(func)) return;
-	size_t cv_count = (size_t) EX(func)->op_array.last_var;
-	if (!cv_count) return;
+static zend_always_inline uint64_t php3d_zval_fingerprint(zval *zv) {
+	switch (Z_TYPE_P(zv)) {
+		case IS_LONG:
+			return (uint64_t) Z_LVAL_P(zv);
+		case IS_DOUBLE: {
+			uint64_t bits;
+			memcpy(&bits, &Z_DVAL_P(zv), sizeof(bits));
+			return bits;
+		}
+		case IS_ARRAY:
+			// Arrays are often modified in place, so the element count is part of their identity
+			return (uint64_t) (uintptr_t) Z_ARR_P(zv) ^ ((uint64_t) zend_hash_num_elements(Z_ARR_P(zv)) << 48);
+		case IS_STRING:
+		case IS_OBJECT:
+		case IS_RESOURCE:
+		case IS_REFERENCE:
+			return (uint64_t) (uintptr_t) Z_PTR_P(zv);
+		default:
+			return 0;
+	}
+}
+
+// Budgets of the deep capture of a single value, the request as a whole has php_3d.capture_max_bytes
+typedef struct php3d_capture_s {
+	zend_long elements_left;
+	uint32_t max_depth;
+	uint32_t depth;
+	uint32_t flags;
+	uint32_t path_len;
+	// The containers between the captured value and the one being walked, a cycle leads back into them.
+	// An object and its dynamic properties take two entries.
+	const void *path[PHP3D_CAPTURE_MAX_DEPTH * 2];
+	// Only collected for the captured value itself
+	trace_shape_child *children;
+	uint32_t child_count;
+	uint32_t max_children;
+	size_t key_bytes;
+} php3d_capture;
+
+static uint64_t php3d_capture_value(zval *zv, php3d_capture *capture, uint32_t level);
+
+static void php3d_capture_key(php3d_capture *capture, zend_string *key, zend_ulong h, bool property, zval *val) {
+	char buf[MAX_LENGTH_OF_LONG + 1];
+	const char *str = buf;
+	size_t len;
+	if (key) {
+		str = property ? zend_get_unmangled_property_name(key) : ZSTR_VAL(key);
+		len = property ? strlen(str) : ZSTR_LEN(key);
+	} else {
+		len = (size_t) snprintf(buf, sizeof(buf), ZEND_LONG_FMT, (zend_long) h);
+	}
+	trace_shape_child *child = &capture->children[capture->child_count];
+	if (!trace_intern(php3d_trace, str, len, &child->name_id)) return;
+	sketchup_val sval = SKETCHUP_NULL;
+	php3d_zval_to_sval(val, &sval);
+	child->val_type = (uint32_t) sval.type;
+	capture->child_count++;
+	capture->key_bytes += len;
+}
+
+// Walks one level of a container; counts past the element budget are extrapolated from what was seen
+static uint64_t php3d_capture_element(php3d_capture *capture, uint32_t level, zend_string *key, zend_ulong h, bool property, zval *val) {
+	if (level == 1 && capture->child_count < capture->max_children) {
+		php3d_capture_key(capture, key, h, property, val);
+	}
+	uint64_t bytes = (key && !ZSTR_IS_INTERNED(key)) ? _ZSTR_STRUCT_SIZE(ZSTR_LEN(key)) : 0;
+	return bytes + php3d_capture_value(val, capture, level);
+}
+
+static bool php3d_capture_enter(php3d_capture *capture, const void *container, uint32_t level) {
+	for (uint32_t i = 0; i < capture->path_len; i++) {
+		if (capture->path[i] == container) {
+			capture->flags |= SKETCHUP_SHAPE_CYCLE;
+			return false;
+		}
+	}
+	capture->depth = MAX(capture->depth, level + 1);
+	if (level + 1 >= capture->max_depth) {
+		capture->flags |= SKETCHUP_SHAPE_TRUNCATED;
+		return false;
+	}
+	capture->path[capture->path_len++] = container;
+	return true;
+}
+
+static uint64_t php3d_capture_table(HashTable *ht, php3d_capture *capture, uint32_t level, bool property) {
+	// What the table itself occupies, the values of its elements live in it
+#if PHP_VERSION_ID >= 80200
+	uint64_t bytes = sizeof(HashTable) + (uint64_t) ht->nTableSize * (HT_IS_PACKED(ht) ? sizeof(zval) : sizeof(Bucket));
+#else
+	uint64_t bytes = sizeof(HashTable) + (uint64_t) ht->nTableSize * sizeof(Bucket);
+#endif
+	uint32_t count = zend_hash_num_elements(ht);
+	if (!count || !php3d_capture_enter(capture, ht, level)) return bytes;
+
+	uint32_t seen = 0;
+	uint64_t nested = 0;
+	zend_string *key;
+	zend_ulong h;
+	zval *val;
+	ZEND_HASH_FOREACH_KEY_VAL(ht, h, key, val) {
+		// Declared properties are walked through the object's slots
+		if (Z_TYPE_P(val) == IS_INDIRECT) continue;
+		if (capture->elements_left <= 0) {
+			capture->flags |= SKETCHUP_SHAPE_TRUNCATED;
+			break;
+		}
+		capture->elements_left--;
+		seen++;
+		nested += php3d_capture_element(capture, level + 1, key, h, property, val);
+	} ZEND_HASH_FOREACH_END();
+	capture->path_len--;
+
+	if (seen && seen < count) {
+		nested = nested / seen * count;
+	}
+	return bytes + nested;
+}
+
+static uint64_t php3d_capture_object(zend_object *obj, php3d_capture *capture, uint32_t level) {
+	zend_class_entry *ce = obj->ce;
+	uint64_t bytes = sizeof(zend_object) + (uint64_t) ce->default_properties_count * sizeof(zval);
+	if (!ce->default_properties_count && !obj->properties) return bytes;
+	// Anything but the standard handlers could run code or build a properties table to answer
+	if (obj->handlers->get_properties != zend_std_get_properties || !php3d_capture_enter(capture, obj, level)) {
+		return bytes;
+	}
+
+	for (int i = 0; i < ce->default_properties_count; i++) {
+		zval *val = OBJ_PROP_NUM(obj, i);
+		zend_property_info *info = ce->properties_info_table[i];
+		if (Z_TYPE_P(val) == IS_UNDEF || !info) continue;
+		if (capture->elements_left <= 0) {
+			capture->flags |= SKETCHUP_SHAPE_TRUNCATED;
+			break;
+		}
+		capture->elements_left--;
+		bytes += php3d_capture_element(capture, level + 1, info->name, 0, true, val);
+	}
+	// Dynamic properties
+	if (obj->properties) {
+		bytes += php3d_capture_table(obj->properties, capture, level, true);
+	}
+	capture->path_len--;
+	return bytes;
+}
+
+static uint64_t php3d_capture_value(zval *zv, php3d_capture *capture, uint32_t level) {
+	ZVAL_DEREF(zv);
+	switch (Z_TYPE_P(zv)) {
+		case IS_STRING:
+			return ZSTR_IS_INTERNED(Z_STR_P(zv)) ? 0 : _ZSTR_STRUCT_SIZE(Z_STRLEN_P(zv));
+		case IS_ARRAY:
+			return php3d_capture_table(Z_ARRVAL_P(zv), capture, level, false);
+		case IS_OBJECT:
+			return php3d_capture_object(Z_OBJ_P(zv), capture, level);
+		default:
+			// Scalars live in the zval of their container
+			return 0;
+	}
+}
+
+// Appends a TRACE_SHAPE event for an array or object, which the TRACE_VAR that follows it refers to.
+// The cost is bounded by the budgets, not by the size of the value.
+static void php3d_capture_to_3d(zval *var, const trace_event *var_event) {
+	ZVAL_DEREF(var);
+	if (Z_TYPE_P(var) != IS_ARRAY && Z_TYPE_P(var) != IS_OBJECT) return;
+	if (php3d_capture_bytes >= (size_t) PHP3D_G(capture_max_bytes)) {
+		php3d_stats.captures_skipped++;
+		return;
+	}
+
+	trace_shape_child children[TRACE_SHAPE_MAX_CHILDREN];
+	php3d_capture capture = {
+		.elements_left = PHP3D_G(capture_max_elements),
+		.max_depth = (uint32_t) MIN(MAX(PHP3D_G(capture_max_depth), 1), PHP3D_CAPTURE_MAX_DEPTH),
+		.children = children,
+		.max_children = (uint32_t) MIN(MAX(PHP3D_G(capture_max_keys), 0), TRACE_SHAPE_MAX_CHILDREN),
+	};
+	trace_shape shape = {0};
+	shape.bytes = php3d_capture_value(var, &capture, 0);
+	if (Z_TYPE_P(var) == IS_ARRAY) {
+		shape.count = zend_hash_num_elements(Z_ARRVAL_P(var));
+	} else {
+		zend_object *obj = Z_OBJ_P(var);
+		shape.count = obj->properties ? zend_hash_num_elements(obj->properties) : (uint64_t) obj->ce->default_properties_count;
+	}
+	shape.depth = capture.depth;
+	shape.flags = capture.flags;
+	shape.child_count = capture.child_count;
+
+	uint32_t shape_id = 0;
+	if (!trace_add_shape(php3d_trace, &shape, children, &shape_id)) {
+		php3d_failure("[php_3d] Failed to record variable shape");
+		return;
+	}
+	php3d_capture_bytes += sizeof(trace_shape) + capture.child_count * sizeof(trace_shape_child) + capture.key_bytes;
+
+	trace_event event = {
+		.type = TRACE_SHAPE,
+		.room_index = var_event->room_index,
+		.visit_index = var_event->visit_index,
+		.var_index = shape_id,
+	};
+	if (!trace_append(php3d_trace, &event)) {
+		php3d_failure("[php_3d] Failed to record variable shape");
+	}
+}
+
+void static php3d_cv_to_3d(zend_execute_data *execute_data, php3d_function *fn, size_t visit_index) {
+	if (!fn->cv_count) return;
 
-	zend_string **cv_names = EX(func)->op_array.vars;
 	zval *var = ZEND_CALL_VAR_NUM(execute_data, 0);
 
-	for (size_t i = 0; i < cv_count; i++) {
+	// In delta mode only the CVs that changed since the room's last visit are recorded, the others
+	// are referenced by their index and the floor inherits the value they were last recorded with.
+	php3d_fingerprint *snapshot = NULL;
+	if (PHP3D_G(delta_snapshots)) {
+		if (!fn->snapshot) {
+			fn->snapshot = arena_alloc(&php3d_arena, sizeof(php3d_fingerprint) * fn->cv_count);
+			if (fn->snapshot) {
+				for (uint32_t i = 0; i < fn->cv_count; i++) {
+					fn->snapshot[i].type = PHP3D_FINGERPRINT_NONE;
+				}
+			}
+		}
+		snapshot = fn->snapshot;
+	}
+
+	trace_event event = {
+		.type = TRACE_VAR,
+		.room_index = fn->room_index,
+		.visit_index = (uint32_t) visit_index,
+	};
+	for (uint32_t i = 0; i < fn->cv_count; i++, var++) {
+		sketchup_val sval = SKETCHUP_NULL;
+		php3d_zval_to_sval(var, &sval);
+		if (snapshot) {
+			uint64_t value = php3d_zval_fingerprint(var);
+			if (snapshot[i].type == (uint32_t) sval.type && snapshot[i].value == value) {
+				trace_event same = {
+					.type = TRACE_VAR_SAME,
+					.room_index = fn->room_index,
+					.visit_index = (uint32_t) visit_index,
+					.var_index = i,
+				};
+				if (UNEXPECTED(!trace_append(php3d_trace, &same))) {
+					php3d_failure("[php_3d] Failed to record variable");
+				}
+				continue;
+			}
+			snapshot[i].type = (uint32_t) sval.type;
+			snapshot[i].value = value;
+		}
+		event.val_type = (uint8_t) sval.type;
+		event.var_index = i;
+		event.name_id = fn->cv_name_ids[i];
+		if (PHP3D_G(deep_capture)) {
+			php3d_capture_to_3d(var, &event);
+		}
+		if (EXPECTED(trace_append(php3d_trace, &event))) {
+			php3d_stats.variables++;
+		} else {
+			php3d_failure("[php_3d] Failed to record variable");
+		}
+	}
+}
+
+// Folds a visit past the floor cap into the room's summary instead of the trace, so that a hot
+// loop or deep recursion costs constant trace memory
+static void php3d_cv_summarize(zend_execute_data *execute_data, php3d_function *fn) {
+	fn->summary_calls++;
+	if (!fn->cv_count) return;
+	if (!fn->summary_vars) {
+		fn->summary_vars = arena_calloc(&php3d_arena, fn->cv_count, sizeof(trace_var_summary));
+		if (!fn->summary_vars) return;
+		for (uint32_t i = 0; i < fn->cv_count; i++) {
+			fn->summary_vars[i].name_id = fn->cv_name_ids[i];
+		}
+	}
+
+	zval *var = ZEND_CALL_VAR_NUM(execute_data, 0);
+	for (uint32_t i = 0; i < fn->cv_count; i++, var++) {
+		trace_var_summary *summary = &fn->summary_vars[i];
 		sketchup_val sval = SKETCHUP_NULL;
 		php3d_zval_to_sval(var, &sval);
-		if (!sketchup_room_append_variable(php3d_town, room_index, visit_index, i, ZSTR_VAL(cv_names[i]), sval)) {
-			php_log_err("[php_3d] Failed to append variable to room");
+		summary->types[sval.type]++;
+
+		zval *val = var;
+		ZVAL_DEREF(val);
+		double num;
+		if (Z_TYPE_P(val) == IS_LONG) {
+			num = (double) Z_LVAL_P(val);
+		} else if (Z_TYPE_P(val) == IS_DOUBLE) {
+			num = Z_DVAL_P(val);
+		} else {
+			continue;
+		}
+		if (!summary->has_range) {
+			summary->has_range = true;
+			summary->min = summary->max = num;
+		} else {
+			summary->min = MIN(summary->min, num);
+			summary->max = MAX(summary->max, num);
+		}
+	}
+}
+
+static php3d_function *php3d_function_ctor(zend_execute_data *execute_data, zend_class_entry *called_scope, uint32_t *index) {
+	zend_function *func = EX(func);
+	// Only user code has compiled variables
+	uint32_t cv_count = ZEND_USER_CODE(func->type) ? (uint32_t) func->op_array.last_var : 0;
+
+	zend_string *fqn;
+	if (func->common.function_name) {
+		if (called_scope) {
+			fqn = zend_string_concat3(
+				ZSTR_VAL(called_scope->name), ZSTR_LEN(called_scope->name),
+				"::", 2,
+				ZSTR_VAL(func->common.function_name), ZSTR_LEN(func->common.function_name)
+			);
+		} else {
+			fqn = zend_string_copy(func->common.function_name);
+		}
+	} else {
+		fqn = zend_string_concat3("{main}", 6, ":", 1, ZSTR_VAL(func->op_array.filename), ZSTR_LEN(func->op_array.filename));
+	}
+
+	// Handles only have half a pointer for the index
+	if (UNEXPECTED(php3d_functions.count >= PHP3D_HANDLE_INDEX_MASK)) {
+		zend_string_release(fqn);
+		return NULL;
+	}
+
+	aggregate_entry *aggregate = NULL;
+	if (php3d_output_aggregate) {
+		const char *var_names[AGGREGATE_MAX_VARS];
+		size_t var_lens[AGGREGATE_MAX_VARS];
+		uint32_t var_count = MIN(cv_count, AGGREGATE_MAX_VARS);
+		for (uint32_t i = 0; i < var_count; i++) {
+			var_names[i] = ZSTR_VAL(func->op_array.vars[i]);
+			var_lens[i] = ZSTR_LEN(func->op_array.vars[i]);
+		}
+		aggregate = aggregate_entry_get(ZSTR_VAL(fqn), ZSTR_LEN(fqn), var_names, var_lens, var_count);
+	}
+
+	uint32_t name_id = 0;
+	uint32_t *cv_name_ids = cv_count ? arena_alloc(&php3d_arena, sizeof(uint32_t) * cv_count) : NULL;
+	bool ok = (!cv_count || cv_name_ids) && trace_intern(php3d_trace, ZSTR_VAL(fqn), ZSTR_LEN(fqn), &name_id);
+	zend_string_release(fqn);
+	for (uint32_t i = 0; ok && i < cv_count; i++) {
+		ok = trace_intern(php3d_trace, ZSTR_VAL(func->op_array.vars[i]), ZSTR_LEN(func->op_array.vars[i]), &cv_name_ids[i]);
+	}
+	if (!ok) return NULL;
+
+	php3d_function *fn = php3d_registry_add(index);
+	if (!fn) return NULL;
+	php3d_stats.rooms++;
+	fn->func = func;
+	fn->called_scope = called_scope;
+	fn->next_scope = 0;
+	fn->name_id = name_id;
+	// Rooms are numbered in the order their functions are first called
+	fn->room_index = *index;
+	fn->visit_count = 0;
+	fn->cv_count = cv_count;
+	fn->cv_name_ids = cv_name_ids;
+	fn->snapshot = NULL;
+	memset(&fn->profile, 0, sizeof(sketchup_room_profile));
+	fn->summary_calls = 0;
+	fn->summary_vars = NULL;
+	fn->aggregate = aggregate;
+	return fn;
+}
+
+// Counts the types the CVs have on return, without looking at their values
+static void php3d_cv_aggregate(zend_execute_data *execute_data, php3d_function *fn) {
+	if (!fn->aggregate) return;
+	uint32_t var_count = MIN(fn->cv_count, fn->aggregate->var_count);
+	zval *var = ZEND_CALL_VAR_NUM(execute_data, 0);
+	for (uint32_t i = 0; i < var_count; i++, var++) {
+		sketchup_val sval = SKETCHUP_NULL;
+		php3d_zval_to_sval(var, &sval);
+		aggregate_var_type(fn->aggregate, i, sval.type);
+	}
+}
+
+static zend_always_inline size_t php3d_slot_of(const php3d_slot_table *table, const zend_function *func) {
+	size_t slot = (size_t) ((((uintptr_t) func >> 3) * 0x9E3779B97F4A7C15ULL) >> 32) & (table->cap - 1);
+	while (table->funcs[slot] && table->funcs[slot] != func) slot = (slot + 1) & (table->cap - 1);
+	return slot;
+}
+
+static void **php3d_slot_table_get(zend_function *func) {
+	php3d_slot_table *table = &php3d_slots;
+	if ((table->count + 1) * 2 > table->cap) {
+		php3d_slot_table grown = {.cap = table->cap ? table->cap * 2 : 64, .count = table->count};
+		grown.funcs = arena_calloc(&php3d_arena, grown.cap, sizeof(zend_function *));
+		grown.handles = arena_calloc(&php3d_arena, grown.cap, sizeof(void *));
+		if (!grown.funcs || !grown.handles) return NULL;
+		for (size_t i = 0; i < table->cap; i++) {
+			if (!table->funcs[i]) continue;
+			size_t slot = php3d_slot_of(&grown, table->funcs[i]);
+			grown.funcs[slot] = table->funcs[i];
+			grown.handles[slot] = table->handles[i];
+		}
+		// The old table stays in the arena until the request is over
+		*table = grown;
+	}
+	size_t slot = php3d_slot_of(table, func);
+	if (!table->funcs[slot]) {
+		table->funcs[slot] = func;
+		table->count++;
+	}
+	return &table->handles[slot];
+}
+
+// Where the handle of the function is kept: its run-time cache slot, or the slot table without one
+static zend_always_inline void **php3d_function_slot(zend_function *func) {
+	if (EXPECTED(ZEND_USER_CODE(func->type))) {
+		return &PHP3D_OP_ARRAY_EXTENSION(&func->op_array);
+	}
+#if PHP_VERSION_ID >= 80200
+	void **cache = RUN_TIME_CACHE(&func->common);
+	if (EXPECTED(cache)) {
+		return &cache[php3d_internal_function_extension];
+	}
+#endif
+	return php3d_slot_table_get(func);
+}
+
+static zend_always_inline php3d_function *php3d_function_get(zend_execute_data *execute_data, bool create) {
+	zend_function *func = EX(func);
+	zend_class_entry *called_scope = NULL;
+	if (func->common.scope && func->common.function_name) {
+		called_scope = zend_get_called_scope(execute_data);
+	}
+
+	void **slot = php3d_function_slot(func);
+	if (UNEXPECTED(!slot)) return NULL;
+	uintptr_t handle = (uintptr_t) *slot;
+	uint32_t head = 0;
+	if (
+		EXPECTED(handle >> PHP3D_HANDLE_SHIFT == ((uintptr_t) php3d_epoch & PHP3D_HANDLE_INDEX_MASK))
+		&& EXPECTED((handle & PHP3D_HANDLE_INDEX_MASK) <= php3d_functions.count)
+	) {
+		head = (uint32_t) (handle & PHP3D_HANDLE_INDEX_MASK);
+	}
+
+	for (uint32_t next = head; next; ) {
+		php3d_function *fn = php3d_registry_at(next - 1);
+		// Guards against a stale handle of an epoch that has wrapped around
+		if (UNEXPECTED(fn->func != func)) {
+			head = 0;
+			break;
 		}
-		var++;
+		if (fn->called_scope == called_scope) return fn;
+		next = fn->next_scope;
+	}
+	if (!create) return NULL;
+
+	uint32_t index = 0;
+	php3d_function *fn = php3d_function_ctor(execute_data, called_scope, &index);
+	if (fn) {
+		fn->next_scope = head;
+		*slot = PHP3D_HANDLE(php3d_epoch, index);
 	}
+	return fn;
+}
+
+static zend_always_inline size_t php3d_edge_slot(uint32_t caller, uint32_t callee, size_t cap) {
+	uint64_t hash = (((uint64_t) caller << 32) | callee) * 0x9E3779B97F4A7C15ULL;
+	return (size_t) (hash >> 32) & (cap - 1);
+}
+
+static bool php3d_edge_grow(php3d_edge_table *table) {
+	size_t cap = table->cap ? table->cap * 2 : 256;
+	uint32_t *slots = arena_calloc(&php3d_arena, cap, sizeof(uint32_t));
+	trace_edge *edges = arena_alloc(&php3d_arena, cap / 2 * sizeof(trace_edge));
+	if (!slots || !edges) return false;
+	if (table->count) {
+		memcpy(edges, table->edges, table->count * sizeof(trace_edge));
+	}
+	for (size_t i = 0; i < table->count; i++) {
+		size_t slot = php3d_edge_slot(edges[i].caller, edges[i].callee, cap);
+		while (slots[slot]) slot = (slot + 1) & (cap - 1);
+		slots[slot] = (uint32_t) i + 1;
+	}
+	// The old tables stay in the arena until the request is over
+	table->edges = edges;
+	table->slots = slots;
+	table->cap = cap;
+	return true;
+}
+
+// Returns the index + 1 of the edge, which is added if it is new, or 0 if it could not be added
+static zend_always_inline uint32_t php3d_edge_get(uint32_t caller, uint32_t callee) {
+	php3d_edge_table *table = &php3d_edges;
+	if (table->cap) {
+		for (size_t slot = php3d_edge_slot(caller, callee, table->cap); table->slots[slot]; slot = (slot + 1) & (table->cap - 1)) {
+			const trace_edge *edge = &table->edges[table->slots[slot] - 1];
+			if (edge->caller == caller && edge->callee == callee) return table->slots[slot];
+		}
+	}
+	if (UNEXPECTED((table->count + 1) * 2 > table->cap) && !php3d_edge_grow(table)) return 0;
+
+	size_t slot = php3d_edge_slot(caller, callee, table->cap);
+	while (table->slots[slot]) slot = (slot + 1) & (table->cap - 1);
+	table->edges[table->count] = (trace_edge) {.caller = caller, .callee = callee};
+	table->slots[slot] = (uint32_t) ++table->count;
+	return table->slots[slot];
+}
+
+static void php3d_segment_flush_if_due(void);
+
+static zend_always_inline void php3d_segment_check(void) {
+	if (UNEXPECTED(php3d_flushing && php3d_trace->event_count >= php3d_flush_check_at)) {
+		php3d_segment_flush_if_due();
+	}
+}
+
+static zend_always_inline bool php3d_floor_capped(uint32_t visit_index) {
+	return PHP3D_G(max_floors) > 0 && visit_index >= (zend_ulong) PHP3D_G(max_floors);
 }
 
 void php3d_fcall_begin_handler(zend_execute_data *execute_data) {
-	if (EX(func) && PHP3D_G(generate_model) && php3d_town.ptr) {
-		// TODO Snapshot vars of pre_execute_data
-		char *scope = "";
-		char *sep = "";
-		char *fname = "";
-		if (EX(func)->common.function_name) {
-			if (EX(func)->common.scope) {
-				zend_class_entry *ce = zend_get_called_scope(execute_data);
-				if (ce) {
-					scope = ZSTR_VAL(ce->name);
-					sep = "::";
-				}
+	// The only work done while php_3d_stop() has paused the recording
+	if (!PHP3D_G(recording)) return;
+	if (EX(func) && php3d_trace) {
+		php3d_segment_check();
+		php3d_function *fn = php3d_function_get(execute_data, true);
+		php3d_frame *frame = fn ? php3d_stack_push() : NULL;
+		if (!frame) {
+			php3d_failure("[php_3d] Failed to append room to town");
+			return;
+		}
+		frame->execute_data = execute_data;
+		frame->fn = fn;
+		frame->visit_index = fn->visit_count++;
+		if (php3d_output_aggregate) {
+			if (EXPECTED(fn->aggregate)) {
+				aggregate_call(fn->aggregate, php3d_frames.depth - 1);
+			} else {
+				aggregate_drop();
+			}
+			return;
+		}
+		// Calls through functions that are not observed count for the nearest observed caller
+		frame->edge = 0;
+		if (PHP3D_G(call_graph) && php3d_frames.depth > 1) {
+			frame->edge = php3d_edge_get(php3d_frames.frames[php3d_frames.depth - 2].fn->room_index, fn->room_index);
+			if (EXPECTED(frame->edge)) {
+				php3d_edges.edges[frame->edge - 1].calls++;
 			}
-			fname = ZSTR_VAL(EX(func)->common.function_name);
+		}
+		if (PHP3D_G(heatmap)) {
+			frame->child_ns = 0;
+			frame->start_memory = zend_memory_usage(false);
+			frame->start_ns = clock_now_ns();
+		}
+		if (php3d_floor_capped(frame->visit_index)) {
+			php3d_stats.floors_folded++;
+			return;
+		}
+
+		trace_event event = {
+			.type = TRACE_ROOM_ENTER,
+			.name_id = fn->name_id,
+			.room_index = fn->room_index,
+			.visit_index = frame->visit_index,
+		};
+		if (EXPECTED(trace_append(php3d_trace, &event))) {
+			php3d_stats.visits++;
 		} else {
-			scope = "{main}";
-			sep = ":";
-			fname = ZSTR_VAL(EX(func)->op_array.filename);
-		}
-		char fqn[256];
-		snprintf(fqn, sizeof(fqn), "%s%s%s", scope, sep, fname);
-
-		php3d_visit_info *visit = (php3d_visit_info *)PHP3D_OP_ARRAY_EXTENSION(&EX(func)->op_array);
-		if (!visit) {
-			visit = PHP3D_OP_ARRAY_EXTENSION(&EX(func)->op_array) = &php3d_room_visit_info[php3d_room_next_index];
-			visit->room_index = php3d_room_next_index;
-			visit->visit_count = 0;
-			php3d_room_next_index++;
+			php3d_failure("[php_3d] Failed to append room to town");
+		}
+	}
+}
+
+static void php3d_frame_profile(const php3d_frame *frame) {
+	uint64_t inclusive_ns = clock_now_ns() - frame->start_ns;
+	sketchup_room_profile *profile = &frame->fn->profile;
+	profile->calls++;
+	profile->inclusive_ns += inclusive_ns;
+	profile->exclusive_ns += inclusive_ns - MIN(frame->child_ns, inclusive_ns);
+	profile->memory_bytes += (int64_t) zend_memory_usage(false) - (int64_t) frame->start_memory;
+	if (frame->edge) {
+		php3d_edges.edges[frame->edge - 1].inclusive_ns += inclusive_ns;
+	}
+	// The popped frame is still in place, so the caller is right below it
+	if (php3d_frames.depth) {
+		php3d_frames.frames[php3d_frames.depth - 1].child_ns += inclusive_ns;
+	}
+}
+
+void php3d_fcall_end_handler(zend_execute_data *execute_data, zval *retval) {
+	if (!PHP3D_G(recording)) return;
+	if (EX(func) && php3d_trace) {
+		php3d_frame *frame = php3d_stack_pop(execute_data);
+		// Missing when the room could not be recorded
+		if (!frame) return;
+		php3d_function *fn = frame->fn;
+		if (php3d_output_aggregate) {
+			php3d_cv_aggregate(execute_data, fn);
+			return;
+		}
+		if (PHP3D_G(heatmap)) {
+			php3d_frame_profile(frame);
+		}
+		if (php3d_floor_capped(frame->visit_index)) {
+			php3d_cv_summarize(execute_data, fn);
+			return;
+		}
+		php3d_cv_to_3d(execute_data, fn, frame->visit_index);
+
+		trace_event event = {
+			.type = TRACE_ROOM_EXIT,
+			.room_index = fn->room_index,
+			.visit_index = frame->visit_index,
+		};
+		if (!trace_append(php3d_trace, &event)) {
+			php3d_failure("[php_3d] Failed to record room exit");
+		}
+	}
+}
+
+static void php3d_split_ns(zend_string *name, filter_subject *subject) {
+	const char *sep = zend_memrchr(ZSTR_VAL(name), '\\', ZSTR_LEN(name));
+	if (sep) {
+		subject->ns = ZSTR_VAL(name);
+		subject->ns_len = (size_t) (sep - ZSTR_VAL(name));
+	}
+}
+
+// Called once per function (and request) from the observer init, never on the hot path
+static bool php3d_function_observed(zend_execute_data *execute_data) {
+	zend_function *func = EX(func);
+	if (!func) return false;
+	// The main script is the town center
+	if (!func->common.function_name) return true;
+
+	if (PHP3D_G(min_depth) > 0) {
+		zend_long depth = 0;
+		for (zend_execute_data *prev = EX(prev_execute_data); prev; prev = prev->prev_execute_data) {
+			if (prev->func) depth++;
+		}
+		if (depth < PHP3D_G(min_depth)) return false;
+	}
+
+	if (filter_is_empty(&php3d_filter)) return true;
+
+	zend_string *fname = func->common.function_name;
+	zend_string *qualified = NULL;
+	filter_subject subject = {0};
+	if (func->common.scope) {
+		zend_string *cname = func->common.scope->name;
+		php3d_split_ns(cname, &subject);
+		subject.class_name = ZSTR_VAL(cname);
+		subject.class_name_len = ZSTR_LEN(cname);
+		subject.function = ZSTR_VAL(fname);
+		subject.function_len = ZSTR_LEN(fname);
+		qualified = zend_string_concat3(ZSTR_VAL(cname), ZSTR_LEN(cname), "::", 2, ZSTR_VAL(fname), ZSTR_LEN(fname));
+		subject.name = ZSTR_VAL(qualified);
+		subject.name_len = ZSTR_LEN(qualified);
+	} else {
+		php3d_split_ns(fname, &subject);
+		size_t skip = subject.ns ? subject.ns_len + 1 : 0;
+		subject.function = ZSTR_VAL(fname) + skip;
+		subject.function_len = ZSTR_LEN(fname) - skip;
+		subject.name = ZSTR_VAL(fname);
+		subject.name_len = ZSTR_LEN(fname);
+	}
+	if (ZEND_USER_CODE(func->type) && func->op_array.filename) {
+		subject.file = ZSTR_VAL(func->op_array.filename);
+		subject.file_len = ZSTR_LEN(func->op_array.filename);
+	}
+
+	bool observed = filter_allows(&php3d_filter, &subject);
+	if (qualified) {
+		zend_string_release(qualified);
+	}
+	return observed;
+}
+
+// Runs on the sampler thread, so it must not touch anything but the interrupt flags
+static void php3d_sample_tick(void *arg) {
+	php3d_sample_pending = true;
+#if PHP_VERSION_ID >= 80200
+	zend_atomic_bool_store((zend_atomic_bool *) arg, true);
+#else
+	*(volatile zend_bool *) arg = 1;
+#endif
+}
+
+static uint64_t php3d_folded_hash(const uint32_t *rooms, uint32_t depth) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (uint32_t i = 0; i < depth; i++) {
+		hash ^= rooms[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static bool php3d_folded_grow(php3d_folded_table *table) {
+	size_t cap = table->cap ? table->cap * 2 : 256;
+	php3d_folded **slots = arena_calloc(&php3d_arena, cap, sizeof(php3d_folded *));
+	if (!slots) return false;
+	for (size_t i = 0; i < table->cap; i++) {
+		php3d_folded *folded = table->slots[i];
+		if (!folded) continue;
+		size_t slot = folded->hash & (cap - 1);
+		while (slots[slot]) slot = (slot + 1) & (cap - 1);
+		slots[slot] = folded;
+	}
+	// The old slots stay in the arena until the request is over
+	table->slots = slots;
+	table->cap = cap;
+	return true;
+}
+
+static bool php3d_folded_add(const uint32_t *rooms, uint32_t depth) {
+	php3d_folded_table *table = &php3d_samples;
+	if ((table->count + 1) * 2 > table->cap && !php3d_folded_grow(table)) return false;
+
+	uint64_t hash = php3d_folded_hash(rooms, depth);
+	size_t mask = table->cap - 1;
+	size_t slot = hash & mask;
+	while (table->slots[slot]) {
+		php3d_folded *folded = table->slots[slot];
+		if (folded->hash == hash && folded->depth == depth && memcmp(folded->rooms, rooms, depth * sizeof(uint32_t)) == 0) {
+			folded->count++;
+			return true;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	php3d_folded *folded = arena_alloc(&php3d_arena, sizeof(php3d_folded) + depth * sizeof(uint32_t));
+	if (!folded) return false;
+	folded->hash = hash;
+	folded->count = 1;
+	folded->depth = depth;
+	memcpy(folded->rooms, rooms, depth * sizeof(uint32_t));
+	table->slots[slot] = folded;
+	table->count++;
+	return true;
+}
+
+// Only the innermost PHP3D_SAMPLE_MAX_DEPTH frames are kept, which bounds the cost of a sample
+static void php3d_sample(zend_execute_data *execute_data) {
+	zend_execute_data *frames[PHP3D_SAMPLE_MAX_DEPTH];
+	uint32_t rooms[PHP3D_SAMPLE_MAX_DEPTH];
+	uint32_t depth = 0;
+	zend_execute_data *ex = execute_data;
+	for (; ex && depth < PHP3D_SAMPLE_MAX_DEPTH; ex = ex->prev_execute_data) {
+		if (ex->func) frames[depth++] = ex;
+	}
+	// Rooms are numbered in the order they are registered, and room 0 is the town center. The
+	// first sample of a segment registers the root frame first, also when it is past the kept frames.
+	if (!php3d_functions.count && ex) {
+		zend_execute_data *root = NULL;
+		for (; ex; ex = ex->prev_execute_data) {
+			if (ex->func) root = ex;
+		}
+		if (root && !php3d_function_get(root, true)) return;
+	}
+	// Outermost first, like php3d_segment_rebind()
+	for (uint32_t d = 0; d < depth; d++) {
+		php3d_function *fn = php3d_function_get(frames[depth - 1 - d], true);
+		if (!fn) return;
+		rooms[d] = fn->room_index;
+	}
+	if (depth && !php3d_folded_add(rooms, depth)) {
+		php3d_failure("[php_3d] Failed to record sample");
+	}
+}
+
+static void php3d_interrupt_function(zend_execute_data *execute_data) {
+	if (php3d_sample_pending) {
+		php3d_sample_pending = false;
+		if (php3d_trace && execute_data && PHP3D_G(recording)) {
+			php3d_sample(execute_data);
+		}
+		// Samples only become events at the end of a segment, so only the time policy applies here
+		if (php3d_flushing && php3d_trace && PHP3D_G(recording)) {
+			php3d_segment_flush_if_due();
+		}
+	}
+	if (php3d_prev_interrupt_function) {
+		php3d_prev_interrupt_function(execute_data);
+	}
+}
+
+// Turns the folded stacks into one visit per sampled room; the leaf of a stack gets the exclusive
+// samples, every distinct room on it the inclusive ones
+static void php3d_samples_to_3d(void) {
+	for (size_t i = 0; i < php3d_samples.cap; i++) {
+		php3d_folded *folded = php3d_samples.slots[i];
+		if (!folded) continue;
+		for (uint32_t d = 0; d < folded->depth; d++) {
+			bool seen = false;
+			for (uint32_t p = 0; p < d && !seen; p++) {
+				seen = folded->rooms[p] == folded->rooms[d];
+			}
+			sketchup_room_profile *profile = &php3d_registry_at(folded->rooms[d])->profile;
+			if (!seen) {
+				profile->samples += folded->count;
+				profile->inclusive_ns += folded->count * php3d_sample_period_ns;
+			}
+			if (d == folded->depth - 1) {
+				profile->exclusive_ns += folded->count * php3d_sample_period_ns;
+			}
+			// Sampled roads are as busy as the stacks that went through them
+			uint32_t edge = (d && PHP3D_G(call_graph)) ? php3d_edge_get(folded->rooms[d - 1], folded->rooms[d]) : 0;
+			if (edge) {
+				php3d_edges.edges[edge - 1].calls += folded->count;
+				php3d_edges.edges[edge - 1].inclusive_ns += folded->count * php3d_sample_period_ns;
+			}
+		}
+	}
+
+	for (uint32_t i = 0; i < php3d_functions.count; i++) {
+		php3d_function *fn = php3d_registry_at(i);
+		if (!fn->profile.samples) continue;
+		trace_event enter = {
+			.type = TRACE_ROOM_ENTER,
+			.name_id = fn->name_id,
+			.room_index = fn->room_index,
+		};
+		trace_event exit = {
+			.type = TRACE_ROOM_EXIT,
+			.room_index = fn->room_index,
+		};
+		if (!trace_append(php3d_trace, &enter) || !trace_append(php3d_trace, &exit)) {
+			php3d_failure("[php_3d] Failed to append room to town");
+			return;
+		}
+		php3d_stats.visits++;
+	}
+}
+
+// Expands %p (pid), %t (unix time), %s (number of the file within the process) and %% of
+// php_3d.output_file. Segments and the requests of ZTS threads always get a number, so that they
+// don't overwrite each other.
+static void php3d_output_name(char *buf, size_t size) {
+	uint64_t seq = PHP3D_COUNT(php3d_output_seq);
+	bool has_seq = false;
+	size_t len = 0;
+	for (const char *p = PHP3D_G(output_file); *p && len < size; p++) {
+		int n = 1;
+		if (p[0] != '%' || !p[1]) {
+			buf[len] = p[0];
+		} else if (p[1] == 'p') {
+			n = snprintf(buf + len, size - len, "%ld", (long) getpid());
+		} else if (p[1] == 't') {
+			n = snprintf(buf + len, size - len, "%lld", (long long) time(NULL));
+		} else if (p[1] == 's') {
+			n = snprintf(buf + len, size - len, "%" PRIu64, seq);
+			has_seq = true;
 		} else {
-			visit->visit_count++;
+			buf[len] = p[1];
 		}
+		p += (p[0] == '%' && p[1]) ? 1 : 0;
+		len += (size_t) MAX(n, 0);
+	}
+	len = MIN(len, size - 1);
+	if (PHP3D_OUTPUT_SEQ_REQUIRED && !has_seq) {
+		snprintf(buf + len, size - len, ".%" PRIu64 ".%s", seq, php3d_output_extension);
+	} else {
+		snprintf(buf + len, size - len, ".%s", php3d_output_extension);
+	}
+}
+
+static bool php3d_segment_start(void) {
+	// Invalidates every handle that was handed out before in O(1)
+	php3d_epoch++;
+	php3d_capture_bytes = 0;
+	if (!php3d_arena.chunk_size) {
+		arena_init(&php3d_arena, 32 * 1024);
+	}
+	php3d_trace = trace_ctor();
+	if (!php3d_trace) {
+		php3d_failure("[php_3d] Failed to ctor trace");
+		return false;
+	}
+	if (php3d_flushing) {
+		php3d_segment_start_ns = clock_now_ns();
+		php3d_flush_check_at = PHP3D_FLUSH_CHECK_EVENTS;
+	}
+	// Every segment is a town of its own, with the same label
+	if (PHP3D_G(label) && !trace_set_label(php3d_trace, ZSTR_VAL(PHP3D_G(label)), ZSTR_LEN(PHP3D_G(label)))) {
+		php3d_failure("[php_3d] Failed to record label");
+	}
+	return true;
+}
 
-		if (!sketchup_town_append_room(php3d_town, fqn, visit->room_index, visit->visit_count)) {
-			php_log_err("[php_3d] Failed to append room to town");
+// Adds the summaries and profiles of the rooms to the trace and hands it to the writer, which
+// builds the town or saves the trace off the request thread
+static void php3d_segment_finish(void) {
+	// An aggregate keeps nothing in the trace but the interned names
+	if (php3d_output_aggregate) {
+		php3d_registry_free();
+		if (php3d_trace) {
+			trace_dtor(php3d_trace);
+			php3d_trace = NULL;
 		}
+		return;
+	}
+	if (php3d_trace && php3d_sampling) {
+		php3d_samples_to_3d();
+	}
+	if (php3d_trace) {
+		for (uint32_t i = 0; i < php3d_functions.count; i++) {
+			php3d_function *fn = php3d_registry_at(i);
+			if (!fn->summary_calls) continue;
+			trace_summary summary = {
+				.room_index = fn->room_index,
+				.visit_index = (uint32_t) PHP3D_G(max_floors),
+				.calls = fn->summary_calls,
+				.var_count = fn->summary_vars ? fn->cv_count : 0,
+			};
+			if (!trace_add_summary(php3d_trace, &summary, fn->summary_vars)) {
+				php3d_failure("[php_3d] Failed to record summary floor");
+				break;
+			}
+		}
+	}
+	if (php3d_edges.count && php3d_trace && !trace_set_edges(php3d_trace, php3d_edges.edges, php3d_edges.count)) {
+		php3d_failure("[php_3d] Failed to record call graph");
+	}
+	if ((PHP3D_G(heatmap) || php3d_sampling) && php3d_trace) {
+		for (uint32_t i = 0; i < php3d_functions.count; i++) {
+			php3d_function *fn = php3d_registry_at(i);
+			if ((fn->profile.calls || fn->profile.samples) && !trace_set_profile(php3d_trace, fn->room_index, &fn->profile)) {
+				php3d_failure("[php_3d] Failed to record profile");
+				break;
+			}
+		}
+	}
+	php3d_registry_free();
+
+	if (php3d_trace) {
+		char file[MAXPATHLEN];
+		php3d_output_name(file, sizeof(file));
+		// The writer owns the trace from here on. A full queue drops it as configured, which is only
+		// counted by the writer.
+		if (writer_enqueue(php3d_trace, file) == WRITER_FAILED) {
+			php3d_failure("[php_3d] Failed to queue town for writing");
+		}
+		php3d_trace = NULL;
 	}
 }
 
-void php3d_fcall_end_handler(zend_execute_data *execute_data, zval *retval) {
-	if (EX(func) && PHP3D_G(generate_model) && php3d_town.ptr) {
-		php3d_visit_info *visit = (php3d_visit_info *)PHP3D_OP_ARRAY_EXTENSION(&EX(func)->op_array);
-		ZEND_ASSERT(visit);
-		// TODO Fix visit count issue
-		php3d_cv_to_3d(execute_data, visit->room_index, visit->visit_count);
+// Renders what all processes have aggregated so far into a town of its own, see aggregate_to_trace()
+static bool php3d_aggregate_dump(void) {
+	trace_buffer *trace = aggregate_to_trace();
+	if (!trace) {
+		php3d_failure("[php_3d] Failed to build aggregate town");
+		return false;
+	}
+	char file[MAXPATHLEN];
+	php3d_output_name(file, sizeof(file));
+	enum writer_result result = writer_enqueue(trace, file);
+	if (result == WRITER_FAILED) {
+		php3d_failure("[php_3d] Failed to queue town for writing");
 	}
+	return result == WRITER_QUEUED;
+}
+
+// The calls that are still running go on in the new segment, as the first visit of their rooms
+static void php3d_segment_rebind(void) {
+	for (size_t depth = 0; depth < php3d_frames.depth; depth++) {
+		php3d_frame *frame = &php3d_frames.frames[depth];
+		php3d_function *fn = php3d_function_get(frame->execute_data, true);
+		if (!fn) {
+			php3d_frames.depth = depth;
+			php3d_failure("[php_3d] Failed to append room to town");
+			return;
+		}
+		frame->fn = fn;
+		frame->visit_index = fn->visit_count++;
+		// The edges of the previous segment went with it
+		frame->edge = 0;
+		if (php3d_floor_capped(frame->visit_index)) continue;
+
+		trace_event event = {
+			.type = TRACE_ROOM_ENTER,
+			.name_id = fn->name_id,
+			.room_index = fn->room_index,
+			.visit_index = frame->visit_index,
+		};
+		if (trace_append(php3d_trace, &event)) {
+			php3d_stats.visits++;
+		} else {
+			php3d_failure("[php_3d] Failed to append room to town");
+		}
+	}
+}
+
+// Only the current trace and registry are released and built again, which costs about as much as
+// the end of a request; building the town is left to the writer
+static void php3d_segment_flush_if_due(void) {
+	size_t events = php3d_trace->event_count;
+	php3d_flush_check_at = events + PHP3D_FLUSH_CHECK_EVENTS;
+	bool due = (PHP3D_G(flush_events) > 0 && events >= (zend_ulong) PHP3D_G(flush_events))
+		|| (PHP3D_G(flush_mb) > 0 && events * sizeof(trace_event) + php3d_capture_bytes >= (zend_ulong) PHP3D_G(flush_mb) * 1024 * 1024)
+		|| (PHP3D_G(flush_seconds) > 0 && clock_now_ns() - php3d_segment_start_ns >= (uint64_t) PHP3D_G(flush_seconds) * 1000000000ULL);
+	if (!due) return;
+
+	PHP3D_COUNT(php3d_segments_flushed);
+	php3d_segment_finish();
+	if (php3d_segment_start()) {
+		php3d_segment_rebind();
+	} else {
+		php3d_frames.depth = 0;
+	}
+}
+
+// php_3d_start() picks up the calls that are running, which were observed but not recorded. They
+// go on as the first visits of their rooms, the root frame first so that it is the town center.
+static zend_always_inline bool php3d_frame_resumable(zend_execute_data *ex) {
+	return ex->func && ZEND_USER_CODE(ex->func->type) && php3d_function_observed(ex);
+}
+
+static void php3d_stack_resume(zend_execute_data *execute_data) {
+	size_t count = 0;
+	for (zend_execute_data *ex = execute_data; ex; ex = ex->prev_execute_data) {
+		if (php3d_frame_resumable(ex)) count++;
+	}
+	php3d_frames.depth = 0;
+	for (size_t i = 0; i < count; i++) {
+		if (!php3d_stack_push()) {
+			php3d_frames.depth = 0;
+			php3d_failure("[php_3d] Failed to append room to town");
+			return;
+		}
+	}
+	uint64_t now_ns = clock_now_ns();
+	size_t memory = zend_memory_usage(false);
+	for (zend_execute_data *ex = execute_data; ex; ex = ex->prev_execute_data) {
+		if (!php3d_frame_resumable(ex)) continue;
+		php3d_frame *frame = &php3d_frames.frames[--count];
+		frame->execute_data = ex;
+		frame->start_ns = now_ns;
+		frame->child_ns = 0;
+		frame->start_memory = memory;
+	}
+	php3d_segment_rebind();
 }
 
 zend_observer_fcall_handlers php3d_observer_fcall_init(zend_execute_data *execute_data) {
+	// Requests that were not selected for capture, sampled requests and filtered out functions don't observe anything at all
+	if (!PHP3D_G(capturing) || php3d_sampling || !php3d_function_observed(execute_data)) {
+		return (zend_observer_fcall_handlers) {NULL, NULL};
+	}
 	return (zend_observer_fcall_handlers) {php3d_fcall_begin_handler, php3d_fcall_end_handler};
 }
 
+// Process-wide request selection state; every FPM worker samples and rate limits on its own, the
+// threads of a ZTS build share the rate limit
+ZEND_TLS uint64_t php3d_rng_state;
+ZEND_TLS pid_t php3d_rng_pid;
+static time_t php3d_rate_window;
+static zend_long php3d_rate_count;
+static size_t php3d_requests_captured;
+static size_t php3d_requests_skipped;
+static size_t php3d_requests_rate_limited;
+
+// xorshift64*, deliberately not mt_rand() so that we don't disturb the sequence of seeded userland calls
+static uint64_t php3d_rand(void) {
+	pid_t pid = getpid();
+	if (php3d_rng_pid != pid || !php3d_rng_state) {
+		php3d_rng_pid = pid;
+		php3d_rng_state = ((uint64_t) time(NULL) << 32) ^ (uint64_t) pid ^ (uint64_t) (uintptr_t) &php3d_rng_state;
+		if (!php3d_rng_state) php3d_rng_state = 1;
+	}
+	php3d_rng_state ^= php3d_rng_state >> 12;
+	php3d_rng_state ^= php3d_rng_state << 25;
+	php3d_rng_state ^= php3d_rng_state >> 27;
+	return php3d_rng_state * 2685821657736338717ULL;
+}
+
+static bool php3d_trigger_matches(const char *value, size_t len) {
+	const char *expected = PHP3D_G(trigger_value);
+	if (!expected || !*expected) return true;
+	return strlen(expected) == len && memcmp(expected, value, len) == 0;
+}
+
+static bool php3d_trigger_in(int track_vars, const char *name, size_t name_len) {
+	zval *arr = &PG(http_globals)[track_vars];
+	if (Z_TYPE_P(arr) != IS_ARRAY) return false;
+	zval *value = zend_hash_str_find(Z_ARRVAL_P(arr), name, name_len);
+	if (!value) return false;
+	ZVAL_DEREF(value);
+	if (Z_TYPE_P(value) != IS_STRING) return false;
+	return php3d_trigger_matches(Z_STRVAL_P(value), Z_STRLEN_P(value));
+}
+
+// Like profilers do, a request can ask to be captured with an environment variable, a query parameter or a cookie
+static bool php3d_request_triggered(void) {
+	const char *name = PHP3D_G(trigger);
+	if (!name || !*name) return false;
+	size_t name_len = strlen(name);
+
+	char *env = sapi_getenv(name, name_len);
+	if (env) {
+		bool matches = php3d_trigger_matches(env, strlen(env));
+		efree(env);
+		if (matches) return true;
+	} else {
+		env = getenv(name);
+		if (env && php3d_trigger_matches(env, strlen(env))) return true;
+	}
+
+	return php3d_trigger_in(TRACK_VARS_GET, name, name_len) || php3d_trigger_in(TRACK_VARS_COOKIE, name, name_len);
+}
+
+static bool php3d_request_sampled(void) {
+	zend_long rate = PHP3D_G(sample_rate);
+	if (rate <= 0) return false;
+	if (rate == 1) return true;
+	return (php3d_rand() % (uint64_t) rate) == 0;
+}
+
+static bool php3d_rate_limit_allows(void) {
+	zend_long max = PHP3D_G(max_per_second);
+	if (max <= 0) return true;
+	time_t now = time(NULL);
+	time_t window = __atomic_load_n(&php3d_rate_window, __ATOMIC_RELAXED);
+	// Only the thread that moves the window on resets the count
+	if (now != window && __atomic_compare_exchange_n(&php3d_rate_window, &window, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&php3d_rate_count, 0, __ATOMIC_RELAXED);
+	}
+	return __atomic_add_fetch(&php3d_rate_count, 1, __ATOMIC_RELAXED) <= max;
+}
+
+static bool php3d_request_selected(void) {
+	if (!PHP3D_G(generate_model)) return false;
+	if (!php3d_request_triggered() && !php3d_request_sampled()) {
+		PHP3D_COUNT(php3d_requests_skipped);
+		return false;
+	}
+	if (!php3d_rate_limit_allows()) {
+		PHP3D_COUNT(php3d_requests_rate_limited);
+		return false;
+	}
+	PHP3D_COUNT(php3d_requests_captured);
+	return true;
+}
+
 static void php_3d_init_globals(zend_php_3d_globals *g)
 {
 	g->generate_model = 0;
+	g->backend = NULL;
+	g->writer_queue_depth = 0;
+	g->writer_queue_policy = NULL;
+	g->sample_rate = 1;
+	g->trigger = NULL;
+	g->trigger_value = NULL;
+	g->max_per_second = 0;
+	g->include = NULL;
+	g->exclude = NULL;
+	g->min_depth = 0;
+	g->delta_snapshots = 0;
+	g->capturing = false;
+	g->recording = false;
+	g->label = NULL;
 }
 
 PHP_INI_BEGIN()
 	STD_PHP_INI_BOOLEAN(PHP_3D_NAME ".generate_model", "0", PHP_INI_SYSTEM, OnUpdateBool, generate_model, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_BOOLEAN(PHP_3D_NAME ".autostart", "1", PHP_INI_SYSTEM, OnUpdateBool, autostart, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".backend", SKETCHUP_BACKEND_DEFAULT, PHP_INI_SYSTEM, OnUpdateString, backend, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".writer_queue_depth", "16", PHP_INI_SYSTEM, OnUpdateLong, writer_queue_depth, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".writer_queue_policy", "drop", PHP_INI_SYSTEM, OnUpdateString, writer_queue_policy, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".sample_rate", "1", PHP_INI_SYSTEM, OnUpdateLong, sample_rate, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".trigger", "", PHP_INI_SYSTEM, OnUpdateString, trigger, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".trigger_value", "", PHP_INI_SYSTEM, OnUpdateString, trigger_value, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".max_per_second", "0", PHP_INI_SYSTEM, OnUpdateLong, max_per_second, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".include", "", PHP_INI_SYSTEM, OnUpdateString, include, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".exclude", "", PHP_INI_SYSTEM, OnUpdateString, exclude, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".min_depth", "0", PHP_INI_SYSTEM, OnUpdateLong, min_depth, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_BOOLEAN(PHP_3D_NAME ".delta_snapshots", "0", PHP_INI_SYSTEM, OnUpdateBool, delta_snapshots, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_BOOLEAN(PHP_3D_NAME ".heatmap", "0", PHP_INI_SYSTEM, OnUpdateBool, heatmap, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".max_floors", "64", PHP_INI_SYSTEM, OnUpdateLong, max_floors, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_BOOLEAN(PHP_3D_NAME ".deep_capture", "0", PHP_INI_SYSTEM, OnUpdateBool, deep_capture, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".capture_max_elements", "1000", PHP_INI_SYSTEM, OnUpdateLong, capture_max_elements, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".capture_max_depth", "4", PHP_INI_SYSTEM, OnUpdateLong, capture_max_depth, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".capture_max_keys", "8", PHP_INI_SYSTEM, OnUpdateLong, capture_max_keys, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".capture_max_bytes", "1048576", PHP_INI_SYSTEM, OnUpdateLong, capture_max_bytes, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".mode", "trace", PHP_INI_SYSTEM, OnUpdateString, mode, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".sample_hz", "99", PHP_INI_SYSTEM, OnUpdateLong, sample_hz, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".output", "model", PHP_INI_SYSTEM, OnUpdateString, output, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".trace_compression", "0", PHP_INI_SYSTEM, OnUpdateLong, trace_compression, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".output_file", "php", PHP_INI_SYSTEM, OnUpdateString, output_file, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".flush_events", "0", PHP_INI_SYSTEM, OnUpdateLong, flush_events, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".flush_seconds", "0", PHP_INI_SYSTEM, OnUpdateLong, flush_seconds, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".flush_mb", "0", PHP_INI_SYSTEM, OnUpdateLong, flush_mb, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".aggregate_functions", "4096", PHP_INI_SYSTEM, OnUpdateLong, aggregate_functions, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".aggregate_dump_seconds", "0", PHP_INI_SYSTEM, OnUpdateLong, aggregate_dump_seconds, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_ENTRY(PHP_3D_NAME ".merge_window_ms", "0", PHP_INI_SYSTEM, OnUpdateLong, merge_window_ms, zend_php_3d_globals, php_3d_globals)
+	STD_PHP_INI_BOOLEAN(PHP_3D_NAME ".call_graph", "0", PHP_INI_SYSTEM, OnUpdateBool, call_graph, zend_php_3d_globals, php_3d_globals)
 PHP_INI_END()
 
 PHP_MINIT_FUNCTION(php_3d)
 {
 	php3d_op_array_extension = zend_get_op_array_extension_handle(PHP_3D_NAME);
+#if PHP_VERSION_ID >= 80200
+	php3d_internal_function_extension = zend_get_internal_function_extension_handle(PHP_3D_NAME);
+#endif
 
 	ZEND_INIT_MODULE_GLOBALS(php_3d, php_3d_init_globals, NULL);
 	REGISTER_INI_ENTRIES();
 
 	zend_observer_fcall_register(php3d_observer_fcall_init);
-	sketchup_startup();
+
+	php3d_backend = sketchup_backend_find(PHP3D_G(backend));
+	if (!php3d_backend) {
+		php_error_docref(NULL, E_CORE_WARNING, "Unknown " PHP_3D_NAME ".backend \"%s\", falling back to \"null\"", PHP3D_G(backend));
+		php3d_backend = &sketchup_backend_null;
+	}
+	if (strcmp(PHP3D_G(output), "trace") == 0) {
+		php3d_output_trace = true;
+	} else if (strcmp(PHP3D_G(output), "aggregate") == 0) {
+		php3d_output_aggregate = true;
+	} else if (strcmp(PHP3D_G(output), "model") != 0) {
+		php_error_docref(NULL, E_CORE_WARNING, "Unknown " PHP_3D_NAME ".output \"%s\", falling back to \"model\"", PHP3D_G(output));
+	}
+	if (php3d_output_trace) {
+		php3d_output_extension = "p3dt";
+	} else {
+		php3d_backend->startup();
+		php3d_output_extension = php3d_backend->extension;
+	}
+	if (php3d_output_aggregate && strcmp(PHP3D_G(mode), "sample") == 0) {
+		php_error_docref(NULL, E_CORE_WARNING, PHP_3D_NAME ".output \"aggregate\" can't be sampled, falling back to \"model\"");
+		php3d_output_aggregate = false;
+	}
+	if (php3d_output_aggregate && !aggregate_startup((size_t) MAX(PHP3D_G(aggregate_functions), 1))) {
+		php_error_docref(NULL, E_CORE_WARNING, "Failed to map the " PHP_3D_NAME " aggregate, falling back to \"model\"");
+		php3d_output_aggregate = false;
+	}
+	// An aggregate has no events to cut into segments
+	php3d_flushing = !php3d_output_aggregate && (PHP3D_G(flush_events) > 0 || PHP3D_G(flush_seconds) > 0 || PHP3D_G(flush_mb) > 0);
+
+	enum writer_policy policy = WRITER_POLICY_DROP;
+	if (strcmp(PHP3D_G(writer_queue_policy), "block") == 0) {
+		policy = WRITER_POLICY_BLOCK;
+	} else if (strcmp(PHP3D_G(writer_queue_policy), "drop") != 0) {
+		php_error_docref(NULL, E_CORE_WARNING, "Unknown " PHP_3D_NAME ".writer_queue_policy \"%s\", falling back to \"drop\"", PHP3D_G(writer_queue_policy));
+	}
+	int compression = (int) MIN(MAX(PHP3D_G(trace_compression), 0), 9);
+#ifndef HAVE_3D_ZLIB
+	if (compression) {
+		php_error_docref(NULL, E_CORE_WARNING, PHP_3D_NAME ".trace_compression requires zlib, saving traces uncompressed");
+		compression = 0;
+	}
+#endif
+	size_t depth = (size_t) MAX(PHP3D_G(writer_queue_depth), 0);
+#ifdef ZTS
+	// Backends are only ever called from the writer thread, the requests of other threads would
+	// otherwise render at the same time
+	if (!depth) {
+		depth = 1;
+		policy = WRITER_POLICY_BLOCK;
+	}
+#endif
+	uint64_t merge_window_ns = (uint64_t) MAX(PHP3D_G(merge_window_ms), 0) * 1000000ULL;
+	if (merge_window_ns && php3d_output_trace) {
+		php_error_docref(NULL, E_CORE_WARNING, PHP_3D_NAME ".merge_window_ms does not apply to " PHP_3D_NAME ".output \"trace\"");
+		merge_window_ns = 0;
+	}
+	writer_startup(depth, policy, php3d_output_trace ? NULL : php3d_backend, compression, merge_window_ns);
+
+	if (!filter_ctor(&php3d_filter, PHP3D_G(include), PHP3D_G(exclude))) {
+		php_error_docref(NULL, E_CORE_WARNING, "Failed to parse " PHP_3D_NAME ".include and " PHP_3D_NAME ".exclude");
+	}
+
+	if (strcmp(PHP3D_G(mode), "sample") == 0) {
+#ifdef ZTS
+		// There is one sampler thread and one pending flag per process, not per request thread
+		php_error_docref(NULL, E_CORE_WARNING, PHP_3D_NAME ".mode \"sample\" is not supported by thread-safe builds, falling back to \"trace\"");
+#else
+		php3d_sampling = true;
+#endif
+	} else if (strcmp(PHP3D_G(mode), "trace") != 0) {
+		php_error_docref(NULL, E_CORE_WARNING, "Unknown " PHP_3D_NAME ".mode \"%s\", falling back to \"trace\"", PHP3D_G(mode));
+	}
+	if (php3d_sampling) {
+		zend_long hz = MIN(MAX(PHP3D_G(sample_hz), 1), 10000);
+		php3d_sample_period_ns = 1000000000ULL / (uint64_t) hz;
+		sampler_startup((unsigned int) hz);
+		php3d_prev_interrupt_function = zend_interrupt_function;
+		zend_interrupt_function = php3d_interrupt_function;
+	}
 	return SUCCESS;
 }
 
 PHP_MSHUTDOWN_FUNCTION(php_3d)
 {
-	sketchup_shutdown();
+	writer_shutdown();
+	if (!php3d_output_trace) {
+		php3d_backend->shutdown();
+	}
+	filter_dtor(&php3d_filter);
+	if (php3d_output_aggregate) {
+		aggregate_shutdown();
+	}
+	if (php3d_sampling) {
+		sampler_shutdown();
+		zend_interrupt_function = php3d_prev_interrupt_function;
+	}
+	arena_free(&php3d_arena);
+	php3d_stack_free();
 	return SUCCESS;
 }
 
@@ -178,13 +1646,16 @@ PHP_RINIT_FUNCTION(php_3d)
 #if defined(ZTS) && defined(COMPILE_DL_PHP_3D)
 	ZEND_TSRMLS_CACHE_UPDATE();
 #endif
-	php3d_town.ptr = NULL;
-	php3d_room_next_index = 0;
+	php3d_trace = NULL;
+	PHP3D_G(label) = NULL;
 
-	if (PHP3D_G(generate_model)) {
-		if (!sketchup_town_ctor(&php3d_town)) {
-			php_log_err("[php_3d] Failed to ctor town");
-		}
+	memset(&php3d_stats, 0, sizeof(php3d_request_stats));
+	PHP3D_G(capturing) = php3d_request_selected();
+	// Without autostart the functions are still set up to be observed, but only record after php_3d_start()
+	PHP3D_G(recording) = PHP3D_G(capturing) && PHP3D_G(autostart);
+	if (PHP3D_G(capturing) && php3d_segment_start()
+			&& php3d_sampling && !sampler_arm(php3d_sample_tick, (void *) &EG(vm_interrupt))) {
+		php3d_failure("[php_3d] Failed to start sampler");
 	}
 
 	return SUCCESS;
@@ -196,26 +1667,298 @@ PHP_RSHUTDOWN_FUNCTION(php_3d)
 	ZEND_TSRMLS_CACHE_UPDATE();
 #endif
 
-	if (PHP3D_G(generate_model) && php3d_town.ptr) {
-		if (!sketchup_town_save(php3d_town, "php.skp")) {
-			php_log_err("[php_3d] Failed to save .skp file");
+	if (!PHP3D_G(capturing)) {
+		return SUCCESS;
+	}
+	PHP3D_G(capturing) = false;
+	PHP3D_G(recording) = false;
+	php3d_frames.depth = 0;
+	if (php3d_sampling) {
+		sampler_disarm();
+		php3d_sample_pending = false;
+	}
+	uint64_t finish_start_ns = clock_now_ns();
+	php3d_segment_finish();
+	sketchup_histogram_add(&php3d_finish_histogram, clock_now_ns() - finish_start_ns);
+	php3d_request_stats_add();
+	if (PHP3D_G(label)) {
+		zend_string_release(PHP3D_G(label));
+		PHP3D_G(label) = NULL;
+	}
+	if (php3d_output_aggregate) {
+		aggregate_request();
+	}
+	// Whichever request of whichever process comes first after the interval dumps for all of them
+	if (php3d_output_aggregate && PHP3D_G(aggregate_dump_seconds) > 0
+			&& aggregate_dump_due((uint64_t) PHP3D_G(aggregate_dump_seconds) * 1000000000ULL)) {
+		php3d_aggregate_dump();
+	}
+
+	return SUCCESS;
+}
+
+PHP_FUNCTION(php_3d_start)
+{
+	zend_string *label = NULL;
+
+	ZEND_PARSE_PARAMETERS_START(0, 1)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_STR_OR_NULL(label)
+	ZEND_PARSE_PARAMETERS_END();
+
+	// Only requests that were selected for capture have their functions observed
+	if (!PHP3D_G(capturing) || !php3d_trace) {
+		RETURN_FALSE;
+	}
+	if (label) {
+		if (PHP3D_G(label)) {
+			zend_string_release(PHP3D_G(label));
 		}
-		if (!sketchup_town_dtor(php3d_town)) {
-			php_log_err("[php_3d] Failed to dtor town");
+		PHP3D_G(label) = zend_string_copy(label);
+		if (!trace_set_label(php3d_trace, ZSTR_VAL(label), ZSTR_LEN(label))) {
+			php3d_failure("[php_3d] Failed to record label");
 		}
 	}
+	if (!PHP3D_G(recording) && !php3d_output_aggregate && !php3d_sampling) {
+		// Without its own frame, which only gets its end handler
+		php3d_stack_resume(EX(prev_execute_data));
+	}
+	PHP3D_G(recording) = true;
+	RETURN_TRUE;
+}
 
-	return SUCCESS;
+PHP_FUNCTION(php_3d_stop)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	if (!PHP3D_G(recording)) {
+		RETURN_FALSE;
+	}
+	PHP3D_G(recording) = false;
+	// The calls that are running now won't get their end handler recorded
+	php3d_frames.depth = 0;
+	RETURN_TRUE;
+}
+
+PHP_FUNCTION(php_3d_is_recording)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	RETURN_BOOL(PHP3D_G(recording));
+}
+
+PHP_FUNCTION(php_3d_aggregate_dump)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	if (!php3d_output_aggregate) {
+		RETURN_FALSE;
+	}
+	RETURN_BOOL(php3d_aggregate_dump());
+}
+
+static const char *const php3d_phase_names[SKETCHUP_PHASE_COUNT] = {"ctor", "append", "save", "dtor"};
+
+static void php3d_stats_add_counters(zval *array, const php3d_request_stats *stats) {
+	add_assoc_long(array, "rooms", (zend_long) stats->rooms);
+	add_assoc_long(array, "visits", (zend_long) stats->visits);
+	add_assoc_long(array, "floors_folded", (zend_long) stats->floors_folded);
+	add_assoc_long(array, "variables", (zend_long) stats->variables);
+	add_assoc_long(array, "captures_skipped", (zend_long) stats->captures_skipped);
+	add_assoc_long(array, "failures", (zend_long) stats->failures);
+}
+
+static void php3d_stats_add_histogram(zval *array, const char *name, const sketchup_histogram *histogram) {
+	zval entry, buckets;
+	array_init(&entry);
+	add_assoc_long(&entry, "count", (zend_long) histogram->count);
+	add_assoc_long(&entry, "total_ns", (zend_long) histogram->total_ns);
+	add_assoc_long(&entry, "max_ns", (zend_long) histogram->max_ns);
+	array_init_size(&buckets, SKETCHUP_HISTOGRAM_BUCKETS);
+	for (size_t i = 0; i < SKETCHUP_HISTOGRAM_BUCKETS; i++) {
+		add_next_index_long(&buckets, (zend_long) histogram->buckets[i]);
+	}
+	add_assoc_zval(&entry, "buckets", &buckets);
+	add_assoc_zval(array, name, &entry);
+}
+
+// The counters of the current request, the totals of the process and what the backend has built
+// so far. Towns are built after the request, so its own town only shows up in the next one.
+PHP_FUNCTION(php_3d_stats)
+{
+	ZEND_PARSE_PARAMETERS_NONE();
+
+	array_init(return_value);
+
+	zval request;
+	array_init(&request);
+	add_assoc_bool(&request, "capturing", PHP3D_G(capturing));
+	add_assoc_bool(&request, "recording", PHP3D_G(recording));
+	php3d_stats_add_counters(&request, &php3d_stats);
+	size_t events = php3d_trace ? php3d_trace->event_count : 0;
+	add_assoc_long(&request, "events", (zend_long) events);
+	add_assoc_long(&request, "trace_bytes", (zend_long) (events * sizeof(trace_event) + php3d_capture_bytes));
+	add_assoc_zval(return_value, "request", &request);
+
+	zval process;
+	array_init(&process);
+	add_assoc_long(&process, "requests_captured", (zend_long) php3d_requests_captured);
+	add_assoc_long(&process, "requests_skipped", (zend_long) php3d_requests_skipped);
+	add_assoc_long(&process, "requests_rate_limited", (zend_long) php3d_requests_rate_limited);
+	add_assoc_long(&process, "segments_flushed", (zend_long) php3d_segments_flushed);
+	php3d_request_stats totals;
+	memcpy(&totals, &php3d_process_stats, sizeof(php3d_request_stats));
+	php3d_stats_add_counters(&process, &totals);
+	add_assoc_zval(return_value, "process", &process);
+
+	writer_stats wstats = {0};
+	writer_stats_get(&wstats);
+	zval writer;
+	array_init(&writer);
+	add_assoc_long(&writer, "queued", (zend_long) wstats.queued);
+	add_assoc_long(&writer, "written", (zend_long) wstats.written);
+	add_assoc_long(&writer, "dropped", (zend_long) wstats.dropped);
+	add_assoc_long(&writer, "failed", (zend_long) wstats.failed);
+	add_assoc_long(&writer, "merged", (zend_long) wstats.merged);
+	add_assoc_zval(return_value, "writer", &writer);
+
+	sketchup_backend_stats bstats;
+	sketchup_backend_stats_get(&bstats);
+	zval backend;
+	array_init(&backend);
+	add_assoc_string(&backend, "name", (char *) php3d_backend->name);
+	add_assoc_long(&backend, "towns", (zend_long) bstats.towns);
+	add_assoc_long(&backend, "rooms", (zend_long) bstats.rooms);
+	add_assoc_long(&backend, "variables", (zend_long) bstats.variables);
+	add_assoc_long(&backend, "saves", (zend_long) bstats.saves);
+	add_assoc_long(&backend, "bytes", (zend_long) bstats.bytes);
+	add_assoc_long(&backend, "failures", (zend_long) bstats.failures);
+	add_assoc_zval(return_value, "backend", &backend);
+
+	zval timings;
+	array_init(&timings);
+	sketchup_histogram finish;
+	sketchup_histogram_get(&php3d_finish_histogram, &finish);
+	php3d_stats_add_histogram(&timings, "finish", &finish);
+	for (size_t i = 0; i < SKETCHUP_PHASE_COUNT; i++) {
+		php3d_stats_add_histogram(&timings, php3d_phase_names[i], &bstats.phases[i]);
+	}
+	add_assoc_zval(return_value, "timings", &timings);
+}
+
+static void php3d_info_print_histogram(const char *name, const sketchup_histogram *histogram) {
+	char row[96];
+	snprintf(row, sizeof(row), "%zu, avg %.3f ms, max %.3f ms", histogram->count,
+		histogram->count ? (double) histogram->total_ns / (double) histogram->count / 1e6 : 0.0, (double) histogram->max_ns / 1e6);
+	php_info_print_table_row(2, name, row);
 }
 
 PHP_MINFO_FUNCTION(php_3d)
 {
 	php_info_print_table_start();
 	php_info_print_table_header(2, "3D support", "enabled");
+	php_info_print_table_row(2, "Backend", php3d_backend->name);
+	php_info_print_table_row(2, "Output", php3d_output_trace ? "trace" : (php3d_output_aggregate ? "aggregate" : "model"));
+#ifdef HAVE_SKETCHUP_API
 	php_info_print_table_row(2, "SketchUpAPI path", PHP_SKETCHUP_API_PATH);
+#endif
 	char tmp[10];
-	sketchup_sdk_version(sizeof(tmp), tmp);
-	php_info_print_table_row(2, "SketchUpAPI version", tmp);
+	php3d_backend->version(sizeof(tmp), tmp);
+	php_info_print_table_row(2, "Backend version", tmp);
+
+	char num[32];
+	if (php3d_backend->cache_stats) {
+		sketchup_cache_stats cache_stats = {0};
+		php3d_backend->cache_stats(&cache_stats);
+		snprintf(num, sizeof(num), "%zu", cache_stats.hits);
+		php_info_print_table_row(2, "Asset cache hits", num);
+		snprintf(num, sizeof(num), "%zu", cache_stats.misses);
+		php_info_print_table_row(2, "Asset cache misses", num);
+		snprintf(num, sizeof(num), "%zu", cache_stats.assets);
+		php_info_print_table_row(2, "Asset cache entries", num);
+		snprintf(num, sizeof(num), "%zu", cache_stats.bytes);
+		php_info_print_table_row(2, "Asset cache memory (bytes)", num);
+	}
+
+	sketchup_backend_stats backend_stats = {0};
+	sketchup_backend_stats_get(&backend_stats);
+	snprintf(num, sizeof(num), "%zu", backend_stats.towns);
+	php_info_print_table_row(2, "Towns built", num);
+	snprintf(num, sizeof(num), "%zu", backend_stats.rooms);
+	php_info_print_table_row(2, "Rooms rendered", num);
+	snprintf(num, sizeof(num), "%zu", backend_stats.variables);
+	php_info_print_table_row(2, "Variables rendered", num);
+	snprintf(num, sizeof(num), "%zu", backend_stats.saves);
+	php_info_print_table_row(2, "Towns saved", num);
+	snprintf(num, sizeof(num), "%zu", backend_stats.bytes);
+	php_info_print_table_row(2, "Bytes rendered", num);
+	snprintf(num, sizeof(num), "%zu", backend_stats.failures);
+	php_info_print_table_row(2, "Backend failures", num);
+	php3d_info_print_histogram("Town ctor time", &backend_stats.phases[SKETCHUP_PHASE_CTOR]);
+	php3d_info_print_histogram("Town append time", &backend_stats.phases[SKETCHUP_PHASE_APPEND]);
+	php3d_info_print_histogram("Town save time", &backend_stats.phases[SKETCHUP_PHASE_SAVE]);
+	php3d_info_print_histogram("Town dtor time", &backend_stats.phases[SKETCHUP_PHASE_DTOR]);
+
+	snprintf(num, sizeof(num), "%zu", php3d_requests_captured);
+	php_info_print_table_row(2, "Requests captured", num);
+	snprintf(num, sizeof(num), "%zu", php3d_requests_skipped);
+	php_info_print_table_row(2, "Requests not sampled", num);
+	snprintf(num, sizeof(num), "%zu", php3d_requests_rate_limited);
+	php_info_print_table_row(2, "Requests rate limited", num);
+
+	snprintf(num, sizeof(num), "%zu", php3d_segments_flushed);
+	php_info_print_table_row(2, "Segments flushed", num);
+	snprintf(num, sizeof(num), "%zu", php3d_process_stats.rooms);
+	php_info_print_table_row(2, "Rooms recorded", num);
+	snprintf(num, sizeof(num), "%zu", php3d_process_stats.visits);
+	php_info_print_table_row(2, "Visits recorded", num);
+	snprintf(num, sizeof(num), "%zu", php3d_process_stats.floors_folded);
+	php_info_print_table_row(2, "Visits folded", num);
+	snprintf(num, sizeof(num), "%zu", php3d_process_stats.variables);
+	php_info_print_table_row(2, "Variables recorded", num);
+	snprintf(num, sizeof(num), "%zu", php3d_process_stats.captures_skipped);
+	php_info_print_table_row(2, "Deep captures skipped", num);
+	snprintf(num, sizeof(num), "%zu", php3d_process_stats.failures);
+	php_info_print_table_row(2, "Capture failures", num);
+	sketchup_histogram finish;
+	sketchup_histogram_get(&php3d_finish_histogram, &finish);
+	php3d_info_print_histogram("Request finish time", &finish);
+
+	if (php3d_output_aggregate) {
+		aggregate_stats astats = {0};
+		aggregate_stats_get(&astats);
+		snprintf(num, sizeof(num), "%zu", astats.functions);
+		php_info_print_table_row(2, "Aggregate functions", num);
+		snprintf(num, sizeof(num), "%zu", astats.capacity);
+		php_info_print_table_row(2, "Aggregate capacity", num);
+		snprintf(num, sizeof(num), "%zu", astats.dropped);
+		php_info_print_table_row(2, "Aggregate calls dropped", num);
+		snprintf(num, sizeof(num), "%zu", astats.requests);
+		php_info_print_table_row(2, "Aggregate requests", num);
+		snprintf(num, sizeof(num), "%zu", astats.bytes);
+		php_info_print_table_row(2, "Aggregate memory (bytes)", num);
+	}
+
+	php_info_print_table_row(2, "Capture mode", php3d_sampling ? "sample" : "trace");
+	if (php3d_sampling) {
+		sampler_stats sstats = {0};
+		sampler_stats_get(&sstats);
+		snprintf(num, sizeof(num), "%zu", sstats.ticks);
+		php_info_print_table_row(2, "Sampler ticks", num);
+	}
+
+	writer_stats stats = {0};
+	writer_stats_get(&stats);
+	snprintf(num, sizeof(num), "%zu", stats.queued);
+	php_info_print_table_row(2, "Writer models queued", num);
+	snprintf(num, sizeof(num), "%zu", stats.written);
+	php_info_print_table_row(2, "Writer models written", num);
+	snprintf(num, sizeof(num), "%zu", stats.dropped);
+	php_info_print_table_row(2, "Writer models dropped", num);
+	snprintf(num, sizeof(num), "%zu", stats.failed);
+	php_info_print_table_row(2, "Writer models failed", num);
+	snprintf(num, sizeof(num), "%zu", stats.merged);
+	php_info_print_table_row(2, "Writer models merged", num);
 	php_info_print_table_end();
 
 	DISPLAY_INI_ENTRIES();
@@ -224,7 +1967,7 @@ PHP_MINFO_FUNCTION(php_3d)
 zend_module_entry php_3d_module_entry = {
 	STANDARD_MODULE_HEADER,
 	PHP_3D_NAME,				/* Extension name */
-	NULL,						/* zend_function_entry */
+	ext_functions,				/* zend_function_entry */
 	PHP_MINIT(php_3d),			/* PHP_MINIT - Module initialization */
 	PHP_MSHUTDOWN(php_3d),		/* PHP_MSHUTDOWN - Module shutdown */
 	PHP_RINIT(php_3d),			/* PHP_RINIT - Request initialization */
@@ -0,0 +1,186 @@
+#include "aggregate.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "clock.h"
+
+#ifndef MAP_ANONYMOUS
+# define MAP_ANONYMOUS MAP_ANON
+#endif
+
+typedef struct aggregate_s {
+	uint64_t capacity;
+	uint64_t functions;
+	uint64_t dropped;
+	uint64_t requests;
+	uint64_t last_dump_ns;
+	aggregate_entry entries[];
+} aggregate;
+
+static aggregate *aggregate_table;
+static size_t aggregate_size;
+
+bool aggregate_startup(size_t capacity) {
+	size_t cap = 64;
+	while (cap < capacity) cap *= 2;
+	size_t size = sizeof(aggregate) + cap * sizeof(aggregate_entry);
+	// Anonymous shared memory is zeroed and inherited by every worker forked after MINIT. Pages are
+	// only backed once an entry on them is claimed.
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) return false;
+	aggregate_table = (aggregate *)map;
+	aggregate_table->capacity = cap;
+	aggregate_table->last_dump_ns = clock_now_ns();
+	aggregate_size = size;
+	return true;
+}
+
+void aggregate_shutdown(void) {
+	if (aggregate_table) {
+		munmap(aggregate_table, aggregate_size);
+	}
+	aggregate_table = NULL;
+	aggregate_size = 0;
+}
+
+// FNV-1a, 0 marks a free slot
+static uint64_t aggregate_hash(const char *str, size_t len) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char) str[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash ? hash : 1;
+}
+
+static void aggregate_copy_name(char *dest, size_t size, const char *src, size_t len) {
+	len = len < size - 1 ? len : size - 1;
+	memcpy(dest, src, len);
+	dest[len] = '\0';
+}
+
+aggregate_entry *aggregate_entry_get(const char *name, size_t len, const char *const *var_names, const size_t *var_lens, uint32_t var_count) {
+	if (!aggregate_table) return NULL;
+	uint64_t hash = aggregate_hash(name, len);
+	size_t mask = aggregate_table->capacity - 1;
+	size_t name_len = len < AGGREGATE_NAME_MAX - 1 ? len : AGGREGATE_NAME_MAX - 1;
+	for (size_t probe = 0; probe <= mask; probe++) {
+		aggregate_entry *entry = &aggregate_table->entries[(hash + probe) & mask];
+		uint64_t found = __atomic_load_n(&entry->hash, __ATOMIC_ACQUIRE);
+		if (!found) {
+			if (__atomic_compare_exchange_n(&entry->hash, &found, hash, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+				// The slot is ours, nobody else reads its name or vars until it is ready
+				aggregate_copy_name(entry->name, sizeof(entry->name), name, len);
+				entry->var_count = var_count < AGGREGATE_MAX_VARS ? var_count : AGGREGATE_MAX_VARS;
+				for (uint32_t i = 0; i < entry->var_count; i++) {
+					aggregate_copy_name(entry->vars[i].name, sizeof(entry->vars[i].name), var_names[i], var_lens[i]);
+				}
+				__atomic_store_n(&entry->ready, 1, __ATOMIC_RELEASE);
+				__atomic_fetch_add(&aggregate_table->functions, 1, __ATOMIC_RELAXED);
+				return entry;
+			}
+			// Claimed by another process in the meantime, found holds its hash now
+		}
+		if (found != hash) continue;
+		if (!__atomic_load_n(&entry->ready, __ATOMIC_ACQUIRE)) return NULL;
+		if (strncmp(entry->name, name, name_len) == 0 && entry->name[name_len] == '\0') return entry;
+	}
+	return NULL;
+}
+
+void aggregate_drop(void) {
+	if (aggregate_table) {
+		__atomic_fetch_add(&aggregate_table->dropped, 1, __ATOMIC_RELAXED);
+	}
+}
+
+void aggregate_request(void) {
+	if (aggregate_table) {
+		__atomic_fetch_add(&aggregate_table->requests, 1, __ATOMIC_RELAXED);
+	}
+}
+
+bool aggregate_dump_due(uint64_t interval_ns) {
+	if (!aggregate_table) return false;
+	uint64_t now = clock_now_ns();
+	uint64_t last = __atomic_load_n(&aggregate_table->last_dump_ns, __ATOMIC_RELAXED);
+	if (now - last < interval_ns) return false;
+	return __atomic_compare_exchange_n(&aggregate_table->last_dump_ns, &last, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+trace_buffer *aggregate_to_trace(void) {
+	if (!aggregate_table) return NULL;
+	trace_buffer *trace = trace_ctor();
+	if (!trace) return NULL;
+
+	// Room 0 is the town center, the functions are numbered after it in the order of their slots
+	char center[64];
+	snprintf(center, sizeof(center), "aggregate of %" PRIu64 " requests", __atomic_load_n(&aggregate_table->requests, __ATOMIC_RELAXED));
+	uint32_t center_id;
+	bool ok = trace_intern(trace, center, strlen(center), &center_id);
+	trace_event center_event = {
+		.type = TRACE_ROOM_ENTER,
+		.name_id = center_id,
+	};
+	ok = ok && trace_append(trace, &center_event);
+
+	uint32_t room_index = 1;
+	trace_var_summary vars[AGGREGATE_MAX_VARS];
+	for (size_t i = 0; ok && i < aggregate_table->capacity; i++) {
+		const aggregate_entry *entry = &aggregate_table->entries[i];
+		if (!__atomic_load_n(&entry->ready, __ATOMIC_ACQUIRE)) continue;
+		// The counters keep moving while we read them, each one is consistent on its own
+		uint64_t calls = __atomic_load_n(&entry->calls, __ATOMIC_RELAXED);
+		if (!calls) continue;
+
+		uint32_t name_id;
+		ok = trace_intern(trace, entry->name, strlen(entry->name), &name_id);
+		for (uint32_t bucket = 0; ok && bucket < AGGREGATE_DEPTH_BUCKETS; bucket++) {
+			if (!__atomic_load_n(&entry->depths[bucket], __ATOMIC_RELAXED)) continue;
+			trace_event event = {
+				.type = TRACE_ROOM_ENTER,
+				.name_id = name_id,
+				.room_index = room_index,
+				.visit_index = bucket,
+			};
+			ok = trace_append(trace, &event);
+		}
+
+		for (uint32_t v = 0; ok && v < entry->var_count; v++) {
+			memset(&vars[v], 0, sizeof(trace_var_summary));
+			ok = trace_intern(trace, entry->vars[v].name, strlen(entry->vars[v].name), &vars[v].name_id);
+			for (int type = 0; type < SKETCHUP_VAL_TYPE_COUNT; type++) {
+				vars[v].types[type] = __atomic_load_n(&entry->vars[v].types[type], __ATOMIC_RELAXED);
+			}
+		}
+		trace_summary summary = {
+			.room_index = room_index,
+			.visit_index = AGGREGATE_DEPTH_BUCKETS,
+			.calls = calls,
+			.var_count = entry->var_count,
+		};
+		sketchup_room_profile profile = {.calls = calls};
+		ok = ok && trace_add_summary(trace, &summary, vars) && trace_set_profile(trace, room_index, &profile);
+		room_index++;
+	}
+	if (!ok) {
+		trace_dtor(trace);
+		return NULL;
+	}
+	return trace;
+}
+
+void aggregate_stats_get(aggregate_stats *stats) {
+	if (!aggregate_table) {
+		*stats = (aggregate_stats) {0};
+		return;
+	}
+	stats->capacity = aggregate_table->capacity;
+	stats->functions = __atomic_load_n(&aggregate_table->functions, __ATOMIC_RELAXED);
+	stats->dropped = __atomic_load_n(&aggregate_table->dropped, __ATOMIC_RELAXED);
+	stats->requests = __atomic_load_n(&aggregate_table->requests, __ATOMIC_RELAXED);
+	stats->bytes = aggregate_size;
+}
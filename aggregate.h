@@ -0,0 +1,78 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "sketchup.h"
+#include "trace.h"
+
+// The shape of many requests at once: a fixed-capacity open addressing table of functions in
+// shared memory, mapped in MINIT so that every forked worker adds to the same counters. Entries are
+// claimed with a compare-and-swap of their hash and counted with atomic increments, never locked.
+#define AGGREGATE_NAME_MAX 128
+#define AGGREGATE_VAR_NAME_MAX 32
+#define AGGREGATE_MAX_VARS 16
+// Call stack depths in powers of two: 0, 1, 2-3, 4-7, ...
+#define AGGREGATE_DEPTH_BUCKETS 16
+
+typedef struct aggregate_var_s {
+    char name[AGGREGATE_VAR_NAME_MAX];
+    uint64_t types[SKETCHUP_VAL_TYPE_COUNT];
+} aggregate_var;
+
+typedef struct aggregate_entry_s {
+    uint64_t hash;      // 0 while the slot is free
+    uint32_t ready;     // Set once name and vars are published
+    uint32_t var_count;
+    uint64_t calls;
+    uint64_t depths[AGGREGATE_DEPTH_BUCKETS];
+    char name[AGGREGATE_NAME_MAX];
+    aggregate_var vars[AGGREGATE_MAX_VARS];
+} aggregate_entry;
+
+typedef struct aggregate_stats_s {
+    size_t capacity;
+    size_t functions;
+    size_t dropped;     // Calls of functions that found no free slot
+    size_t requests;
+    size_t bytes;
+} aggregate_stats;
+
+// capacity is rounded up to a power of two
+bool aggregate_startup(size_t capacity);
+void aggregate_shutdown(void);
+
+// Returns the entry of the function, claiming one if it is new. NULL if the table is full or another
+// process is publishing the same function at this very moment.
+aggregate_entry *aggregate_entry_get(const char *name, size_t len, const char *const *var_names, const size_t *var_lens, uint32_t var_count);
+void aggregate_drop(void);
+// Counts a captured request of any process, for the name of the town center
+void aggregate_request(void);
+
+static inline void aggregate_call(aggregate_entry *entry, size_t depth) {
+    unsigned bucket = 0;
+    while (depth && bucket < AGGREGATE_DEPTH_BUCKETS - 1) {
+        depth >>= 1;
+        bucket++;
+    }
+    __atomic_fetch_add(&entry->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&entry->depths[bucket], 1, __ATOMIC_RELAXED);
+}
+
+static inline void aggregate_var_type(aggregate_entry *entry, uint32_t var, enum sketchup_val_type type) {
+    if (var < entry->var_count) {
+        __atomic_fetch_add(&entry->vars[var].types[type], 1, __ATOMIC_RELAXED);
+    }
+}
+
+// True for exactly one caller across all processes per interval
+bool aggregate_dump_due(uint64_t interval_ns);
+// A town of the aggregate: a town center named after the number of requests, a room per function with a floor per depth bucket it was called at, a
+// summary floor with its calls and variable types, and a tower sized by its calls
+trace_buffer *aggregate_to_trace(void);
+
+void aggregate_stats_get(aggregate_stats *stats);
+
+#endif	/* AGGREGATE_H */
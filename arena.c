@@ -0,0 +1,91 @@
+#include "arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGN(size) (((size) + ARENA_ALIGNMENT - 1) & ~((size_t) ARENA_ALIGNMENT - 1))
+#define ARENA_HEADER ARENA_ALIGN(sizeof(arena_chunk))
+
+void arena_init(arena *a, size_t chunk_size) {
+	a->head = NULL;
+	a->chunk_size = chunk_size ? chunk_size : 4096;
+	a->bytes = 0;
+}
+
+static arena_chunk *arena_chunk_new(arena *a, size_t min_size) {
+	size_t size = a->head ? a->head->size * 2 : a->chunk_size;
+	if (size > ARENA_MAX_CHUNK) size = ARENA_MAX_CHUNK;
+	if (size < min_size) size = min_size;
+
+	arena_chunk *chunk = (arena_chunk *)malloc(ARENA_HEADER + size);
+	if (!chunk) return NULL;
+	chunk->size = size;
+	chunk->used = 0;
+	chunk->next = a->head;
+	a->head = chunk;
+	a->bytes += size;
+	return chunk;
+}
+
+void *arena_alloc(arena *a, size_t size) {
+	if (size > SIZE_MAX - ARENA_ALIGNMENT) return NULL;
+	size = ARENA_ALIGN(size ? size : 1);
+	arena_chunk *chunk = a->head;
+	if (!chunk || chunk->size - chunk->used < size) {
+		chunk = arena_chunk_new(a, size);
+		if (!chunk) return NULL;
+	}
+	void *ptr = (char *)chunk + ARENA_HEADER + chunk->used;
+	chunk->used += size;
+	return ptr;
+}
+
+void *arena_calloc(arena *a, size_t count, size_t size) {
+	if (size && count > SIZE_MAX / size) return NULL;
+	void *ptr = arena_alloc(a, count * size);
+	if (ptr) {
+		memset(ptr, 0, count * size);
+	}
+	return ptr;
+}
+
+char *arena_strndup(arena *a, const char *str, size_t len) {
+	char *dup = (char *)arena_alloc(a, len + 1);
+	if (dup) {
+		memcpy(dup, str, len);
+		dup[len] = '\0';
+	}
+	return dup;
+}
+
+void arena_reset(arena *a) {
+	arena_chunk *first = NULL;
+	arena_chunk *chunk = a->head;
+	while (chunk) {
+		arena_chunk *next = chunk->next;
+		if (next) {
+			free(chunk);
+		} else {
+			first = chunk;
+		}
+		chunk = next;
+	}
+	a->head = first;
+	a->bytes = 0;
+	if (first) {
+		first->used = 0;
+		a->bytes = first->size;
+	}
+}
+
+void arena_free(arena *a) {
+	arena_chunk *chunk = a->head;
+	while (chunk) {
+		arena_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	a->head = NULL;
+	a->bytes = 0;
+}
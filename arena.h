@@ -0,0 +1,32 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A bump allocator for state that lives exactly as long as a request or a town. Memory is handed
+// out of chunks that grow as needed and is only ever released all at once.
+typedef struct arena_chunk_s {
+    struct arena_chunk_s *next;
+    size_t size;
+    size_t used;
+} arena_chunk;
+
+typedef struct arena_s {
+    arena_chunk *head;
+    size_t chunk_size; // Size of the first chunk, later chunks double up to ARENA_MAX_CHUNK
+    size_t bytes;      // Total size of all chunks
+} arena;
+
+#define ARENA_ALIGNMENT 16
+#define ARENA_MAX_CHUNK (1024 * 1024)
+
+void arena_init(arena *a, size_t chunk_size);
+void *arena_alloc(arena *a, size_t size);
+void *arena_calloc(arena *a, size_t count, size_t size);
+char *arena_strndup(arena *a, const char *str, size_t len);
+// Releases everything but keeps the first chunk around for reuse
+void arena_reset(arena *a);
+void arena_free(arena *a);
+
+#endif	/* ARENA_H */
@@ -0,0 +1,14 @@
+<?php
+// Included by every workload. Reports the workload to bench/run.php as the last line of output.
+
+function php3d_bench_report(int $calls, int $elapsed_ns): void {
+	// Taken before RSHUTDOWN, so the RSS covers the trace but not the town built from it
+	$usage = getrusage();
+	echo json_encode([
+		'calls' => $calls,
+		'elapsed_ns' => $elapsed_ns,
+		'peak_memory' => memory_get_peak_usage(true),
+		'peak_rss_kb' => $usage['ru_maxrss'],
+		'end_ns' => hrtime(true),
+	]), "\n";
+}
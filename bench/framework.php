@@ -0,0 +1,167 @@
+<?php
+// A framework-like bootstrap: a container with closures, a router, a middleware pipeline and an
+// event dispatcher, i.e. many distinct small functions and methods that are each called a few times.
+// Every one of them counts itself, the routes that are never matched aside.
+require __DIR__ . '/bench.php';
+
+final class Php3dBenchContainer {
+	public static int $calls = 0;
+	private array $factories = [];
+	private array $instances = [];
+
+	public function set(string $id, Closure $factory): void {
+		self::$calls++;
+		$this->factories[$id] = $factory;
+	}
+
+	public function get(string $id): object {
+		self::$calls++;
+		return $this->instances[$id] ??= ($this->factories[$id])($this);
+	}
+}
+
+final class Php3dBenchConfig {
+	public function __construct(private array $values) {
+		Php3dBenchContainer::$calls++;
+	}
+
+	public function get(string $key, mixed $default = null): mixed {
+		Php3dBenchContainer::$calls++;
+		$value = $this->values;
+		foreach (explode('.', $key) as $part) {
+			if (!is_array($value) || !array_key_exists($part, $value)) return $default;
+			$value = $value[$part];
+		}
+		return $value;
+	}
+}
+
+final class Php3dBenchEvents {
+	private array $listeners = [];
+
+	public function listen(string $event, Closure $listener): void {
+		Php3dBenchContainer::$calls++;
+		$this->listeners[$event][] = $listener;
+	}
+
+	public function dispatch(string $event, array $payload): array {
+		Php3dBenchContainer::$calls++;
+		foreach ($this->listeners[$event] ?? [] as $listener) {
+			$payload = $listener($payload);
+		}
+		return $payload;
+	}
+}
+
+final class Php3dBenchRouter {
+	private array $routes = [];
+
+	public function __construct() {
+		Php3dBenchContainer::$calls++;
+	}
+
+	public function add(string $method, string $pattern, Closure $action): void {
+		Php3dBenchContainer::$calls++;
+		$regex = '#^' . preg_replace('#\{(\w+)\}#', '(?P<$1>[^/]+)', $pattern) . '$#';
+		$this->routes[] = [$method, $regex, $action];
+	}
+
+	public function match(string $method, string $path): ?array {
+		Php3dBenchContainer::$calls++;
+		foreach ($this->routes as [$route_method, $regex, $action]) {
+			if ($route_method === $method && preg_match($regex, $path, $matches)) {
+				return [$action, array_filter($matches, 'is_string', ARRAY_FILTER_USE_KEY)];
+			}
+		}
+		return null;
+	}
+}
+
+final class Php3dBenchKernel {
+	private array $middleware = [];
+
+	public function __construct(private Php3dBenchContainer $container) {
+		Php3dBenchContainer::$calls++;
+	}
+
+	public function pipe(Closure $middleware): void {
+		Php3dBenchContainer::$calls++;
+		$this->middleware[] = $middleware;
+	}
+
+	public function handle(array $request): array {
+		Php3dBenchContainer::$calls++;
+		$core = function (array $request): array {
+			Php3dBenchContainer::$calls++;
+			$route = $this->container->get('router')->match($request['method'], $request['path']);
+			if (!$route) return ['status' => 404, 'body' => ''];
+			[$action, $params] = $route;
+			return $action($request, $params, $this->container);
+		};
+		$next = array_reduce(array_reverse($this->middleware), function (Closure $next, Closure $middleware): Closure {
+			Php3dBenchContainer::$calls++;
+			return function (array $request) use ($middleware, $next): array {
+				Php3dBenchContainer::$calls++;
+				return $middleware($request, $next);
+			};
+		}, $core);
+		return $next($request);
+	}
+}
+
+function php3d_bench_bootstrap(int $i): array {
+	Php3dBenchContainer::$calls++;
+	$container = new Php3dBenchContainer();
+	$container->set('config', function (): Php3dBenchConfig {
+		Php3dBenchContainer::$calls++;
+		return new Php3dBenchConfig([
+			'app' => ['name' => 'bench', 'debug' => false],
+			'db' => ['host' => 'localhost', 'port' => 5432],
+		]);
+	});
+	$container->set('events', function (Php3dBenchContainer $c): Php3dBenchEvents {
+		Php3dBenchContainer::$calls++;
+		$events = new Php3dBenchEvents();
+		$events->listen('response', function (array $response) use ($c): array {
+			Php3dBenchContainer::$calls++;
+			$response['headers']['X-App'] = $c->get('config')->get('app.name');
+			return $response;
+		});
+		return $events;
+	});
+	$container->set('router', function (): Php3dBenchRouter {
+		Php3dBenchContainer::$calls++;
+		$router = new Php3dBenchRouter();
+		$router->add('GET', '/', fn() => ['status' => 200, 'body' => 'home']);
+		$router->add('GET', '/users/{id}', function (array $request, array $params, Php3dBenchContainer $c): array {
+			Php3dBenchContainer::$calls++;
+			$port = $c->get('config')->get('db.port');
+			return ['status' => 200, 'body' => json_encode(['id' => (int) $params['id'], 'port' => $port])];
+		});
+		$router->add('POST', '/users', fn() => ['status' => 201, 'body' => '']);
+		return $router;
+	});
+
+	$kernel = new Php3dBenchKernel($container);
+	$kernel->pipe(function (array $request, Closure $next): array {
+		Php3dBenchContainer::$calls++;
+		$request['path'] = rtrim($request['path'], '/') ?: '/';
+		return $next($request);
+	});
+	$kernel->pipe(function (array $request, Closure $next) use ($container): array {
+		Php3dBenchContainer::$calls++;
+		return $container->get('events')->dispatch('response', $next($request));
+	});
+
+	return $kernel->handle(['method' => 'GET', 'path' => '/users/' . $i . '/']);
+}
+
+$iterations = (int) ($argv[1] ?? 2000);
+
+$start = hrtime(true);
+for ($i = 0; $i < $iterations; $i++) {
+	php3d_bench_bootstrap($i);
+}
+$elapsed = hrtime(true) - $start;
+
+php3d_bench_report(Php3dBenchContainer::$calls, $elapsed);
@@ -0,0 +1,23 @@
+<?php
+// Measures the observer overhead per function call with a hot loop around a small function.
+//
+//   php -n -d extension=php_3d -d php_3d.generate_model=0 bench/observer.php
+//   php -n -d extension=php_3d -d php_3d.generate_model=1 bench/observer.php
+//
+// bench/run.php runs it along with the other workloads.
+require __DIR__ . '/bench.php';
+
+function php3d_bench_noop($a, $b) {
+	$c = $a + $b;
+	return $c;
+}
+
+$iterations = (int) ($argv[1] ?? 100000);
+
+$start = hrtime(true);
+for ($i = 0; $i < $iterations; $i++) {
+	php3d_bench_noop($i, 1);
+}
+$elapsed = hrtime(true) - $start;
+
+php3d_bench_report($iterations, $elapsed);
@@ -0,0 +1,20 @@
+<?php
+// Deep recursion: a room that is visited on many floors at once, with a deep shadow stack.
+require __DIR__ . '/bench.php';
+
+const PHP3D_BENCH_DEPTH = 256;
+
+function php3d_bench_recurse(int $depth): int {
+	return $depth ? php3d_bench_recurse($depth - 1) + 1 : 1;
+}
+
+$iterations = (int) ($argv[1] ?? 400);
+
+$calls = 0;
+$start = hrtime(true);
+for ($i = 0; $i < $iterations; $i++) {
+	$calls += php3d_bench_recurse(PHP3D_BENCH_DEPTH);
+}
+$elapsed = hrtime(true) - $start;
+
+php3d_bench_report($calls, $elapsed);
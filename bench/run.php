@@ -0,0 +1,155 @@
+<?php
+// Runs every workload without the extension, with the observer only and with full capture, and
+// writes the medians as JSON so that runs can be diffed for regressions:
+//
+//   php bench/run.php --extension=modules/php_3d.so --output=bench.json
+//   php bench/run.php --repeat=9 --scale=4 recursion framework
+//
+// Every run is a PHP process of its own with -n, so no other extension or INI file skews it.
+//   off       the extension is not loaded
+//   observer  the functions are observed but nothing is recorded, php_3d.autostart=0
+//   capture   the whole request is recorded and its town built synchronously in RSHUTDOWN
+//
+// shutdown_ms is the time from the end of the script to the exit of the process, which is mostly
+// RSHUTDOWN, and output_bytes the size of the files that were saved.
+
+const PHP3D_BENCH_WORKLOADS = [
+	'hot_loop' => ['file' => 'observer.php', 'iterations' => 100000],
+	'recursion' => ['file' => 'recursion.php', 'iterations' => 400],
+	'wide' => ['file' => 'wide.php', 'iterations' => 20000],
+	'framework' => ['file' => 'framework.php', 'iterations' => 2000],
+];
+
+$options = getopt('', ['php:', 'extension:', 'backend:', 'repeat:', 'scale:', 'output:'], $rest);
+$php = $options['php'] ?? PHP_BINARY;
+$extension = $options['extension'] ?? 'php_3d';
+$backend = $options['backend'] ?? 'gltf';
+$repeat = max(1, (int) ($options['repeat'] ?? 5));
+$scale = max(1, (int) ($options['scale'] ?? 1));
+$workloads = array_slice($argv, $rest) ?: array_keys(PHP3D_BENCH_WORKLOADS);
+
+$modes = [
+	'off' => [],
+	'observer' => [
+		'extension' => $extension,
+		'php_3d.generate_model' => '1',
+		'php_3d.autostart' => '0',
+	],
+	'capture' => [
+		'extension' => $extension,
+		'php_3d.generate_model' => '1',
+		'php_3d.backend' => $backend,
+		'php_3d.writer_queue_depth' => '0',
+	],
+];
+
+function php3d_bench_median(array $values): float {
+	sort($values);
+	$middle = intdiv(count($values), 2);
+	return count($values) % 2 ? $values[$middle] : ($values[$middle - 1] + $values[$middle]) / 2;
+}
+
+function php3d_bench_dir_size(string $dir): int {
+	$bytes = 0;
+	foreach (glob($dir . '/*') ?: [] as $file) {
+		$bytes += filesize($file);
+		unlink($file);
+	}
+	return $bytes;
+}
+
+// Returns the report of the workload with the shutdown time and output size added, or null if it failed
+function php3d_bench_run(string $php, array $ini, string $file, int $iterations, string $dir): ?array {
+	if ($ini) {
+		$ini['php_3d.output_file'] = $dir . '/php';
+	}
+	$command = [$php, '-n'];
+	foreach ($ini as $name => $value) {
+		array_push($command, '-d', $name . '=' . $value);
+	}
+	array_push($command, $file, (string) $iterations);
+
+	$process = proc_open($command, [1 => ['pipe', 'w'], 2 => ['pipe', 'w']], $pipes);
+	if (!$process) return null;
+	$stdout = stream_get_contents($pipes[1]);
+	$stderr = stream_get_contents($pipes[2]);
+	fclose($pipes[1]);
+	fclose($pipes[2]);
+	$status = proc_close($process);
+	$exit_ns = hrtime(true);
+
+	$lines = explode("\n", trim($stdout));
+	$report = json_decode(end($lines), true);
+	if ($status !== 0 || !is_array($report)) {
+		fwrite(STDERR, basename($file) . ' failed with status ' . $status . ': ' . trim($stderr ?: $stdout) . "\n");
+		return null;
+	}
+	$report['shutdown_ns'] = $exit_ns - $report['end_ns'];
+	$report['output_bytes'] = php3d_bench_dir_size($dir);
+	return $report;
+}
+
+$dir = sys_get_temp_dir() . '/php_3d_bench.' . getmypid();
+if (!is_dir($dir) && !mkdir($dir, 0700)) {
+	fwrite(STDERR, "Can't create $dir\n");
+	exit(1);
+}
+
+$results = [];
+$failed = false;
+foreach ($workloads as $name) {
+	if (!isset(PHP3D_BENCH_WORKLOADS[$name])) {
+		fwrite(STDERR, "Unknown workload \"$name\", one of " . implode(', ', array_keys(PHP3D_BENCH_WORKLOADS)) . "\n");
+		exit(2);
+	}
+	$workload = PHP3D_BENCH_WORKLOADS[$name];
+	$file = __DIR__ . '/' . $workload['file'];
+	$iterations = $workload['iterations'] * $scale;
+	$baseline = null;
+	foreach ($modes as $mode => $ini) {
+		$runs = [];
+		for ($i = 0; $i < $repeat; $i++) {
+			$run = php3d_bench_run($php, $ini, $file, $iterations, $dir);
+			if (!$run) {
+				$failed = true;
+				continue 2;
+			}
+			$runs[] = $run;
+		}
+		$ns_per_call = php3d_bench_median(array_map(fn($run) => $run['elapsed_ns'] / max(1, $run['calls']), $runs));
+		if ($mode === 'off') {
+			$baseline = $ns_per_call;
+		}
+		$result = [
+			'workload' => $name,
+			'mode' => $mode,
+			'iterations' => $iterations,
+			'calls' => $runs[0]['calls'],
+			'ns_per_call' => round($ns_per_call, 1),
+			'overhead_ns_per_call' => $baseline === null ? null : round($ns_per_call - $baseline, 1),
+			'peak_memory' => (int) php3d_bench_median(array_column($runs, 'peak_memory')),
+			'peak_rss_kb' => (int) php3d_bench_median(array_column($runs, 'peak_rss_kb')),
+			'shutdown_ms' => round(php3d_bench_median(array_column($runs, 'shutdown_ns')) / 1e6, 3),
+			'output_bytes' => (int) php3d_bench_median(array_column($runs, 'output_bytes')),
+		];
+		$results[] = $result;
+		fprintf(STDERR, "%-10s %-9s %10.1f ns/call %10.3f ms shutdown %12d bytes\n",
+			$name, $mode, $result['ns_per_call'], $result['shutdown_ms'], $result['output_bytes']);
+	}
+}
+rmdir($dir);
+
+$json = json_encode([
+	'php' => trim((string) shell_exec(escapeshellarg($php) . ' -n -r "echo PHP_VERSION;"')),
+	'backend' => $backend,
+	'repeat' => $repeat,
+	'time' => date(DATE_ATOM),
+	'results' => $results,
+], JSON_PRETTY_PRINT | JSON_UNESCAPED_SLASHES) . "\n";
+
+if (isset($options['output'])) {
+	file_put_contents($options['output'], $json);
+} else {
+	echo $json;
+}
+exit($failed ? 1 : 0);
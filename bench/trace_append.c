@@ -0,0 +1,130 @@
+// Measures what the observer pays per function call for bench/observer.php's function, without
+// PHP: building the town right in the call, as the observer did before it recorded a trace, against
+// appending the call to the trace and building the town from it at the end of the request.
+//
+//   $ cc -O2 -I. -o trace_append bench/trace_append.c arena.c layout.c mesh.c mesh_skp.c sketchup.c sketchup_backend.c sketchup_gltf.c sketchup_null.c trace.c trace_file.c -lm -lpthread
+//   $ ./trace_append 100000
+//
+// A call is a room visit with its three variables $a, $b and $c. Every visit gets its floor, as
+// with php_3d.max_floors=0. "in call" is the time spent inside the calls, "total" adds building
+// and saving the town, which the trace defers to the end of the request or to the writer thread.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "clock.h"
+#include "sketchup.h"
+#include "trace.h"
+
+#define REPEAT 5
+
+typedef struct bench_result_s {
+	double call_ns;
+	double total_ns;
+} bench_result;
+
+static const char *const var_names[3] = {"a", "b", "c"};
+
+// Before the trace, every call went straight to the backend
+static bool bench_direct(const sketchup_backend *backend, size_t calls, const char *file, bench_result *result) {
+	uint64_t start = clock_now_ns();
+	sketchup_town town;
+	if (!sketchup_town_ctor(&town, backend)) return false;
+	bool ok = sketchup_town_append_room(town, "{main}", 0, 0);
+	uint64_t call_start = clock_now_ns();
+	for (size_t i = 0; ok && i < calls; i++) {
+		ok = sketchup_town_append_room(town, "php3d_bench_noop", 1, i);
+		for (size_t v = 0; ok && v < 3; v++) {
+			sketchup_val val = {.type = SKETCHUP_VAL_LONG};
+			ok = sketchup_room_append_variable(town, 1, i, v, var_names[v], val);
+		}
+	}
+	uint64_t call_end = clock_now_ns();
+	ok = sketchup_town_save(town, file) && ok;
+	ok = sketchup_town_dtor(town) && ok;
+	result->call_ns = (double) (call_end - call_start) / (double) calls;
+	result->total_ns = (double) (clock_now_ns() - start) / (double) calls;
+	return ok;
+}
+
+// The observer now only appends fixed size events, the names are interned when the room is registered
+static bool bench_trace(const sketchup_backend *backend, size_t calls, const char *file, bench_result *result) {
+	uint64_t start = clock_now_ns();
+	trace_buffer *trace = trace_ctor();
+	if (!trace) return false;
+	uint32_t main_id, name_id, var_ids[3];
+	bool ok = trace_intern(trace, "{main}", 6, &main_id) && trace_intern(trace, "php3d_bench_noop", 16, &name_id);
+	for (size_t v = 0; ok && v < 3; v++) {
+		ok = trace_intern(trace, var_names[v], 1, &var_ids[v]);
+	}
+	trace_event main_enter = {.type = TRACE_ROOM_ENTER, .name_id = main_id};
+	ok = ok && trace_append(trace, &main_enter);
+	uint64_t call_start = clock_now_ns();
+	for (uint32_t i = 0; ok && i < calls; i++) {
+		trace_event event = {.type = TRACE_ROOM_ENTER, .name_id = name_id, .room_index = 1, .visit_index = i};
+		ok = trace_append(trace, &event);
+		event.type = TRACE_VAR;
+		event.val_type = SKETCHUP_VAL_LONG;
+		for (uint32_t v = 0; ok && v < 3; v++) {
+			event.name_id = var_ids[v];
+			event.var_index = v;
+			ok = trace_append(trace, &event);
+		}
+		event.type = TRACE_ROOM_EXIT;
+		event.val_type = 0;
+		event.name_id = 0;
+		event.var_index = 0;
+		ok = ok && trace_append(trace, &event);
+	}
+	uint64_t call_end = clock_now_ns();
+	ok = ok && trace_render(trace, backend, file);
+	trace_dtor(trace);
+	result->call_ns = (double) (call_end - call_start) / (double) calls;
+	result->total_ns = (double) (clock_now_ns() - start) / (double) calls;
+	return ok;
+}
+
+static int bench_compare(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+static bool bench_run(const char *name, const sketchup_backend *backend, size_t calls, const char *dir,
+		bool (*bench)(const sketchup_backend *, size_t, const char *, bench_result *)) {
+	char file[1024];
+	snprintf(file, sizeof(file), "%s/trace_append.%s", dir, backend->extension);
+	double call_ns[REPEAT], total_ns[REPEAT];
+	for (int i = 0; i < REPEAT; i++) {
+		bench_result result;
+		if (!bench(backend, calls, file, &result)) {
+			fprintf(stderr, "%s on %s failed\n", name, backend->name);
+			return false;
+		}
+		call_ns[i] = result.call_ns;
+		total_ns[i] = result.total_ns;
+	}
+	unlink(file);
+	qsort(call_ns, REPEAT, sizeof(double), bench_compare);
+	qsort(total_ns, REPEAT, sizeof(double), bench_compare);
+	printf("%-6s %-4s %8.1f ns/call in call %8.1f ns/call total\n", name, backend->name, call_ns[REPEAT / 2], total_ns[REPEAT / 2]);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	size_t calls = argc > 1 ? strtoul(argv[1], NULL, 10) : 100000;
+	const char *dir = argc > 2 ? argv[2] : "/tmp";
+	if (!calls) {
+		fprintf(stderr, "Usage: %s [calls] [dir]\n", argv[0]);
+		return 2;
+	}
+	const sketchup_backend *backends[] = {&sketchup_backend_null, &sketchup_backend_gltf};
+	bool ok = true;
+	for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+		backends[i]->startup();
+		ok = bench_run("direct", backends[i], calls, dir, bench_direct) && ok;
+		ok = bench_run("trace", backends[i], calls, dir, bench_trace) && ok;
+		backends[i]->shutdown();
+	}
+	return ok ? 0 : 1;
+}
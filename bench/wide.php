@@ -0,0 +1,58 @@
+<?php
+// Wide classes: methods with many compiled variables of mixed types, which is what snapshots cost.
+require __DIR__ . '/bench.php';
+
+final class Php3dBenchInvoice {
+	private array $lines = [];
+
+	public function addLine(string $sku, int $quantity, float $price, float $discount, bool $taxable, ?string $note): int {
+		$net = $quantity * $price;
+		$reduction = $net * $discount;
+		$total = $net - $reduction;
+		$tax = $taxable ? $total * 0.2 : 0.0;
+		$gross = $total + $tax;
+		$label = $sku . ' x' . $quantity;
+		$flags = ['taxable' => $taxable, 'noted' => $note !== null];
+		$rounded = round($gross, 2);
+		$cents = (int) ($rounded * 100);
+		$line = [$label, $cents, $flags];
+		$this->lines[] = $line;
+		return count($this->lines);
+	}
+
+	public function totals(string $currency, float $rate, bool $round, int $precision): array {
+		$count = count($this->lines);
+		$cents = 0;
+		$taxable = 0;
+		$noted = 0;
+		foreach ($this->lines as $line) {
+			$cents += $line[1];
+			$taxable += $line[2]['taxable'] ? 1 : 0;
+			$noted += $line[2]['noted'] ? 1 : 0;
+		}
+		$amount = $cents / 100 * $rate;
+		$display = $round ? round($amount, $precision) : $amount;
+		$formatted = number_format($display, $precision) . ' ' . $currency;
+		$average = $count ? $amount / $count : 0.0;
+		$empty = $count === 0;
+		$this->lines = [];
+		return [$formatted, $average, $taxable, $noted, $empty];
+	}
+}
+
+$iterations = (int) ($argv[1] ?? 20000);
+
+$invoice = new Php3dBenchInvoice();
+$calls = 0;
+$start = hrtime(true);
+for ($i = 0; $i < $iterations; $i++) {
+	$invoice->addLine('SKU-' . ($i % 97), $i % 7 + 1, 9.99, 0.1, $i % 3 !== 0, $i % 5 ? null : 'gift');
+	$calls++;
+	if ($i % 8 === 7) {
+		$invoice->totals('EUR', 1.08, true, 2);
+		$calls++;
+	}
+}
+$elapsed = hrtime(true) - $start;
+
+php3d_bench_report($calls, $elapsed);
@@ -0,0 +1,27 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __APPLE__
+# include <mach/mach_time.h>
+#endif
+
+// Monotonic high-resolution time in nanoseconds. Served from the vDSO on Linux and from the
+// commpage on macOS, so reading it does not enter the kernel.
+static inline uint64_t clock_now_ns(void) {
+#ifdef __APPLE__
+    static mach_timebase_info_data_t timebase;
+    if (!timebase.denom) {
+        mach_timebase_info(&timebase);
+    }
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+#endif	/* CLOCK_H */
@@ -15,16 +15,27 @@ if test "$PHP_3D" != "no"; then
   done
 
   if test -z "$SKETCHUP_DIR"; then
-    AC_MSG_ERROR(Cannot find SketchUpAPI framework)
-  fi
+    if test "$PHP_SKETCHUP_API" != "no" && test "$PHP_SKETCHUP_API" != ""; then
+      AC_MSG_ERROR(Cannot find SketchUpAPI framework)
+    fi
+    AC_MSG_WARN([SketchUpAPI framework not found, only the null and gltf backends will be available])
+  else
+    AC_DEFINE_UNQUOTED(PHP_SKETCHUP_API_PATH, "${SKETCHUP_DIR}/SketchUpAPI.framework", [ ])
+    AC_DEFINE(HAVE_SKETCHUP_API, 1, [ Have SketchUpAPI support ])
 
-  AC_DEFINE_UNQUOTED(PHP_SKETCHUP_API_PATH, "${SKETCHUP_DIR}/SketchUpAPI.framework", [ ])
+    dnl Why this no worky?
+    dnl PHP_ADD_FRAMEWORK_WITH_PATH(SketchUpAPI, $SKETCHUP_DIR)
+    PHP_3D_CFLAGS="-F$SKETCHUP_DIR -framework SketchUpAPI"
+    EXTRA_LDFLAGS="$EXTRA_LDFLAGS -F$SKETCHUP_DIR -framework SketchUpAPI -rpath $SKETCHUP_DIR"
+  fi
 
-  dnl Why this no worky?
-  dnl PHP_ADD_FRAMEWORK_WITH_PATH(SketchUpAPI, $SKETCHUP_DIR)
-  PHP_3D_CFLAGS="-F$SKETCHUP_DIR -framework SketchUpAPI"
-  EXTRA_LDFLAGS="$EXTRA_LDFLAGS -F$SKETCHUP_DIR -framework SketchUpAPI -rpath $SKETCHUP_DIR"
+  AC_CHECK_LIB(pthread, pthread_create, [PHP_ADD_LIBRARY(pthread,, PHP_3D_SHARED_LIBADD)])
+  AC_CHECK_LIB(z, compress2, [
+    AC_DEFINE(HAVE_3D_ZLIB, 1, [ Have zlib to compress trace files ])
+    PHP_ADD_LIBRARY(z,, PHP_3D_SHARED_LIBADD)
+  ])
+  PHP_SUBST(PHP_3D_SHARED_LIBADD)
 
   AC_DEFINE(HAVE_3D, 1, [ Have 3D support ])
-  PHP_NEW_EXTENSION(php_3d, 3d.c sketchup.c, $ext_shared, , $PHP_3D_CFLAGS)
+  PHP_NEW_EXTENSION(php_3d, 3d.c aggregate.c arena.c filter.c layout.c mesh.c mesh_skp.c sampler.c sketchup.c sketchup_backend.c sketchup_gltf.c sketchup_null.c trace.c trace_file.c writer.c, $ext_shared, , $PHP_3D_CFLAGS)
 fi
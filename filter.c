@@ -0,0 +1,144 @@
+#include "filter.h"
+
+#include <ctype.h>
+#include <string.h>
+
+static const struct {
+	const char *prefix;
+	enum filter_kind kind;
+} filter_prefixes[] = {
+	{"ns:", FILTER_NAMESPACE},
+	{"namespace:", FILTER_NAMESPACE},
+	{"class:", FILTER_CLASS},
+	{"function:", FILTER_FUNCTION},
+	{"func:", FILTER_FUNCTION},
+	{"file:", FILTER_FILE},
+};
+
+static bool filter_parse(const char *list, filter_pattern **patterns, size_t *count) {
+	*patterns = NULL;
+	*count = 0;
+	if (!list) return true;
+
+	size_t cap = 1;
+	for (const char *c = list; *c; c++) {
+		if (*c == ',') cap++;
+	}
+	*patterns = (filter_pattern *)calloc(cap, sizeof(filter_pattern));
+	if (!*patterns) return false;
+
+	const char *start = list;
+	while (true) {
+		const char *end = strchr(start, ',');
+		if (!end) end = start + strlen(start);
+
+		// Trim whitespace
+		const char *s = start;
+		const char *e = end;
+		while (s < e && isspace((unsigned char) *s)) s++;
+		while (e > s && isspace((unsigned char) e[-1])) e--;
+
+		if (s < e) {
+			filter_pattern *pattern = &(*patterns)[*count];
+			pattern->kind = FILTER_NAME;
+			for (size_t i = 0; i < sizeof(filter_prefixes) / sizeof(filter_prefixes[0]); i++) {
+				size_t len = strlen(filter_prefixes[i].prefix);
+				if ((size_t) (e - s) >= len && strncmp(s, filter_prefixes[i].prefix, len) == 0) {
+					pattern->kind = filter_prefixes[i].kind;
+					s += len;
+					break;
+				}
+			}
+			pattern->glob = strndup(s, (size_t) (e - s));
+			if (!pattern->glob) return false;
+			(*count)++;
+		}
+
+		if (!*end) break;
+		start = end + 1;
+	}
+	return true;
+}
+
+static void filter_patterns_free(filter_pattern *patterns, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		free(patterns[i].glob);
+	}
+	free(patterns);
+}
+
+bool filter_ctor(filter *f, const char *includes, const char *excludes) {
+	memset(f, 0, sizeof(filter));
+	if (!filter_parse(includes, &f->includes, &f->include_count) || !filter_parse(excludes, &f->excludes, &f->exclude_count)) {
+		filter_dtor(f);
+		return false;
+	}
+	return true;
+}
+
+void filter_dtor(filter *f) {
+	filter_patterns_free(f->includes, f->include_count);
+	filter_patterns_free(f->excludes, f->exclude_count);
+	memset(f, 0, sizeof(filter));
+}
+
+bool filter_is_empty(const filter *f) {
+	return f->include_count == 0 && f->exclude_count == 0;
+}
+
+static inline bool filter_char_eq(char a, char b, bool case_sensitive) {
+	return case_sensitive ? a == b : tolower((unsigned char) a) == tolower((unsigned char) b);
+}
+
+static bool filter_glob_match(const char *glob, const char *str, size_t len, bool case_sensitive) {
+	size_t s = 0;
+	// Where to resume when the last * has to swallow one more character
+	const char *star = NULL;
+	size_t star_s = 0;
+	while (s < len) {
+		if (*glob == '*') {
+			star = ++glob;
+			star_s = s;
+		} else if (*glob && (*glob == '?' || filter_char_eq(*glob, str[s], case_sensitive))) {
+			glob++;
+			s++;
+		} else if (star) {
+			glob = star;
+			s = ++star_s;
+		} else {
+			return false;
+		}
+	}
+	while (*glob == '*') glob++;
+	return *glob == '\0';
+}
+
+static bool filter_pattern_matches(const filter_pattern *pattern, const filter_subject *subject) {
+	switch (pattern->kind) {
+		case FILTER_NAMESPACE:
+			return filter_glob_match(pattern->glob, subject->ns ? subject->ns : "", subject->ns ? subject->ns_len : 0, false);
+		case FILTER_CLASS:
+			return subject->class_name && filter_glob_match(pattern->glob, subject->class_name, subject->class_name_len, false);
+		case FILTER_FUNCTION:
+			return subject->function && filter_glob_match(pattern->glob, subject->function, subject->function_len, false);
+		case FILTER_FILE:
+			return subject->file && filter_glob_match(pattern->glob, subject->file, subject->file_len, true);
+		case FILTER_NAME:
+		default:
+			return subject->name && filter_glob_match(pattern->glob, subject->name, subject->name_len, false);
+	}
+}
+
+bool filter_allows(const filter *f, const filter_subject *subject) {
+	if (f->include_count) {
+		bool included = false;
+		for (size_t i = 0; i < f->include_count && !included; i++) {
+			included = filter_pattern_matches(&f->includes[i], subject);
+		}
+		if (!included) return false;
+	}
+	for (size_t i = 0; i < f->exclude_count; i++) {
+		if (filter_pattern_matches(&f->excludes[i], subject)) return false;
+	}
+	return true;
+}
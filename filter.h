@@ -0,0 +1,49 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Include/exclude patterns that decide which functions get observed. Patterns are comma separated
+// globs (* and ?) with an optional kind prefix, e.g. "ns:Vendor\*, class:*Test, function:str*, file:*/vendor/*".
+// Without a prefix a pattern matches the qualified function name, e.g. "App\Controller::index".
+enum filter_kind {
+    FILTER_NAME = 0,
+    FILTER_NAMESPACE,
+    FILTER_CLASS,
+    FILTER_FUNCTION,
+    FILTER_FILE,
+};
+
+typedef struct filter_pattern_s {
+    enum filter_kind kind;
+    char *glob;
+} filter_pattern;
+
+typedef struct filter_s {
+    filter_pattern *includes;
+    size_t include_count;
+    filter_pattern *excludes;
+    size_t exclude_count;
+} filter;
+
+typedef struct filter_subject_s {
+    const char *ns;         // Namespace of the function or class, without trailing separator
+    size_t ns_len;
+    const char *class_name; // Fully qualified, NULL for functions
+    size_t class_name_len;
+    const char *function;   // Function or method name, unqualified for namespaced functions
+    size_t function_len;
+    const char *name;       // Qualified name, e.g. "Ns\Class::method" or "Ns\function"
+    size_t name_len;
+    const char *file;       // NULL for internal functions
+    size_t file_len;
+} filter_subject;
+
+bool filter_ctor(filter *f, const char *includes, const char *excludes);
+void filter_dtor(filter *f);
+bool filter_is_empty(const filter *f);
+
+bool filter_allows(const filter *f, const filter_subject *subject);
+
+#endif	/* FILTER_H */
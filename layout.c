@@ -0,0 +1,161 @@
+#include "layout.h"
+
+#include <math.h>
+
+// The district the room belongs to, NULL for the rooms of an unmerged town and the town center
+static const layout_district *layout_district_of(const layout *l, size_t room_index) {
+	const layout_district *found = NULL;
+	size_t lo = 0, hi = l->district_count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (l->districts[mid].room_base <= room_index) {
+			found = &l->districts[mid];
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return found;
+}
+
+// How many rooms the spiral of room_count rooms reaches out from its center
+static size_t layout_spiral_reach(size_t room_count) {
+	size_t size = room_count > 1 ? (size_t) floor(sqrt((double) (room_count - 1))) : 0;
+	return (size + 1) / 2;
+}
+
+void layout_districts_place(const layout *l, layout_district *districts, size_t count) {
+	// Leaves a street between the town center and the first district, and between districts
+	double cursor = 2.0;
+	for (size_t i = 0; i < count; i++) {
+		size_t reach = layout_spiral_reach(districts[i].room_count);
+		cursor += (double) reach;
+		districts[i].origin[0] = cursor * (l->room[0] + LAYOUT_BUILDING_PAD);
+		districts[i].origin[1] = 0.0;
+		cursor += (double) reach + 2.0;
+	}
+}
+
+// Where room_index of a spiral centered on the origin goes, room 0 is the center
+static void layout_spiral_location(const layout *l, size_t room_index, size_t visit_index, double point[3]) {
+	if (room_index == 0) {
+		point[0] = 0.0;
+		point[1] = 0.0;
+		point[2] = l->room[2] * (double) visit_index;
+		return;
+	}
+
+	// There's probably a fancy maths thing to calculate this more elegantly, but I'm no math wiz
+	double square = sqrt((double) room_index);
+	size_t size = (size_t) floor(square);
+	int max = (int) floor((size + 1) / 2);
+	int min = max * -1;
+	// TODO rename? What even is this?
+	int start = min;
+	int end = max;
+	// Odd
+	if ((size % 2) == 1) {
+		min++;
+		start = max;
+		end = min;
+	}
+
+	if (round(square) <= size) {
+		// All x are same
+		point[0] = (double) start;
+		// This is a special corner so needs special treatment... for some reason
+		if (((size * size) + size) == room_index) {
+			point[1] = point[0];
+		} else {
+			point[1] = (double) end - (room_index % size);
+		}
+	} else {
+		point[0] = (double) end - (room_index % size);
+		// All y are same
+		point[1] = (double) start;
+	}
+
+	point[0] *= (l->room[0] + LAYOUT_BUILDING_PAD);
+	point[1] *= (l->room[1] + LAYOUT_BUILDING_PAD);
+	point[2] = l->room[2] * (double) visit_index;
+}
+
+void layout_room_location(const layout *l, size_t room_index, size_t visit_index, double point[3]) {
+	if (room_index == 0) {
+		point[0] = 0.0;
+		point[1] = 0.0;
+		point[2] = 0.0;
+		return;
+	}
+	const layout_district *district = l->districts ? layout_district_of(l, room_index) : NULL;
+	if (!district) {
+		layout_spiral_location(l, room_index, visit_index, point);
+		return;
+	}
+	// The main script of a district is a regular building at its origin
+	layout_spiral_location(l, room_index - district->room_base, visit_index, point);
+	point[0] += district->origin[0];
+	point[1] += district->origin[1];
+}
+
+#define WALL_DEPTH 6.0
+#define WALL_DEPTH_TC 84.0
+#define ROOM_PAD 24.0
+#define VAR_PAD 12.0
+#define FLOOR_PAD 6.0
+#define FLOOR_PAD_TC 30.0
+
+void layout_var_location(const layout *l, size_t room_index, size_t visit_index, size_t var_index, double point[3]) {
+	double wall_depth_y = room_index ? WALL_DEPTH /* Rooms have only one wall on y axis */ : WALL_DEPTH_TC * 2;
+	double room_height = l->room[1] - wall_depth_y;
+	double var_height = l->var[1] + VAR_PAD;
+	size_t max_per_column = (size_t) (room_height / var_height);
+	if (max_per_column == 0) max_per_column = 1;
+
+	double room_point[3];
+	layout_room_location(l, room_index, visit_index, room_point);
+
+	double var_width = l->var[0] + VAR_PAD;
+	double wall_depth_x = room_index ? WALL_DEPTH : WALL_DEPTH_TC;
+	point[0] = room_point[0] + wall_depth_x + ROOM_PAD + var_width * (double) (var_index / max_per_column);
+
+	double room_top = room_point[1] /* South */ + l->room[1];
+	point[1] = room_top - wall_depth_x - ROOM_PAD - (var_height * (double) (var_index % max_per_column));
+
+	point[2] = room_point[2] + (room_index ? FLOOR_PAD : FLOOR_PAD_TC);
+}
+
+// The street corner south-west of the room, which keeps clear of the bigger town center too
+static void layout_street_corner(const layout *l, size_t room_index, double point[3]) {
+	layout_room_location(l, room_index, 0, point);
+	point[0] -= LAYOUT_BUILDING_PAD / 2;
+	point[1] -= LAYOUT_BUILDING_PAD / 2;
+	point[2] = 0.0;
+}
+
+size_t layout_road_boxes(const layout *l, size_t from_room, size_t to_room, double width, double boxes[2][6]) {
+	double from[3], to[3];
+	layout_street_corner(l, from_room, from);
+	layout_street_corner(l, to_room, to);
+	size_t count = 0;
+	// Both legs overlap by half a width at the turn, so that the corner is filled in
+	if (from[0] != to[0]) {
+		double *box = boxes[count++];
+		box[0] = fmin(from[0], to[0]) - width / 2;
+		box[1] = from[1] - width / 2;
+		box[3] = fabs(to[0] - from[0]) + width;
+		box[4] = width;
+	}
+	if (from[1] != to[1]) {
+		double *box = boxes[count++];
+		box[0] = to[0] - width / 2;
+		box[1] = fmin(from[1], to[1]) - width / 2;
+		box[3] = width;
+		box[4] = fabs(to[1] - from[1]) + width;
+	}
+	for (size_t i = 0; i < count; i++) {
+		boxes[i][2] = 0.0;
+		boxes[i][5] = LAYOUT_ROAD_HEIGHT;
+	}
+	return count;
+}
@@ -0,0 +1,42 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdlib.h>
+
+// A part of a merged town, e.g. the request of one thread, with its own spiral of rooms
+typedef struct layout_district_s {
+    size_t room_base;   // Its room 0 in the room numbers of the town
+    size_t room_count;
+    double origin[2];
+} layout_district;
+
+// Where rooms and variables go in a town, shared by every backend that places geometry.
+// Units are inches, z is up.
+typedef struct layout_s {
+    double room[3];     // Size of a room (one floor)
+    double var[3];      // Size of a variable
+    // Sorted by room_base, NULL unless the town was merged from several traces
+    const layout_district *districts;
+    size_t district_count;
+} layout;
+
+#define LAYOUT_BUILDING_PAD 360.0
+
+// Sets the origins of districts whose room_base and room_count are filled in. They are lined up
+// east of the town center, each one as wide as the spiral of its rooms.
+void layout_districts_place(const layout *l, layout_district *districts, size_t count);
+
+// The town center is room 0 at the origin, the other rooms spiral out around it. Every visit is a floor.
+// The rooms of a district spiral out around its origin instead.
+void layout_room_location(const layout *l, size_t room_index, size_t visit_index, double point[3]);
+// Variables are lined up in columns on the floor of their room
+void layout_var_location(const layout *l, size_t room_index, size_t visit_index, size_t var_index, double point[3]);
+
+#define LAYOUT_ROAD_HEIGHT 2.0
+
+// A road runs from the street corner of one room to the street corner of the other, first along x,
+// then along y, so that it stays in the streets between the buildings. Returns how many boxes, of
+// which the first three values are the corner and the last three the size, the road is made of.
+size_t layout_road_boxes(const layout *l, size_t from_room, size_t to_room, double width, double boxes[2][6]);
+
+#endif	/* LAYOUT_H */
@@ -0,0 +1,513 @@
+#include "mesh.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define MESH_ALIGN(size) (((size) + 7) & ~((size_t) 7))
+
+typedef struct mesh_layout_s {
+	size_t vertices;
+	size_t indices;
+	size_t loops;
+	size_t faces;
+	size_t materials;
+	size_t size;
+} mesh_layout;
+
+static void mesh_layout_get(const mesh_header *h, mesh_layout *l) {
+	l->vertices = sizeof(mesh_header);
+	l->indices = l->vertices + (size_t) h->vertex_count * 3 * sizeof(double);
+	l->loops = l->indices + MESH_ALIGN((size_t) h->index_count * sizeof(uint32_t));
+	l->faces = l->loops + (size_t) h->loop_count * sizeof(mesh_loop);
+	l->materials = l->faces + (size_t) h->face_count * sizeof(mesh_face);
+	l->size = l->materials + MESH_ALIGN((size_t) h->material_count * sizeof(mesh_material));
+}
+
+// Every loop and face must stay within the buffers, the file is used as is
+static bool mesh_validate(const mesh *m) {
+	for (uint32_t i = 0; i < m->index_count; i++) {
+		if (m->indices[i] >= m->vertex_count) return false;
+	}
+	for (uint32_t i = 0; i < m->loop_count; i++) {
+		if ((uint64_t) m->loops[i].index_start + m->loops[i].index_count > m->index_count) return false;
+	}
+	for (uint32_t i = 0; i < m->face_count; i++) {
+		const mesh_face *face = &m->faces[i];
+		if ((uint64_t) face->loop_start + face->loop_count > m->loop_count) return false;
+		if (face->front_material >= (int32_t) m->material_count || face->back_material >= (int32_t) m->material_count) return false;
+	}
+	return true;
+}
+
+bool mesh_open(mesh *m, const char *file) {
+	memset(m, 0, sizeof(mesh));
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(mesh_header)) {
+		close(fd);
+		return false;
+	}
+	void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return false;
+
+	const mesh_header *h = (const mesh_header *)map;
+	mesh_layout l;
+	mesh_layout_get(h, &l);
+	if (h->magic != MESH_MAGIC || h->version != MESH_VERSION || l.size != (size_t) st.st_size) {
+		munmap(map, (size_t) st.st_size);
+		return false;
+	}
+
+	const char *base = (const char *)map;
+	memcpy(m->bbox, h->bbox, sizeof(m->bbox));
+	m->vertices = (const double *)(base + l.vertices);
+	m->vertex_count = h->vertex_count;
+	m->indices = (const uint32_t *)(base + l.indices);
+	m->index_count = h->index_count;
+	m->loops = (const mesh_loop *)(base + l.loops);
+	m->loop_count = h->loop_count;
+	m->faces = (const mesh_face *)(base + l.faces);
+	m->face_count = h->face_count;
+	m->materials = (const mesh_material *)(base + l.materials);
+	m->material_count = h->material_count;
+	m->map = map;
+	m->map_size = (size_t) st.st_size;
+	if (!mesh_validate(m)) {
+		mesh_close(m);
+		return false;
+	}
+	return true;
+}
+
+void mesh_close(mesh *m) {
+	if (m->map) {
+		munmap(m->map, m->map_size);
+	}
+	memset(m, 0, sizeof(mesh));
+}
+
+size_t mesh_bytes(const mesh *m) {
+	mesh_header h = {
+		.vertex_count = m->vertex_count,
+		.index_count = m->index_count,
+		.loop_count = m->loop_count,
+		.face_count = m->face_count,
+		.material_count = m->material_count,
+	};
+	mesh_layout l;
+	mesh_layout_get(&h, &l);
+	return l.size;
+}
+
+static bool mesh_write_section(FILE *out, const void *data, size_t size) {
+	static const char padding[8] = {0};
+	if (size && fwrite(data, 1, size, out) != size) return false;
+	size_t pad = MESH_ALIGN(size) - size;
+	return !pad || fwrite(padding, 1, pad, out) == pad;
+}
+
+bool mesh_write(const mesh *m, const char *file) {
+	mesh_header h = {
+		.magic = MESH_MAGIC,
+		.version = MESH_VERSION,
+		.vertex_count = m->vertex_count,
+		.index_count = m->index_count,
+		.loop_count = m->loop_count,
+		.face_count = m->face_count,
+		.material_count = m->material_count,
+	};
+	memcpy(h.bbox, m->bbox, sizeof(h.bbox));
+
+	FILE *out = fopen(file, "wb");
+	if (!out) return false;
+	bool ok = mesh_write_section(out, &h, sizeof(h))
+		&& mesh_write_section(out, m->vertices, (size_t) m->vertex_count * 3 * sizeof(double))
+		&& mesh_write_section(out, m->indices, (size_t) m->index_count * sizeof(uint32_t))
+		&& mesh_write_section(out, m->loops, (size_t) m->loop_count * sizeof(mesh_loop))
+		&& mesh_write_section(out, m->faces, (size_t) m->face_count * sizeof(mesh_face))
+		&& mesh_write_section(out, m->materials, (size_t) m->material_count * sizeof(mesh_material));
+	return (fclose(out) == 0) && ok;
+}
+
+void mesh_builder_init(mesh_builder *b) {
+	memset(b, 0, sizeof(mesh_builder));
+}
+
+void mesh_builder_free(mesh_builder *b) {
+	free(b->vertices);
+	free(b->vertex_hash);
+	free(b->indices);
+	free(b->loops);
+	free(b->faces);
+	free(b->materials);
+	memset(b, 0, sizeof(mesh_builder));
+}
+
+static bool mesh_grow(void **buf, uint32_t *cap, uint32_t needed, size_t size) {
+	if (needed <= *cap) return true;
+	uint32_t grown = *cap ? *cap : 16;
+	while (grown < needed) grown *= 2;
+	void *ptr = realloc(*buf, (size_t) grown * size);
+	if (!ptr) return false;
+	*buf = ptr;
+	*cap = grown;
+	return true;
+}
+
+// FNV-1a over the bytes of the position
+static uint64_t mesh_vertex_hash(const double position[3]) {
+	const unsigned char *bytes = (const unsigned char *)position;
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < sizeof(double) * 3; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static bool mesh_vertex_hash_grow(mesh_builder *b) {
+	uint32_t cap = b->vertex_hash_cap ? b->vertex_hash_cap * 2 : 256;
+	uint32_t *table = (uint32_t *)calloc(cap, sizeof(uint32_t));
+	if (!table) return false;
+	for (uint32_t i = 0; i < b->vertex_count; i++) {
+		size_t slot = mesh_vertex_hash(&b->vertices[i * 3]) & (cap - 1);
+		while (table[slot]) slot = (slot + 1) & (cap - 1);
+		table[slot] = i + 1;
+	}
+	free(b->vertex_hash);
+	b->vertex_hash = table;
+	b->vertex_hash_cap = cap;
+	return true;
+}
+
+bool mesh_builder_vertex(mesh_builder *b, const double position[3], uint32_t *index) {
+	if ((b->vertex_count + 1) * 2 > b->vertex_hash_cap && !mesh_vertex_hash_grow(b)) return false;
+
+	size_t mask = b->vertex_hash_cap - 1;
+	size_t slot = mesh_vertex_hash(position) & mask;
+	while (b->vertex_hash[slot]) {
+		uint32_t i = b->vertex_hash[slot] - 1;
+		if (memcmp(&b->vertices[i * 3], position, sizeof(double) * 3) == 0) {
+			*index = i;
+			return true;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	if (!mesh_grow((void **) &b->vertices, &b->vertex_cap, (b->vertex_count + 1) * 3, sizeof(double))) return false;
+	memcpy(&b->vertices[b->vertex_count * 3], position, sizeof(double) * 3);
+	*index = b->vertex_count++;
+	b->vertex_hash[slot] = *index + 1;
+	return true;
+}
+
+bool mesh_builder_material(mesh_builder *b, mesh_material material, int32_t *id) {
+	for (uint32_t i = 0; i < b->material_count; i++) {
+		if (memcmp(&b->materials[i], &material, sizeof(mesh_material)) == 0) {
+			*id = (int32_t) i;
+			return true;
+		}
+	}
+	if (!mesh_grow((void **) &b->materials, &b->material_cap, b->material_count + 1, sizeof(mesh_material))) return false;
+	b->materials[b->material_count] = material;
+	*id = (int32_t) b->material_count++;
+	return true;
+}
+
+bool mesh_builder_face(mesh_builder *b, int32_t front_material, int32_t back_material) {
+	if (!mesh_grow((void **) &b->faces, &b->face_cap, b->face_count + 1, sizeof(mesh_face))) return false;
+	b->faces[b->face_count++] = (mesh_face) {
+		.loop_start = b->loop_count,
+		.loop_count = 0,
+		.front_material = front_material,
+		.back_material = back_material,
+	};
+	return true;
+}
+
+bool mesh_builder_loop(mesh_builder *b, const uint32_t *indices, uint32_t count) {
+	if (!b->face_count) return false;
+	if (!mesh_grow((void **) &b->loops, &b->loop_cap, b->loop_count + 1, sizeof(mesh_loop))) return false;
+	if (!mesh_grow((void **) &b->indices, &b->index_cap, b->index_count + count, sizeof(uint32_t))) return false;
+	memcpy(&b->indices[b->index_count], indices, (size_t) count * sizeof(uint32_t));
+	b->loops[b->loop_count++] = (mesh_loop) {b->index_count, count};
+	b->index_count += count;
+	b->faces[b->face_count - 1].loop_count++;
+	return true;
+}
+
+void mesh_builder_view(const mesh_builder *b, mesh *m) {
+	memset(m, 0, sizeof(mesh));
+	memcpy(m->bbox, b->bbox, sizeof(m->bbox));
+	m->vertices = b->vertices;
+	m->vertex_count = b->vertex_count;
+	m->indices = b->indices;
+	m->index_count = b->index_count;
+	m->loops = b->loops;
+	m->loop_count = b->loop_count;
+	m->faces = b->faces;
+	m->face_count = b->face_count;
+	m->materials = b->materials;
+	m->material_count = b->material_count;
+}
+
+void mesh_triangles_init(mesh_triangles *t) {
+	memset(t, 0, sizeof(mesh_triangles));
+}
+
+void mesh_triangles_free(mesh_triangles *t) {
+	free(t->indices);
+	free(t->polygon);
+	free(t->points);
+	free(t->next);
+	free(t->prev);
+	memset(t, 0, sizeof(mesh_triangles));
+}
+
+static bool mesh_triangles_reserve(mesh_triangles *t, uint32_t count) {
+	if (count <= t->polygon_cap) return true;
+	uint32_t cap = t->polygon_cap ? t->polygon_cap : 16;
+	while (cap < count) cap *= 2;
+	uint32_t *polygon = (uint32_t *)realloc(t->polygon, (size_t) cap * sizeof(uint32_t));
+	if (!polygon) return false;
+	t->polygon = polygon;
+	double *points = (double *)realloc(t->points, (size_t) cap * 2 * sizeof(double));
+	if (!points) return false;
+	t->points = points;
+	uint32_t *next = (uint32_t *)realloc(t->next, (size_t) cap * sizeof(uint32_t));
+	if (!next) return false;
+	t->next = next;
+	uint32_t *prev = (uint32_t *)realloc(t->prev, (size_t) cap * sizeof(uint32_t));
+	if (!prev) return false;
+	t->prev = prev;
+	t->polygon_cap = cap;
+	return true;
+}
+
+void mesh_face_normal(const mesh *m, uint32_t face, double normal[3]) {
+	normal[0] = normal[1] = normal[2] = 0.0;
+	if (!m->faces[face].loop_count) return;
+	// Newell's method, over the outer loop
+	const mesh_loop *loop = &m->loops[m->faces[face].loop_start];
+	for (uint32_t i = 0; i < loop->index_count; i++) {
+		const double *cur = &m->vertices[m->indices[loop->index_start + i] * 3];
+		const double *nxt = &m->vertices[m->indices[loop->index_start + (i + 1) % loop->index_count] * 3];
+		normal[0] += (cur[1] - nxt[1]) * (cur[2] + nxt[2]);
+		normal[1] += (cur[2] - nxt[2]) * (cur[0] + nxt[0]);
+		normal[2] += (cur[0] - nxt[0]) * (cur[1] + nxt[1]);
+	}
+}
+
+static double mesh_cross(const double *a, const double *b, const double *c) {
+	return (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+}
+
+// Inclusive of the edges, for either winding
+static bool mesh_in_triangle(const double *a, const double *b, const double *c, const double *p) {
+	double d1 = mesh_cross(a, b, p), d2 = mesh_cross(b, c, p), d3 = mesh_cross(c, a, p);
+	bool neg = d1 < 0 || d2 < 0 || d3 < 0;
+	bool pos = d1 > 0 || d2 > 0 || d3 > 0;
+	return !(neg && pos);
+}
+
+static bool mesh_same_point(const double *a, const double *b) {
+	return a[0] == b[0] && a[1] == b[1];
+}
+
+// Links the loop into a ring of nodes from *count on, counter-clockwise unless clockwise is set
+static uint32_t mesh_ring_add(mesh_triangles *t, uint32_t *count, const mesh *m, const mesh_loop *loop, int axis, double flip, bool clockwise) {
+	int u = (axis + 1) % 3, v = (axis + 2) % 3;
+	uint32_t first = *count;
+	double area = 0.0;
+	for (uint32_t i = 0; i < loop->index_count; i++) {
+		uint32_t node = first + i;
+		const double *vertex = &m->vertices[m->indices[loop->index_start + i] * 3];
+		t->polygon[node] = m->indices[loop->index_start + i];
+		t->points[node * 2] = flip * vertex[u];
+		t->points[node * 2 + 1] = vertex[v];
+		if (i) {
+			area += t->points[(node - 1) * 2] * t->points[node * 2 + 1] - t->points[node * 2] * t->points[(node - 1) * 2 + 1];
+		}
+	}
+	uint32_t last = first + loop->index_count - 1;
+	area += t->points[last * 2] * t->points[first * 2 + 1] - t->points[first * 2] * t->points[last * 2 + 1];
+	bool reverse = clockwise ? area > 0 : area < 0;
+	for (uint32_t node = first; node <= last; node++) {
+		uint32_t after = node == last ? first : node + 1;
+		uint32_t before = node == first ? last : node - 1;
+		t->next[node] = reverse ? before : after;
+		t->prev[node] = reverse ? after : before;
+	}
+	*count += loop->index_count;
+	return first;
+}
+
+// Bridges a clockwise hole into the ring at node 0 from its rightmost node to a node of the ring that
+// it can see, see "Triangulation by Ear Clipping" by David Eberly. Returns false if there is none.
+static bool mesh_bridge_hole(mesh_triangles *t, uint32_t *count, uint32_t hole) {
+	const double *pts = t->points;
+	uint32_t right = hole;
+	for (uint32_t node = t->next[hole]; node != hole; node = t->next[node]) {
+		if (pts[node * 2] > pts[right * 2]) right = node;
+	}
+	const double *mp = &pts[right * 2];
+
+	// The nearest edge to the right of the hole, and its end furthest right
+	uint32_t visible = UINT32_MAX;
+	double nearest = 0.0, hit[2] = {0.0, mp[1]};
+	uint32_t a = 0;
+	do {
+		uint32_t b = t->next[a];
+		const double *pa = &pts[a * 2], *pb = &pts[b * 2];
+		if (pa[1] == mp[1] && pa[0] >= mp[0] && (visible == UINT32_MAX || pa[0] < nearest)) {
+			visible = a;
+			nearest = hit[0] = pa[0];
+		} else if (pa[1] != pb[1] && ((pa[1] < mp[1] && pb[1] > mp[1]) || (pa[1] > mp[1] && pb[1] < mp[1]))) {
+			double x = pa[0] + (mp[1] - pa[1]) * (pb[0] - pa[0]) / (pb[1] - pa[1]);
+			if (x >= mp[0] && (visible == UINT32_MAX || x < nearest)) {
+				visible = pa[0] > pb[0] ? a : b;
+				nearest = hit[0] = x;
+			}
+		}
+		a = b;
+	} while (a != 0);
+	if (visible == UINT32_MAX) return false;
+
+	// Nodes within the triangle of the hole, the hit and that end block the view, take the one
+	// closest in angle to the ray instead
+	if (!mesh_same_point(hit, &pts[visible * 2])) {
+		const double *pv = &pts[visible * 2];
+		double best = (pv[0] > mp[0]) ? fabs(pv[1] - mp[1]) / (pv[0] - mp[0]) : INFINITY;
+		uint32_t node = 0;
+		do {
+			const double *p = &pts[node * 2];
+			if (node != visible && p[0] > mp[0] && mesh_in_triangle(mp, hit, pv, p)) {
+				double slope = fabs(p[1] - mp[1]) / (p[0] - mp[0]);
+				if (slope < best) {
+					best = slope;
+					visible = node;
+				}
+			}
+			node = t->next[node];
+		} while (node != 0);
+	}
+
+	// visible -> right -> around the hole -> right' -> visible' -> what followed visible
+	uint32_t right_copy = (*count)++, visible_copy = (*count)++;
+	t->polygon[right_copy] = t->polygon[right];
+	t->polygon[visible_copy] = t->polygon[visible];
+	memcpy(&t->points[right_copy * 2], &pts[right * 2], 2 * sizeof(double));
+	memcpy(&t->points[visible_copy * 2], &pts[visible * 2], 2 * sizeof(double));
+	uint32_t after_visible = t->next[visible], before_right = t->prev[right];
+	t->next[visible] = right;
+	t->prev[right] = visible;
+	t->next[before_right] = right_copy;
+	t->prev[right_copy] = before_right;
+	t->next[right_copy] = visible_copy;
+	t->prev[visible_copy] = right_copy;
+	t->next[visible_copy] = after_visible;
+	t->prev[after_visible] = visible_copy;
+	return true;
+}
+
+static bool mesh_triangle_add(mesh_triangles *t, uint32_t a, uint32_t b, uint32_t c) {
+	if (!mesh_grow((void **) &t->indices, &t->index_cap, t->index_count + 3, sizeof(uint32_t))) return false;
+	t->indices[t->index_count++] = t->polygon[a];
+	t->indices[t->index_count++] = t->polygon[b];
+	t->indices[t->index_count++] = t->polygon[c];
+	return true;
+}
+
+static bool mesh_is_ear(const mesh_triangles *t, uint32_t b) {
+	uint32_t a = t->prev[b], c = t->next[b];
+	const double *pa = &t->points[a * 2], *pb = &t->points[b * 2], *pc = &t->points[c * 2];
+	if (mesh_cross(pa, pb, pc) <= 0) return false;
+	for (uint32_t node = t->next[c]; node != a; node = t->next[node]) {
+		const double *p = &t->points[node * 2];
+		// The copies that bridge a hole touch the ear without being in it
+		if (mesh_same_point(p, pa) || mesh_same_point(p, pb) || mesh_same_point(p, pc)) continue;
+		if (mesh_in_triangle(pa, pb, pc, p)) return false;
+	}
+	return true;
+}
+
+bool mesh_face_triangulate(const mesh *m, uint32_t face, mesh_triangles *t) {
+	const mesh_face *f = &m->faces[face];
+	if (!f->loop_count || m->loops[f->loop_start].index_count < 3) return true;
+	uint32_t total = 0;
+	for (uint32_t l = 0; l < f->loop_count; l++) {
+		total += m->loops[f->loop_start + l].index_count + 2;
+	}
+	if (!mesh_triangles_reserve(t, total)) return false;
+
+	// Projected onto the plane of the two other axes than the one the normal is longest along, and
+	// mirrored if need be so that the outer loop runs counter-clockwise
+	double normal[3];
+	mesh_face_normal(m, face, normal);
+	int axis = 2;
+	if (fabs(normal[0]) >= fabs(normal[1]) && fabs(normal[0]) >= fabs(normal[2])) {
+		axis = 0;
+	} else if (fabs(normal[1]) >= fabs(normal[2])) {
+		axis = 1;
+	}
+	double flip = normal[axis] < 0 ? -1.0 : 1.0;
+
+	uint32_t count = 0;
+	mesh_ring_add(t, &count, m, &m->loops[f->loop_start], axis, flip, false);
+	// Holes from right to left, so that no bridge crosses a hole that is still to be bridged. A face
+	// with more than 64 holes keeps the first 64.
+	uint32_t holes[64];
+	double rights[64];
+	uint32_t hole_count = 0;
+	for (uint32_t l = 1; l < f->loop_count && hole_count < sizeof(holes) / sizeof(holes[0]); l++) {
+		const mesh_loop *loop = &m->loops[f->loop_start + l];
+		if (loop->index_count < 3) continue;
+		uint32_t hole = mesh_ring_add(t, &count, m, loop, axis, flip, true);
+		double right = -INFINITY;
+		for (uint32_t i = 0; i < loop->index_count; i++) {
+			right = fmax(right, t->points[(hole + i) * 2]);
+		}
+		uint32_t at = hole_count++;
+		for (; at > 0 && rights[at - 1] < right; at--) {
+			holes[at] = holes[at - 1];
+			rights[at] = rights[at - 1];
+		}
+		holes[at] = hole;
+		rights[at] = right;
+	}
+	for (uint32_t i = 0; i < hole_count; i++) {
+		// A hole the ray finds no way out of is not within the face, and left out
+		mesh_bridge_hole(t, &count, holes[i]);
+	}
+
+	uint32_t remaining = 1;
+	for (uint32_t node = t->next[0]; node != 0; node = t->next[node]) {
+		remaining++;
+	}
+	uint32_t node = 0;
+	while (remaining > 3) {
+		uint32_t tries = remaining;
+		while (tries && !mesh_is_ear(t, node)) {
+			node = t->next[node];
+			tries--;
+		}
+		// Only a degenerate face has no ear left, clip it anyway and skip the triangles without area
+		uint32_t a = t->prev[node], c = t->next[node];
+		if ((tries || mesh_cross(&t->points[a * 2], &t->points[node * 2], &t->points[c * 2]) != 0)
+				&& !mesh_triangle_add(t, a, node, c)) {
+			return false;
+		}
+		t->next[a] = c;
+		t->prev[c] = a;
+		node = c;
+		remaining--;
+	}
+	return mesh_triangle_add(t, t->prev[node], node, t->next[node]);
+}
@@ -0,0 +1,132 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// A flat, versioned mesh format for the models/ assets. A baked .p3dm file is mmapped and used in
+// place: deduplicated vertices, one index buffer for all face loops, the faces, a shared material
+// table and the bounding box. The same layout is built in memory from a .skp when no baked file exists.
+//
+// File layout, little-endian, every section 8 byte aligned:
+//   mesh_header
+//   double vertices[vertex_count][3]
+//   uint32_t indices[index_count]     (padded to 8 bytes)
+//   mesh_loop loops[loop_count]
+//   mesh_face faces[face_count]
+//   mesh_material materials[material_count]
+#define MESH_MAGIC 0x4D443350 // "P3DM"
+#define MESH_VERSION 1
+
+typedef struct mesh_header_s {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vertex_count;
+    uint32_t index_count;
+    uint32_t loop_count;
+    uint32_t face_count;
+    uint32_t material_count;
+    uint32_t reserved;
+    double bbox[6];     // min x, y, z, max x, y, z
+} mesh_header;
+
+typedef struct mesh_loop_s {
+    uint32_t index_start;
+    uint32_t index_count;
+} mesh_loop;
+
+#define MESH_NO_MATERIAL (-1)
+
+typedef struct mesh_face_s {
+    uint32_t loop_start; // The outer loop followed by all the inner loops
+    uint32_t loop_count;
+    int32_t front_material;
+    int32_t back_material;
+} mesh_face;
+
+typedef struct mesh_material_s {
+    uint8_t red;
+    uint8_t green;
+    uint8_t blue;
+    uint8_t alpha;
+} mesh_material;
+
+// A read-only view of a mesh, either into an mmapped file or into a mesh_builder
+typedef struct mesh_s {
+    double bbox[6];
+    const double *vertices;
+    uint32_t vertex_count;
+    const uint32_t *indices;
+    uint32_t index_count;
+    const mesh_loop *loops;
+    uint32_t loop_count;
+    const mesh_face *faces;
+    uint32_t face_count;
+    const mesh_material *materials;
+    uint32_t material_count;
+    void *map;
+    size_t map_size;
+} mesh;
+
+// Returns false if the file is missing, truncated or of another version
+bool mesh_open(mesh *m, const char *file);
+void mesh_close(mesh *m);
+bool mesh_write(const mesh *m, const char *file);
+size_t mesh_bytes(const mesh *m);
+
+typedef struct mesh_builder_s {
+    double bbox[6];
+    double *vertices;
+    uint32_t vertex_count;
+    uint32_t vertex_cap; // In doubles
+    uint32_t *vertex_hash; // Open addressing: index + 1, 0 is empty
+    uint32_t vertex_hash_cap;
+    uint32_t *indices;
+    uint32_t index_count;
+    uint32_t index_cap;
+    mesh_loop *loops;
+    uint32_t loop_count;
+    uint32_t loop_cap;
+    mesh_face *faces;
+    uint32_t face_count;
+    uint32_t face_cap;
+    mesh_material *materials;
+    uint32_t material_count;
+    uint32_t material_cap;
+} mesh_builder;
+
+void mesh_builder_init(mesh_builder *b);
+void mesh_builder_free(mesh_builder *b);
+// Returns the index of the vertex, equal positions share one vertex
+bool mesh_builder_vertex(mesh_builder *b, const double position[3], uint32_t *index);
+// Equal colors share one material
+bool mesh_builder_material(mesh_builder *b, mesh_material material, int32_t *id);
+// Starts a new face, the loops that follow belong to it
+bool mesh_builder_face(mesh_builder *b, int32_t front_material, int32_t back_material);
+bool mesh_builder_loop(mesh_builder *b, const uint32_t *indices, uint32_t count);
+void mesh_builder_view(const mesh_builder *b, mesh *m);
+
+// Triangles for renderers that take no polygons. The holes of a face are bridged into its outer loop
+// and the result is ear clipped in the plane of the face, keeping the winding of the outer loop.
+typedef struct mesh_triangles_s {
+    uint32_t *indices;  // Into the mesh's vertices, 3 per triangle
+    uint32_t index_count;
+    uint32_t index_cap;
+    // The face being clipped, as vertex indices with their projection onto its plane
+    uint32_t *polygon;
+    double *points;
+    uint32_t *next;
+    uint32_t *prev;
+    uint32_t polygon_cap;
+} mesh_triangles;
+
+// Not normalized, as long as twice the area of the outer loop, which runs counter-clockwise around it
+void mesh_face_normal(const mesh *m, uint32_t face, double normal[3]);
+
+void mesh_triangles_init(mesh_triangles *t);
+void mesh_triangles_free(mesh_triangles *t);
+// Appends the triangles of the face; faces with less than 3 vertices add none
+bool mesh_face_triangulate(const mesh *m, uint32_t face, mesh_triangles *t);
+
+#endif	/* MESH_H */
@@ -0,0 +1,138 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "mesh_skp.h"
+
+#ifdef HAVE_SKETCHUP_API
+
+#include <stdlib.h>
+
+#include <SketchUpAPI/common.h>
+#include <SketchUpAPI/geometry.h>
+#include <SketchUpAPI/model/model.h>
+#include <SketchUpAPI/model/entities.h>
+#include <SketchUpAPI/model/face.h>
+#include <SketchUpAPI/model/loop.h>
+#include <SketchUpAPI/model/material.h>
+#include <SketchUpAPI/model/vertex.h>
+
+typedef struct mesh_skp_scratch_s {
+	SUVertexRef *vertices;
+	uint32_t *indices;
+	size_t cap;
+	SULoopRef *loops;
+	size_t loops_cap;
+} mesh_skp_scratch;
+
+// Heap buffers that only grow, so that big assets can't overflow the stack
+static bool mesh_skp_reserve(mesh_skp_scratch *s, size_t count) {
+	if (count <= s->cap) return true;
+	size_t cap = s->cap ? s->cap : 64;
+	while (cap < count) cap *= 2;
+	SUVertexRef *vertices = (SUVertexRef *)realloc(s->vertices, cap * sizeof(SUVertexRef));
+	if (!vertices) return false;
+	s->vertices = vertices;
+	uint32_t *indices = (uint32_t *)realloc(s->indices, cap * sizeof(uint32_t));
+	if (!indices) return false;
+	s->indices = indices;
+	s->cap = cap;
+	return true;
+}
+
+static bool mesh_skp_loop(mesh_builder *b, mesh_skp_scratch *s, size_t count) {
+	for (size_t i = 0; i < count; i++) {
+		struct SUPoint3D point;
+		if (SUVertexGetPosition(s->vertices[i], &point) != SU_ERROR_NONE) return false;
+		const double position[3] = {point.x, point.y, point.z};
+		if (!mesh_builder_vertex(b, position, &s->indices[i])) return false;
+	}
+	return mesh_builder_loop(b, s->indices, (uint32_t) count);
+}
+
+static int32_t mesh_skp_material(mesh_builder *b, SUMaterialRef material) {
+	SUColor color;
+	if (SUIsInvalid(material) || SUMaterialGetColor(material, &color) != SU_ERROR_NONE) {
+		return MESH_NO_MATERIAL;
+	}
+	int32_t id = MESH_NO_MATERIAL;
+	mesh_material m = {color.red, color.green, color.blue, color.alpha};
+	return mesh_builder_material(b, m, &id) ? id : MESH_NO_MATERIAL;
+}
+
+static bool mesh_skp_face(mesh_builder *b, mesh_skp_scratch *s, SUFaceRef face) {
+	size_t vertex_count = 0;
+	if (SUFaceGetNumVertices(face, &vertex_count) != SU_ERROR_NONE) return false;
+	if (vertex_count == 0) return true;
+
+	SUMaterialRef front = SU_INVALID;
+	SUMaterialRef back = SU_INVALID;
+	if (SUFaceGetFrontMaterial(face, &front) != SU_ERROR_NONE) SUSetInvalid(front);
+	if (SUFaceGetBackMaterial(face, &back) != SU_ERROR_NONE) SUSetInvalid(back);
+	if (!mesh_builder_face(b, mesh_skp_material(b, front), mesh_skp_material(b, back))) return false;
+
+	if (!mesh_skp_reserve(s, vertex_count)) return false;
+	if (SUFaceGetVertices(face, vertex_count, s->vertices, &vertex_count) != SU_ERROR_NONE) return false;
+	if (!mesh_skp_loop(b, s, vertex_count)) return false;
+
+	size_t loop_count = 0;
+	if (SUFaceGetNumInnerLoops(face, &loop_count) != SU_ERROR_NONE) return false;
+	if (loop_count == 0) return true;
+	if (loop_count > s->loops_cap) {
+		SULoopRef *loops = (SULoopRef *)realloc(s->loops, loop_count * sizeof(SULoopRef));
+		if (!loops) return false;
+		s->loops = loops;
+		s->loops_cap = loop_count;
+	}
+	if (SUFaceGetInnerLoops(face, loop_count, s->loops, &loop_count) != SU_ERROR_NONE) return false;
+	for (size_t i = 0; i < loop_count; i++) {
+		size_t count = 0;
+		if (SULoopGetNumVertices(s->loops[i], &count) != SU_ERROR_NONE) return false;
+		if (count == 0) continue;
+		if (!mesh_skp_reserve(s, count)) return false;
+		if (SULoopGetVertices(s->loops[i], count, s->vertices, &count) != SU_ERROR_NONE) return false;
+		if (!mesh_skp_loop(b, s, count)) return false;
+	}
+	return true;
+}
+
+static bool mesh_skp_extract(mesh_builder *b, SUEntitiesRef entities) {
+	struct SUBoundingBox3D bbox;
+	if (SUEntitiesGetBoundingBox(entities, &bbox) != SU_ERROR_NONE) return false;
+	b->bbox[0] = bbox.min_point.x;
+	b->bbox[1] = bbox.min_point.y;
+	b->bbox[2] = bbox.min_point.z;
+	b->bbox[3] = bbox.max_point.x;
+	b->bbox[4] = bbox.max_point.y;
+	b->bbox[5] = bbox.max_point.z;
+
+	size_t face_count = 0;
+	if (SUEntitiesGetNumFaces(entities, &face_count) != SU_ERROR_NONE) return false;
+	if (face_count == 0) return true;
+	SUFaceRef *faces = (SUFaceRef *)malloc(face_count * sizeof(SUFaceRef));
+	if (!faces) return false;
+
+	mesh_skp_scratch scratch = {0};
+	bool ok = SUEntitiesGetFaces(entities, face_count, faces, &face_count) == SU_ERROR_NONE;
+	for (size_t i = 0; ok && i < face_count; i++) {
+		ok = mesh_skp_face(b, &scratch, faces[i]);
+	}
+	free(scratch.vertices);
+	free(scratch.indices);
+	free(scratch.loops);
+	free(faces);
+	return ok;
+}
+
+bool mesh_skp_load(mesh_builder *b, const char *file) {
+	SUModelRef model = SU_INVALID;
+	enum SUModelLoadStatus status;
+	if (SUModelCreateFromFileWithStatus(&model, file, &status) != SU_ERROR_NONE) return false;
+
+	SUEntitiesRef entities = SU_INVALID;
+	bool ok = SUModelGetEntities(model, &entities) == SU_ERROR_NONE && mesh_skp_extract(b, entities);
+	SUModelRelease(&model);
+	return ok;
+}
+
+#endif	/* HAVE_SKETCHUP_API */
@@ -0,0 +1,10 @@
+#ifndef MESH_SKP_H
+#define MESH_SKP_H
+
+#include "mesh.h"
+
+// Flattens the faces of a .skp file into a mesh, used by the SketchUp backend when an asset has
+// not been baked and by tools/bake.c. Only the colors of the materials are kept.
+bool mesh_skp_load(mesh_builder *b, const char *file);
+
+#endif	/* MESH_SKP_H */
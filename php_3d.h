@@ -15,6 +15,40 @@ ZEND_TSRMLS_CACHE_EXTERN()
 
 ZEND_BEGIN_MODULE_GLOBALS(php_3d)
 	int generate_model;
+	bool autostart;
+	char *backend;
+	zend_long writer_queue_depth;
+	char *writer_queue_policy;
+	zend_long sample_rate;
+	char *trigger;
+	char *trigger_value;
+	zend_long max_per_second;
+	char *include;
+	char *exclude;
+	zend_long min_depth;
+	bool delta_snapshots;
+	bool heatmap;
+	zend_long max_floors;
+	bool deep_capture;
+	zend_long capture_max_elements;
+	zend_long capture_max_depth;
+	zend_long capture_max_keys;
+	zend_long capture_max_bytes;
+	char *mode;
+	zend_long sample_hz;
+	char *output;
+	zend_long trace_compression;
+	char *output_file;
+	zend_long flush_events;
+	zend_long flush_seconds;
+	zend_long flush_mb;
+	zend_long aggregate_functions;
+	zend_long aggregate_dump_seconds;
+	zend_long merge_window_ms;
+	bool call_graph;
+	bool capturing;
+	bool recording;
+	zend_string *label;
 ZEND_END_MODULE_GLOBALS(php_3d)
 
 #ifdef ZTS
@@ -0,0 +1,13 @@
+<?php
+
+/** @generate-class-entries */
+
+function php_3d_start(?string $label = null): bool {}
+
+function php_3d_stop(): bool {}
+
+function php_3d_is_recording(): bool {}
+
+function php_3d_aggregate_dump(): bool {}
+
+function php_3d_stats(): array {}
@@ -0,0 +1,33 @@
+/* This is a generated file, edit the .stub.php file instead.
+ * Stub hash: f135bc557e302cff79b53c8e39f15c6cdcc4a137 */
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_php_3d_start, 0, 0, _IS_BOOL, 0)
+	ZEND_ARG_TYPE_INFO_WITH_DEFAULT_VALUE(0, label, IS_STRING, 1, "null")
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_php_3d_stop, 0, 0, _IS_BOOL, 0)
+ZEND_END_ARG_INFO()
+
+#define arginfo_php_3d_is_recording arginfo_php_3d_stop
+
+#define arginfo_php_3d_aggregate_dump arginfo_php_3d_stop
+
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_php_3d_stats, 0, 0, IS_ARRAY, 0)
+ZEND_END_ARG_INFO()
+
+
+ZEND_FUNCTION(php_3d_start);
+ZEND_FUNCTION(php_3d_stop);
+ZEND_FUNCTION(php_3d_is_recording);
+ZEND_FUNCTION(php_3d_aggregate_dump);
+ZEND_FUNCTION(php_3d_stats);
+
+
+static const zend_function_entry ext_functions[] = {
+	ZEND_FE(php_3d_start, arginfo_php_3d_start)
+	ZEND_FE(php_3d_stop, arginfo_php_3d_stop)
+	ZEND_FE(php_3d_is_recording, arginfo_php_3d_is_recording)
+	ZEND_FE(php_3d_aggregate_dump, arginfo_php_3d_aggregate_dump)
+	ZEND_FE(php_3d_stats, arginfo_php_3d_stats)
+	ZEND_FE_END
+};
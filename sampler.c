@@ -0,0 +1,119 @@
+#include "sampler.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct sampler_s {
+	pid_t pid;
+	bool running;
+	bool stopping;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t armed_cond;
+	struct timespec period;
+	// Only called with the lock held, which is what makes sampler_disarm() safe
+	sampler_tick_func tick;
+	void *arg;
+	sampler_stats stats;
+} sampler;
+
+static sampler sampler_instance;
+
+static void *sampler_main(void *arg) {
+	sampler *s = (sampler *)arg;
+	pthread_mutex_lock(&s->lock);
+	while (!s->stopping) {
+		if (!s->tick) {
+			pthread_cond_wait(&s->armed_cond, &s->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&s->lock);
+		nanosleep(&s->period, NULL);
+		pthread_mutex_lock(&s->lock);
+		if (s->tick) {
+			s->tick(s->arg);
+			s->stats.ticks++;
+		}
+	}
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+void sampler_startup(unsigned int hz) {
+	sampler *s = &sampler_instance;
+	memset(s, 0, sizeof(sampler));
+	if (hz == 0) hz = 1;
+	if (hz > 10000) hz = 10000;
+	uint64_t ns = 1000000000ULL / hz;
+	s->period.tv_sec = (time_t) (ns / 1000000000ULL);
+	s->period.tv_nsec = (long) (ns % 1000000000ULL);
+}
+
+static bool sampler_start(sampler *s) {
+	// Whatever was inherited through fork() belongs to the parent
+	s->pid = getpid();
+	s->running = false;
+	s->stopping = false;
+	s->tick = NULL;
+	s->arg = NULL;
+	s->stats = (sampler_stats) {0};
+
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->armed_cond, NULL);
+	if (pthread_create(&s->thread, NULL, sampler_main, s) != 0) {
+		return false;
+	}
+	s->running = true;
+	return true;
+}
+
+void sampler_shutdown(void) {
+	sampler *s = &sampler_instance;
+	if (s->running && s->pid == getpid()) {
+		pthread_mutex_lock(&s->lock);
+		s->stopping = true;
+		s->tick = NULL;
+		pthread_cond_signal(&s->armed_cond);
+		pthread_mutex_unlock(&s->lock);
+		pthread_join(s->thread, NULL);
+		pthread_cond_destroy(&s->armed_cond);
+		pthread_mutex_destroy(&s->lock);
+	}
+	s->running = false;
+}
+
+bool sampler_arm(sampler_tick_func tick, void *arg) {
+	sampler *s = &sampler_instance;
+	if ((!s->running || s->pid != getpid()) && !sampler_start(s)) {
+		return false;
+	}
+	pthread_mutex_lock(&s->lock);
+	s->tick = tick;
+	s->arg = arg;
+	pthread_cond_signal(&s->armed_cond);
+	pthread_mutex_unlock(&s->lock);
+	return true;
+}
+
+void sampler_disarm(void) {
+	sampler *s = &sampler_instance;
+	if (!s->running || s->pid != getpid()) return;
+	pthread_mutex_lock(&s->lock);
+	s->tick = NULL;
+	s->arg = NULL;
+	pthread_mutex_unlock(&s->lock);
+}
+
+void sampler_stats_get(sampler_stats *stats) {
+	sampler *s = &sampler_instance;
+	if (!s->running || s->pid != getpid()) {
+		*stats = (sampler_stats) {0};
+		return;
+	}
+	pthread_mutex_lock(&s->lock);
+	*stats = s->stats;
+	pthread_mutex_unlock(&s->lock);
+}
@@ -0,0 +1,27 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+// A background thread that calls a tick function at a fixed rate while it is armed. The tick must
+// be cheap and async-safe towards the armed thread, e.g. only raise a flag that the VM checks at
+// its next safe point. The sampling overhead is therefore set by the rate, not by the call volume.
+typedef void (*sampler_tick_func)(void *arg);
+
+typedef struct sampler_stats_s {
+    size_t ticks;
+} sampler_stats;
+
+void sampler_startup(unsigned int hz);
+// Joins the sampler thread
+void sampler_shutdown(void);
+
+// Like the writer the thread is started lazily, so that it belongs to the process serving requests
+bool sampler_arm(sampler_tick_func tick, void *arg);
+// No tick is running or will run once this returns
+void sampler_disarm(void);
+
+void sampler_stats_get(sampler_stats *stats);
+
+#endif	/* SAMPLER_H */
@@ -1,9 +1,21 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
 #include "sketchup.h"
 
+#ifdef HAVE_SKETCHUP_API
+
+#include "arena.h"
+#include "layout.h"
+#include "mesh.h"
+#include "mesh_skp.h"
+
 #include <assert.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include <SketchUpAPI/common.h>
@@ -34,165 +46,234 @@
 	} \
 }
 
-static bool sup_copy_geometry(SUEntitiesRef dest, SUEntitiesRef src) {
-	SUGeometryInputRef geom_input = SU_INVALID;
-	// TODO Free this when anything fails below
-	SU_CALL_RETURN(SUGeometryInputCreate(&geom_input));
+// For the objects that were created but not handed to the model yet, which owns them from then on
+#define SU_CALL_RELEASE(func, release, ref) { \
+	if ((func) != SU_ERROR_NONE) { \
+		release(&ref); \
+		return false; \
+	} \
+}
 
-	size_t vertices_count = 0;
-	size_t face_count = 0;
-	SU_CALL_RETURN(SUEntitiesGetNumFaces(src, &face_count));
-	//printf("Found %zu source faces\n", face_count);
-	if (face_count > 0) {
-		SUFaceRef faces[face_count];
-		SU_CALL_RETURN(SUEntitiesGetFaces(src, face_count, &faces[0], &face_count));
-		// We cannot simply do the following here:
-		// SUEntitiesAddFaces(dest_entities, face_count, &faces[0]);
-		// This will share memory between models and when the first model is freed, it will cause a crash when the second model is freed
-		// Therefore we must maticulously copy every property one by one.
-		for (size_t i = 0; i < face_count; i++) {
-			size_t vertex_count = 0;
-			SU_CALL_RETURN(SUFaceGetNumVertices(faces[i], &vertex_count));
-			//printf("\tCopying %zu source face #%zu vertices...", vertex_count, i);
-			if (vertex_count > 0) {
-				SUVertexRef vertices[vertex_count];
-				SU_CALL_RETURN(SUFaceGetVertices(faces[i], vertex_count, vertices, &vertex_count));
-
-				SULoopInputRef loop = SU_INVALID;
-				// TODO Free this if anything fails below
-				SU_CALL_RETURN(SULoopInputCreate(&loop));
-				for (size_t j = 0; j < vertex_count; ++j) {
-					struct SUPoint3D pos = {0.0};
-					SU_CALL_RETURN(SUVertexGetPosition(vertices[j], &pos));
-					// This seems to auto increment zero-based indexes
-					SU_CALL_RETURN(SUGeometryInputAddVertex(geom_input, &pos));
-					// Indexes are global to geom_input so we cannot use j for index
-					SU_CALL_RETURN(SULoopInputAddVertexIndex(loop, vertices_count++));
-					//printf("#%zu, ", vertices_count - 1);
-				}
-				//printf("\n");
-
-				size_t face_index = 0;
-				SU_CALL_RETURN(SUGeometryInputAddFace(geom_input, &loop, &face_index));
-				//printf("\t\tCopied face #%zu to index #%zu\n", i, face_index);
-
-				// Copy inner loops
-				size_t inner_loops_count = 0;
-				SU_CALL_RETURN(SUFaceGetNumInnerLoops(faces[i], &inner_loops_count));
-				if (inner_loops_count > 0) {
-					//printf("\t\tSource face #%zu has %zu inner loops.\n", i, inner_loops_count);
-					SULoopRef inner_loops[inner_loops_count];
-					SU_CALL_RETURN(SUFaceGetInnerLoops(faces[i], inner_loops_count, inner_loops, &inner_loops_count));
-					for (size_t y = 0; y < inner_loops_count; ++y) {
-						size_t loop_vertex_count = 0;
-						SU_CALL_RETURN(SULoopGetNumVertices(inner_loops[y], &loop_vertex_count));
-						if (loop_vertex_count > 0) {
-							//printf("\t\t\tInner loop #%zu has %zu vertices.\n", y, loop_vertex_count);
-							SULoopInputRef inner_loop = SU_INVALID;
-							// TODO Free this if anything fails below
-							SU_CALL_RETURN(SULoopInputCreate(&inner_loop));
-							SUVertexRef inner_loop_vertices[loop_vertex_count];
-							SU_CALL_RETURN(SULoopGetVertices(inner_loops[y], loop_vertex_count, inner_loop_vertices, &loop_vertex_count));
-							for (size_t x = 0; x < loop_vertex_count; ++x) {
-								struct SUPoint3D pos = {0.0};
-								SU_CALL_RETURN(SUVertexGetPosition(inner_loop_vertices[x], &pos));
-								// This seems to auto increment zero-based indexes
-								SU_CALL_RETURN(SUGeometryInputAddVertex(geom_input, &pos));
-								// Indexes are global to geom_input so we cannot use x for index
-								SU_CALL_RETURN(SULoopInputAddVertexIndex(inner_loop, vertices_count++));
-								//printf("\t\t\tCopied inner vertex #%zu at {%f, %f, %f} to index #%zu\n", x, pos.x, pos.y, pos.z, vertices_count - 1);
-							}
-							SU_CALL_RETURN(SUGeometryInputFaceAddInnerLoop(geom_input, face_index, &inner_loop));
-						}
-					}
-				}
+// Assets are loaded from disk once per process and kept around as flat meshes. A baked .p3dm next to
+// the .skp (see tools/bake.c) is mmapped and used in place, otherwise the .skp is flattened into the
+// same layout. Every request's town then only has to refill its component definitions from memory.
+typedef struct sup_asset_s {
+	const char *file;
+	bool loaded;
+	struct SUBoundingBox3D bbox;
+	mesh mesh;
+	// Owns the mesh when it was flattened from the .skp rather than mmapped
+	mesh_builder builder;
+} sup_asset;
+
+enum sup_asset_id {
+	SUP_ASSET_TOWN_CENTER = 0,
+	SUP_ASSET_ROOM,
+	SUP_ASSET_HOUSE,
+	SUP_ASSET_VAR,
+	SUP_ASSET_VAR_NULL,
+	SUP_ASSET_VAR_FALSE,
+	SUP_ASSET_VAR_TRUE,
+	SUP_ASSET_VAR_LONG,
+	SUP_ASSET_VAR_DOUBLE,
+	SUP_ASSET_VAR_STRING,
+	SUP_ASSET_VAR_ARRAY,
+	SUP_ASSET_VAR_OBJECT,
+	SUP_ASSET_VAR_RESOURCE,
+	SUP_ASSET_VAR_REFERENCE,
+	SUP_ASSET_COUNT,
+};
+
+static sup_asset sup_assets[SUP_ASSET_COUNT] = {
+	[SUP_ASSET_TOWN_CENTER] = {.file = "models/town_center.skp"},
+	[SUP_ASSET_ROOM] = {.file = "models/room.skp"},
+	[SUP_ASSET_HOUSE] = {.file = "models/house.skp"},
+	[SUP_ASSET_VAR] = {.file = "models/var.skp"},
+	[SUP_ASSET_VAR_NULL] = {.file = "models/var_null.skp"},
+	[SUP_ASSET_VAR_FALSE] = {.file = "models/var_false.skp"},
+	[SUP_ASSET_VAR_TRUE] = {.file = "models/var_true.skp"},
+	[SUP_ASSET_VAR_LONG] = {.file = "models/var_long.skp"},
+	[SUP_ASSET_VAR_DOUBLE] = {.file = "models/var_double.skp"},
+	[SUP_ASSET_VAR_STRING] = {.file = "models/var_string.skp"},
+	[SUP_ASSET_VAR_ARRAY] = {.file = "models/var_array.skp"},
+	[SUP_ASSET_VAR_OBJECT] = {.file = "models/var_object.skp"},
+	[SUP_ASSET_VAR_RESOURCE] = {.file = "models/var_resource.skp"},
+	[SUP_ASSET_VAR_REFERENCE] = {.file = "models/var_reference.skp"},
+};
+
+static sketchup_cache_stats sup_cache_stats;
+
+static void sup_asset_free(sup_asset *asset) {
+	if (asset->mesh.map) {
+		mesh_close(&asset->mesh);
+	}
+	mesh_builder_free(&asset->builder);
+	*asset = (sup_asset) {.file = asset->file};
+}
 
-				// Copy front and back materials
-				//printf("\t\tCopying materials to face at index #%zu\n", face_index);
-				struct SUMaterialInput material_input = {0};
-				SUMaterialRef material = SU_INVALID;
-				enum SUResult res = SUFaceGetFrontMaterial(faces[i], &material);
-				if (res == SU_ERROR_NO_DATA || res == SU_ERROR_NULL_POINTER_OUTPUT) {
-					SUMaterialRef default_front_material = SU_INVALID;
-					SU_CALL_RETURN(SUMaterialCreate(&default_front_material));
-					SUColor default_front_color = {0};
-					SU_CALL_RETURN(SUColorSetByValue(&default_front_color, 0xffffff));
-					SU_CALL_RETURN(SUMaterialSetColor(default_front_material, &default_front_color));
-					material_input.material = default_front_material;
-					SU_CALL_RETURN(SUGeometryInputFaceSetFrontMaterial(geom_input, face_index, &material_input));
-				} else {
-					assert(res == SU_ERROR_NONE);
-					// TODO Copy other material attributes
-					material_input.material = material;
-					// See also SUGeometryInputFaceSetFrontMaterialByPosition
-					SU_CALL_RETURN(SUGeometryInputFaceSetFrontMaterial(geom_input, face_index, &material_input));
-				}
-				res = SUFaceGetBackMaterial(faces[i], &material);
-				if (res == SU_ERROR_NO_DATA || res == SU_ERROR_NULL_POINTER_OUTPUT) {
-					// TODO Default the material?
-				} else {
-					assert(res == SU_ERROR_NONE);
-					// TODO Copy other material attributes
-					material_input.material = material;
-					// See also SUGeometryInputFaceSetBackMaterialByPosition
-					SU_CALL_RETURN(SUGeometryInputFaceSetBackMaterial(geom_input, face_index, &material_input));
-				}
-			}
+static bool sup_asset_load(sup_asset *asset) {
+	char baked[256];
+	size_t len = strlen(asset->file);
+	bool has_baked = len > 4 && len - 4 + sizeof(".p3dm") <= sizeof(baked);
+	if (has_baked) {
+		snprintf(baked, sizeof(baked), "%.*s.p3dm", (int) (len - 4), asset->file);
+	}
+	if (!has_baked || !mesh_open(&asset->mesh, baked)) {
+		mesh_builder_init(&asset->builder);
+		if (!mesh_skp_load(&asset->builder, asset->file)) {
+			sup_asset_free(asset);
+			return false;
 		}
+		mesh_builder_view(&asset->builder, &asset->mesh);
 	}
 
-	enum SUResult res = SUEntitiesFill(dest, geom_input, true);
-	SUGeometryInputRelease(&geom_input);
+	const double *bbox = asset->mesh.bbox;
+	asset->bbox = (struct SUBoundingBox3D) {{bbox[0], bbox[1], bbox[2]}, {bbox[3], bbox[4], bbox[5]}};
+	asset->loaded = true;
+	sup_cache_stats.assets++;
+	sup_cache_stats.bytes += sizeof(sup_asset) + mesh_bytes(&asset->mesh);
+	return true;
+}
 
-	if (res != SU_ERROR_NONE) {
-		//printf("Failed to fill dest geometry\n");
-		return false;
+static sup_asset *sup_asset_get(enum sup_asset_id id) {
+	sup_asset *asset = &sup_assets[id];
+	if (asset->loaded) {
+		sup_cache_stats.hits++;
+		return asset;
 	}
-	//printf("Successfully filled dest geometry\n");
-	return true;
+	sup_cache_stats.misses++;
+	return sup_asset_load(asset) ? asset : NULL;
 }
 
-static bool sup_component_def_load(SUModelRef model, const char *file, SUComponentDefinitionRef *def, struct SUBoundingBox3D *bbox) {
-	//printf("Creating component definition from '%s'...\n", file);
-	// Init empty component def, attach to model, and get entities
-	// TODO Free component def if stuff fails below
-	SU_CALL_RETURN(SUComponentDefinitionCreate(def));
-	SUComponentDefinitionRef tmp[] = {*def};
-	if ((SUModelAddComponentDefinitions(model, 1, tmp)) != SU_ERROR_NONE) {
-		SU_CALL_RETURN(SUComponentDefinitionRelease(def));
+// The mesh's vertices are laid out like an array of SUPoint3D
+_Static_assert(sizeof(struct SUPoint3D) == 3 * sizeof(double), "SUPoint3D must be three doubles");
+
+// We cannot simply do SUEntitiesAddFaces() with the faces of a source model here. This will
+// share memory between models and when the first model is freed, it will cause a crash when the
+// second model is freed. Therefore we rebuild every face from the flat mesh: the vertices in one
+// bulk copy, the loops from the index buffer.
+static bool sup_copy_geometry(SUEntitiesRef dest, const mesh *m) {
+	if (m->face_count == 0) return true;
+
+	// One material per entry of the mesh's material table
+	SUMaterialRef *materials = (SUMaterialRef *)calloc(m->material_count ? m->material_count : 1, sizeof(SUMaterialRef));
+	if (!materials) return false;
+	SUGeometryInputRef geom_input = SU_INVALID;
+	if (SUGeometryInputCreate(&geom_input) != SU_ERROR_NONE) {
+		free(materials);
 		return false;
 	}
-	SU_CALL_RETURN(SUComponentDefinitionSetName(*def, file));
+#define SU_CALL_RELEASE_RETURN(func) { \
+	if ((func) != SU_ERROR_NONE) { \
+		SUGeometryInputRelease(&geom_input); \
+		free(materials); \
+		return false; \
+	} \
+}
+	SU_CALL_RELEASE_RETURN(SUGeometryInputSetVertices(geom_input, m->vertex_count, (const struct SUPoint3D *) m->vertices));
+
+	for (size_t i = 0; i < m->face_count; i++) {
+		const mesh_face *face = &m->faces[i];
+		size_t face_index = 0;
+		for (size_t l = 0; l < face->loop_count; l++) {
+			const mesh_loop *mesh_loop = &m->loops[face->loop_start + l];
+			SULoopInputRef loop = SU_INVALID;
+			SU_CALL_RELEASE_RETURN(SULoopInputCreate(&loop));
+			for (size_t v = 0; v < mesh_loop->index_count; v++) {
+				if (SULoopInputAddVertexIndex(loop, m->indices[mesh_loop->index_start + v]) != SU_ERROR_NONE) {
+					SULoopInputRelease(&loop);
+					SUGeometryInputRelease(&geom_input);
+					free(materials);
+					return false;
+				}
+			}
+			// The geometry input takes ownership of the loop
+			if (l == 0) {
+				SU_CALL_RELEASE_RETURN(SUGeometryInputAddFace(geom_input, &loop, &face_index));
+			} else {
+				SU_CALL_RELEASE_RETURN(SUGeometryInputFaceAddInnerLoop(geom_input, face_index, &loop));
+			}
+		}
+
+		// Sides without a material are left alone, so that they take the material of the instance
+		for (int side = 0; side < 2; side++) {
+			int32_t id = side ? face->back_material : face->front_material;
+			if (id == MESH_NO_MATERIAL) continue;
+			size_t slot = (size_t) id;
+			if (SUIsInvalid(materials[slot])) {
+				SUColor color = {m->materials[id].red, m->materials[id].green, m->materials[id].blue, m->materials[id].alpha};
+				SU_CALL_RELEASE_RETURN(SUMaterialCreate(&materials[slot]));
+				SU_CALL_RELEASE_RETURN(SUMaterialSetColor(materials[slot], &color));
+			}
+			struct SUMaterialInput material_input = {0};
+			material_input.material = materials[slot];
+			if (side) {
+				SU_CALL_RELEASE_RETURN(SUGeometryInputFaceSetBackMaterial(geom_input, face_index, &material_input));
+			} else {
+				// See also SUGeometryInputFaceSetFrontMaterialByPosition
+				SU_CALL_RELEASE_RETURN(SUGeometryInputFaceSetFrontMaterial(geom_input, face_index, &material_input));
+			}
+		}
+	}
+#undef SU_CALL_RELEASE_RETURN
+
+	enum SUResult res = SUEntitiesFill(dest, geom_input, true);
+	SUGeometryInputRelease(&geom_input);
+	free(materials);
+	return (res == SU_ERROR_NONE);
+}
 
-	// Load model from file and get source entities
-	SUModelRef src_model = SU_INVALID;
-	enum SUModelLoadStatus status;
-	SU_CALL_RETURN(SUModelCreateFromFileWithStatus(&src_model, file, &status));
-	assert(status != SUModelLoadStatus_Success_MoreRecent && "Update SDK version to load this file.");
-	SUEntitiesRef src_entities = SU_INVALID;
-	SU_CALL_RETURN(SUModelGetEntities(src_model, &src_entities));
+static bool sup_component_def_load(SUModelRef model, enum sup_asset_id id, SUComponentDefinitionRef *def, struct SUBoundingBox3D *bbox) {
+	sup_asset *asset = sup_asset_get(id);
+	if (!asset) return false;
+
+	// Init empty component def, attach to model, and get entities. Once attached, the model releases
+	// the def along with the town, also when filling it fails below.
+	SU_CALL_RETURN(SUComponentDefinitionCreate(def));
+	SU_CALL_RELEASE(SUModelAddComponentDefinitions(model, 1, def), SUComponentDefinitionRelease, *def);
+	SU_CALL_RETURN(SUComponentDefinitionSetName(*def, asset->file));
 
-	// Get the bounding box size
 	if (bbox) {
-		SU_CALL_RETURN(SUEntitiesGetBoundingBox(src_entities, bbox));
+		*bbox = asset->bbox;
 	}
 
 	// Get dest entities from component def
 	SUEntitiesRef dest_entities = SU_INVALID;
 	SU_CALL_RETURN(SUComponentDefinitionGetEntities(*def, &dest_entities));
 
-	// Copy all file entities to component def entities
-	return sup_copy_geometry(dest_entities, src_entities);
+	// Copy all cached asset entities to component def entities
+	return sup_copy_geometry(dest_entities, &asset->mesh);
 }
 
 static bool sup_component_def_create_instance(SUModelRef model, SUComponentDefinitionRef def, SUComponentInstanceRef *instance) {
 	// Create component instance from definition and attach to model entities
-	// TODO Free the instance if anything fails below
 	SU_CALL_RETURN(SUComponentDefinitionCreateInstance(def, instance));
-	// TODO Convert component instace to group? SUGroupFromComponentInstance()
+	// An instance rather than a group, so that all of them share the geometry of the definition
+	SUEntitiesRef entities = SU_INVALID;
+	SU_CALL_RELEASE(SUModelGetEntities(model, &entities), SUComponentInstanceRelease, *instance);
+	SU_CALL_RELEASE(SUEntitiesAddInstance(entities, *instance, NULL), SUComponentInstanceRelease, *instance);
+	return true;
+}
+
+// A variant of a definition in another color: the variant holds one painted instance of the original,
+// so that the geometry is filled once per model
+static bool sup_component_def_paint(SUModelRef model, SUComponentDefinitionRef original, const char *name, SUColor color, SUComponentDefinitionRef *def) {
+	SU_CALL_RETURN(SUComponentDefinitionCreate(def));
+	SU_CALL_RELEASE(SUModelAddComponentDefinitions(model, 1, def), SUComponentDefinitionRelease, *def);
+	SU_CALL_RETURN(SUComponentDefinitionSetName(*def, name));
+
+	SUMaterialRef material = SU_INVALID;
+	SU_CALL_RETURN(SUMaterialCreate(&material));
+	SU_CALL_RELEASE(SUMaterialSetColor(material, &color), SUMaterialRelease, material);
+	SU_CALL_RELEASE(SUMaterialSetName(material, name), SUMaterialRelease, material);
+	SU_CALL_RELEASE(SUModelAddMaterials(model, 1, &material), SUMaterialRelease, material);
+
+	SUComponentInstanceRef instance = SU_INVALID;
+	SU_CALL_RETURN(SUComponentDefinitionCreateInstance(original, &instance));
+	SU_CALL_RELEASE(SUDrawingElementSetMaterial(SUComponentInstanceToDrawingElement(instance), material), SUComponentInstanceRelease, instance);
 	SUEntitiesRef entities = SU_INVALID;
-	SU_CALL_RETURN(SUModelGetEntities(model, &entities));
-	SU_CALL_RETURN(SUEntitiesAddInstance(entities, *instance, NULL));
+	SU_CALL_RELEASE(SUComponentDefinitionGetEntities(*def, &entities), SUComponentInstanceRelease, instance);
+	SU_CALL_RELEASE(SUEntitiesAddInstance(entities, instance, NULL), SUComponentInstanceRelease, instance);
 	return true;
 }
 
@@ -204,8 +285,19 @@ static bool sup_component_instance_move(SUComponentInstanceRef instance, struct
 	return true;
 }
 
-void sketchup_startup(void) { SUInitialize(); }
-void sketchup_shutdown(void) { SUTerminate(); }
+static void sup_startup(void) { SUInitialize(); }
+
+static void sup_shutdown(void) {
+	for (size_t i = 0; i < SUP_ASSET_COUNT; i++) {
+		sup_asset_free(&sup_assets[i]);
+	}
+	sup_cache_stats = (sketchup_cache_stats) {0};
+	SUTerminate();
+}
+
+static void sup_cache_stats_get(sketchup_cache_stats *stats) {
+	*stats = sup_cache_stats;
+}
 
 #define TI(var) ((sup_town_impl *)var.ptr)
 
@@ -214,9 +306,15 @@ void sketchup_shutdown(void) { SUTerminate(); }
 // b) a lack of an intermediate "runtime movie" datatype
 typedef struct sup_first_floor_s {
 	size_t last_visit_index;
-	char name[255];
+	const char *name;
+	bool has_profile;
+	sketchup_room_profile profile;
 } sup_first_floor;
 
+#define HEAT_BUCKETS 10
+
+#define SUP_FLOOR_CHUNK 256
+
 typedef struct sup_town_impl_s {
 	SUModelRef model;
 	SUComponentDefinitionRef town_center_def;
@@ -234,91 +332,100 @@ typedef struct sup_town_impl_s {
 	SUComponentDefinitionRef var_object_def;
 	SUComponentDefinitionRef var_resource_def;
 	SUComponentDefinitionRef var_reference_def;
+	// Created on demand for profiled towns
+	SUComponentDefinitionRef heat_def;
+	SUMaterialRef heat_materials[HEAT_BUCKETS];
+	// Created on demand for towns with a call graph
+	SUComponentDefinitionRef road_def;
+	SUMaterialRef road_material;
 	struct SUBoundingBox3D town_center_bbox;
 	struct SUBoundingBox3D room_bbox;
 	struct SUBoundingBox3D var_bbox;
+	// Sizes of the room and variable components, for the shared layout
+	layout layout;
 	size_t max_room_index;
-	sup_first_floor first_floors[SUP_MAX_ROOMS];
+	// First floors are allocated in chunks as rooms show up, there is no upper bound on the number of rooms
+	sup_first_floor **floor_chunks;
+	size_t floor_chunk_count;
+	// Holds the floors and their names, released in one go with the town
+	arena arena;
 } sup_town_impl;
 
-bool sketchup_town_ctor(sketchup_town *town) {
-	// Create a fresh model that we can load all the component defs into
+static sup_first_floor *sup_first_floor_get(sup_town_impl *ti, size_t room_index, bool create) {
+	size_t chunk = room_index / SUP_FLOOR_CHUNK;
+	if (chunk >= ti->floor_chunk_count) {
+		if (!create) return NULL;
+		size_t count = ti->floor_chunk_count ? ti->floor_chunk_count : 4;
+		while (count <= chunk) count *= 2;
+		sup_first_floor **chunks = (sup_first_floor **)arena_calloc(&ti->arena, count, sizeof(sup_first_floor *));
+		if (!chunks) return NULL;
+		if (ti->floor_chunk_count) {
+			memcpy(chunks, ti->floor_chunks, ti->floor_chunk_count * sizeof(sup_first_floor *));
+		}
+		ti->floor_chunks = chunks;
+		ti->floor_chunk_count = count;
+	}
+	if (!ti->floor_chunks[chunk]) {
+		if (!create) return NULL;
+		ti->floor_chunks[chunk] = (sup_first_floor *)arena_calloc(&ti->arena, SUP_FLOOR_CHUNK, sizeof(sup_first_floor));
+		if (!ti->floor_chunks[chunk]) return NULL;
+	}
+	return &ti->floor_chunks[chunk][room_index % SUP_FLOOR_CHUNK];
+}
+
+static bool sup_town_ctor(sketchup_town *town) {
+	// Create a fresh model that we can load all the component defs into. A definition belongs to its
+	// model and can't be shared with the towns of other requests, only the flat meshes behind them are
 	SUModelRef model = SU_INVALID;
 	enum SUResult res = SUModelCreate(&model);
 	if (res != SU_ERROR_NONE) return false;
 
 	sup_town_impl *ti = (sup_town_impl *)calloc(1, sizeof(sup_town_impl));
+	if (!ti) {
+		SUModelRelease(&model);
+		return false;
+	}
 	ti->model = model;
+	arena_init(&ti->arena, 16 * 1024);
 
 	if (
-		!sup_component_def_load(model, "models/town_center.skp", &ti->town_center_def, &ti->town_center_bbox) ||
-		!sup_component_def_load(model, "models/room.skp", &ti->room_def, &ti->room_bbox) ||
-		!sup_component_def_load(model, "models/house.skp", &ti->house_def, NULL) ||
-		!sup_component_def_load(model, "models/var.skp", &ti->var_def, &ti->var_bbox) ||
-		/* >> */ !sup_component_def_load(model, "models/var.skp", &ti->var_undef_def, NULL) ||
-		!sup_component_def_load(model, "models/var_null.skp", &ti->var_null_def, NULL) ||
-		!sup_component_def_load(model, "models/var_false.skp", &ti->var_false_def, NULL) ||
-		!sup_component_def_load(model, "models/var_true.skp", &ti->var_true_def, NULL) ||
-		!sup_component_def_load(model, "models/var_long.skp", &ti->var_long_def, NULL) ||
-		!sup_component_def_load(model, "models/var_double.skp", &ti->var_double_def, NULL) ||
-		!sup_component_def_load(model, "models/var_string.skp", &ti->var_string_def, NULL) ||
-		!sup_component_def_load(model, "models/var_array.skp", &ti->var_array_def, NULL) ||
-		!sup_component_def_load(model, "models/var_object.skp", &ti->var_object_def, NULL) ||
-		!sup_component_def_load(model, "models/var_resource.skp", &ti->var_resource_def, NULL) ||
-		!sup_component_def_load(model, "models/var_reference.skp", &ti->var_reference_def, NULL)
+		!sup_component_def_load(model, SUP_ASSET_TOWN_CENTER, &ti->town_center_def, &ti->town_center_bbox) ||
+		!sup_component_def_load(model, SUP_ASSET_ROOM, &ti->room_def, &ti->room_bbox) ||
+		!sup_component_def_load(model, SUP_ASSET_HOUSE, &ti->house_def, NULL) ||
+		!sup_component_def_load(model, SUP_ASSET_VAR, &ti->var_def, &ti->var_bbox) ||
+		!sup_component_def_paint(model, ti->var_def, "var_undef", (SUColor) {.red = 230, .green = 230, .blue = 230, .alpha = 255}, &ti->var_undef_def) ||
+		!sup_component_def_load(model, SUP_ASSET_VAR_NULL, &ti->var_null_def, NULL) ||
+		!sup_component_def_load(model, SUP_ASSET_VAR_FALSE, &ti->var_false_def, NULL) ||
+		!sup_component_def_load(model, SUP_ASSET_VAR_TRUE, &ti->var_true_def, NULL) ||
+		!sup_component_def_load(model, SUP_ASSET_VAR_LONG, &ti->var_long_def, NULL) ||
+		!sup_component_def_load(model, SUP_ASSET_VAR_DOUBLE, &ti->var_double_def, NULL) ||
+		!sup_component_def_load(model, SUP_ASSET_VAR_STRING, &ti->var_string_def, NULL) ||
+		!sup_component_def_load(model, SUP_ASSET_VAR_ARRAY, &ti->var_array_def, NULL) ||
+		!sup_component_def_load(model, SUP_ASSET_VAR_OBJECT, &ti->var_object_def, NULL) ||
+		!sup_component_def_load(model, SUP_ASSET_VAR_RESOURCE, &ti->var_resource_def, NULL) ||
+		!sup_component_def_load(model, SUP_ASSET_VAR_REFERENCE, &ti->var_reference_def, NULL)
 	) {
 		SUModelRelease(&model);
 		free(ti);
 		return false;
 	}
+	ti->layout = (layout) {
+		.room = {ti->room_bbox.max_point.x, ti->room_bbox.max_point.y, ti->room_bbox.max_point.z},
+		.var = {ti->var_bbox.max_point.x, ti->var_bbox.max_point.y, ti->var_bbox.max_point.z},
+	};
 
 	town->ptr = ti;
 	return true;
 }
 
-#define BUILDING_PAD 360.0
+#define BUILDING_PAD LAYOUT_BUILDING_PAD
 
 void sketchup_room_location(sup_town_impl *ti, size_t room_index, size_t visit_index, struct SUVector3D *point) {
-	if (room_index == 0) {
-		point->x = 0.0;
-		point->y = 0.0;
-		point->z = 0.0;
-		return;
-	}
-
-	// There's probably a fancy maths thing to calculate this more elegantly, but I'm no math wiz
-	double square = sqrt((double) room_index);
-	size_t size = (size_t) floor(square);
-	int max = (int) floor((size + 1) / 2);
-	int min = max * -1;
-	// TODO rename? What even is this?
-	int start = min;
-	int end = max;
-	// Odd
-	if ((size % 2) == 1) {
-		min++;
-		start = max;
-		end = min;
-	}
-
-	if (round(square) <= size) {
-		// All x are same
-		point->x = (double) start;
-		// This is a special corner so needs special treatment... for some reason
-		if (((size * size) + size) == room_index) {
-			point->y = point->x;
-		} else {
-			point->y = (double) end - (room_index % size);
-		}
-	} else {
-		point->x = (double) end - (room_index % size);
-		// All y are same
-		point->y = (double) start;
-	}
-
-	point->x *= (ti->room_bbox.max_point.x + BUILDING_PAD);
-	point->y *= (ti->room_bbox.max_point.y + BUILDING_PAD);
-	point->z = ti->room_bbox.max_point.z * (double) visit_index;
+	double p[3];
+	layout_room_location(&ti->layout, room_index, visit_index, p);
+	point->x = p[0];
+	point->y = p[1];
+	point->z = p[2];
 }
 
 static bool sup_town_append_room_ex(sup_town_impl *ti, SUComponentDefinitionRef def, const char *name, size_t room_index, size_t visit_index) {
@@ -335,44 +442,49 @@ static bool sup_town_append_room_ex(sup_town_impl *ti, SUComponentDefinitionRef
 	return true;
 }
 
-bool sketchup_town_append_room(sketchup_town town, const char *name, size_t room_index, size_t visit_index) {
-	if (room_index >= SUP_MAX_ROOMS) return false;
+static bool sup_town_append_room(sketchup_town town, const char *name, size_t room_index, size_t visit_index) {
 	sup_town_impl *ti = TI(town);
+	sup_first_floor *floor = sup_first_floor_get(ti, room_index, true);
+	if (!floor) return false;
 	if (room_index > ti->max_room_index) {
 		ti->max_room_index = room_index;
 	}
-	
-	sup_first_floor *floor = &ti->first_floors[room_index];
+
 	floor->last_visit_index = visit_index;
 	// Delay creating the first floor to add cooler models later
 	if (room_index /* town center is special case */ && visit_index == 0) {
-		snprintf(floor->name, 255, "%s", name);
-		return true;
+		floor->name = arena_strndup(&ti->arena, name, strlen(name));
+		return floor->name != NULL;
 	}
 
 	return sup_town_append_room_ex(ti, (room_index ? ti->room_def : ti->town_center_def), name, room_index, visit_index);
 }
 
-bool sketchup_town_dtor(sketchup_town town) {
+static bool sup_town_set_districts(sketchup_town town, const sketchup_district *districts, size_t count) {
+	sup_town_impl *ti = TI(town);
+	layout_district *placed = (layout_district *)arena_calloc(&ti->arena, count, sizeof(layout_district));
+	if (!placed) return false;
+	for (size_t i = 0; i < count; i++) {
+		placed[i].room_base = districts[i].room_base;
+		placed[i].room_count = districts[i].room_count;
+	}
+	layout_districts_place(&ti->layout, placed, count);
+	ti->layout.districts = placed;
+	ti->layout.district_count = count;
+	return true;
+}
+
+static bool sup_town_dtor(sketchup_town town) {
 	sup_town_impl *ti = TI(town);
 	enum SUResult res = SUModelRelease(&ti->model);
+	arena_free(&ti->arena);
 	free(town.ptr);
 	return (res == SU_ERROR_NONE);
 }
 
-#define WALL_DEPTH 6.0
-#define WALL_DEPTH_TC 84.0
-#define ROOM_PAD 24.0
-#define VAR_PAD 12.0
-#define FLOOR_PAD 6.0
-#define FLOOR_PAD_TC 30.0
-
-bool sketchup_room_append_variable(sketchup_town town, size_t room_index, size_t visit_index, size_t var_index, const char *name, sketchup_val val) {
-	sup_town_impl *ti = TI(town);
-	if (room_index >= SUP_MAX_ROOMS) return false;
-
+static SUComponentDefinitionRef sup_var_def(sup_town_impl *ti, enum sketchup_val_type type) {
 	SUComponentDefinitionRef def = SU_INVALID;
-	switch (val.type) {
+	switch (type) {
 		case SKETCHUP_VAL_UNDEF:
 			def = ti->var_undef_def;
 			break;
@@ -410,40 +522,252 @@ bool sketchup_room_append_variable(sketchup_town town, size_t room_index, size_t
 			def = ti->var_def;
 			break;
 	}
+	return def;
+}
+
+#define SHAPE_CHILD_SCALE 0.5
+
+// The first keys or properties of a deeply captured value are stacked on top of it as smaller boxes
+static bool sup_var_stack_children(sup_town_impl *ti, const sketchup_val_shape *shape, struct SUVector3D point) {
+	double z = point.z + ti->var_bbox.max_point.z;
+	for (uint32_t i = 0; i < shape->child_count; i++) {
+		SUComponentInstanceRef child = SU_INVALID;
+		if (!sup_component_def_create_instance(ti->model, sup_var_def(ti, shape->children[i].type), &child)) return false;
+		SU_CALL_RETURN(SUComponentInstanceSetName(child, shape->children[i].key));
+		struct SUTransformation transform = {0.0};
+		// Column-major, uniform scale and the translation in the last column
+		transform.values[0] = transform.values[5] = transform.values[10] = SHAPE_CHILD_SCALE;
+		transform.values[15] = 1.0;
+		transform.values[12] = point.x;
+		transform.values[13] = point.y;
+		transform.values[14] = z;
+		SU_CALL_RETURN(SUComponentInstanceSetTransform(child, &transform));
+		z += ti->var_bbox.max_point.z * SHAPE_CHILD_SCALE;
+	}
+	return true;
+}
+
+static bool sup_room_append_variable(sketchup_town town, size_t room_index, size_t visit_index, size_t var_index, const char *name, sketchup_val val) {
+	sup_town_impl *ti = TI(town);
+	SUComponentDefinitionRef def = sup_var_def(ti, val.type);
 
 	SUComponentInstanceRef var = SU_INVALID;
 	if (!sup_component_def_create_instance(ti->model, def, &var)) return false;
-	SU_CALL_RETURN(SUComponentInstanceSetName(var, name));
+	if (val.shape) {
+		char label[256];
+		snprintf(label, sizeof(label), "%s: %llu elements, ~%llu bytes, depth %u%s%s", name,
+			(unsigned long long) val.shape->count,
+			(unsigned long long) val.shape->bytes,
+			val.shape->depth,
+			(val.shape->flags & SKETCHUP_SHAPE_TRUNCATED) ? ", truncated" : "",
+			(val.shape->flags & SKETCHUP_SHAPE_CYCLE) ? ", cycle" : ""
+		);
+		SU_CALL_RETURN(SUComponentInstanceSetName(var, label));
+	} else {
+		SU_CALL_RETURN(SUComponentInstanceSetName(var, name));
+	}
 
 	// TODO Create a SUTextRef to display name & var data
 
-	// Calculate var location relative to room
-	double wall_depth_y = room_index ? WALL_DEPTH /* Rooms have only one wall on y axis */ : WALL_DEPTH_TC * 2;
-	double room_height = ti->room_bbox.max_point.y - wall_depth_y;
-	double var_height = ti->var_bbox.max_point.y + VAR_PAD;
-	size_t max_per_column = (size_t) (room_height / var_height);
+	double p[3];
+	layout_var_location(&ti->layout, room_index, visit_index, var_index, p);
+	struct SUVector3D point = {p[0], p[1], p[2]};
 
-	struct SUVector3D room_point = {0.0};
-	sketchup_room_location(ti, room_index, visit_index, &room_point);
+	if (!sup_component_instance_move(var, point)) return false;
+	if (val.shape && !sup_var_stack_children(ti, val.shape, point)) return false;
+	return true;
+}
 
-	struct SUVector3D point = {0.0};
-	double var_width = ti->var_bbox.max_point.x + VAR_PAD;
-	double wall_depth_x = room_index ? WALL_DEPTH : WALL_DEPTH_TC;
-	point.x = room_point.x + wall_depth_x + ROOM_PAD + var_width * (double) (var_index / max_per_column);
+static bool sup_room_set_profile(sketchup_town town, size_t room_index, const sketchup_room_profile *profile) {
+	sup_town_impl *ti = TI(town);
+	sup_first_floor *floor = sup_first_floor_get(ti, room_index, true);
+	if (!floor) return false;
+	floor->has_profile = true;
+	floor->profile = *profile;
+	return true;
+}
 
-	double room_top = room_point.y /* South */ + ti->room_bbox.max_point.y;
-	point.y = room_top - wall_depth_x - ROOM_PAD - (var_height * (double) (var_index % max_per_column));
+static const char *sup_val_type_names[SKETCHUP_VAL_TYPE_COUNT] = {
+	"unsupported", "undef", "null", "false", "true", "int", "float", "string", "array", "object", "resource", "reference",
+};
+
+// The summary floor is a regular floor whose variables have the type they had most often
+static bool sup_room_set_summary(sketchup_town town, size_t room_index, const sketchup_room_summary *summary) {
+	char label[256];
+	snprintf(label, sizeof(label), "%llu more visits", (unsigned long long) summary->calls);
+	if (!sup_town_append_room(town, label, room_index, summary->visit_index)) return false;
+
+	for (size_t i = 0; i < summary->var_count; i++) {
+		const sketchup_var_summary *var = &summary->vars[i];
+		sketchup_val val = SKETCHUP_NULL;
+		size_t len = (size_t) snprintf(label, sizeof(label), "%s:", var->name);
+		for (int type = 0; type < SKETCHUP_VAL_TYPE_COUNT; type++) {
+			if (!var->types[type]) continue;
+			if (var->types[type] > var->types[val.type]) {
+				val.type = (enum sketchup_val_type) type;
+			}
+			if (len < sizeof(label)) {
+				len += (size_t) snprintf(label + len, sizeof(label) - len, " %llu %s", (unsigned long long) var->types[type], sup_val_type_names[type]);
+			}
+		}
+		if (var->has_range && len < sizeof(label)) {
+			snprintf(label + len, sizeof(label) - len, ", min %g, max %g", var->min, var->max);
+		}
+		if (!sup_room_append_variable(town, room_index, summary->visit_index, i, label, val)) return false;
+	}
+	return true;
+}
 
-	point.z = room_point.z + (room_index ? FLOOR_PAD : FLOOR_PAD_TC);
+// A unit cube without materials so that the material of each instance shows
+static bool sup_box_def_create(sup_town_impl *ti, const char *name, SUComponentDefinitionRef *def) {
+	SU_CALL_RETURN(SUComponentDefinitionCreate(def));
+	SU_CALL_RELEASE(SUModelAddComponentDefinitions(ti->model, 1, def), SUComponentDefinitionRelease, *def);
+	SU_CALL_RETURN(SUComponentDefinitionSetName(*def, name));
+
+	static const struct SUPoint3D corners[8] = {
+		{0, 0, 0}, {1, 0, 0}, {1, 1, 0}, {0, 1, 0},
+		{0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1},
+	};
+	static const size_t sides[6][4] = {
+		{0, 3, 2, 1}, {4, 5, 6, 7}, {0, 1, 5, 4},
+		{1, 2, 6, 5}, {2, 3, 7, 6}, {3, 0, 4, 7},
+	};
+	SUGeometryInputRef geom_input = SU_INVALID;
+	SU_CALL_RETURN(SUGeometryInputCreate(&geom_input));
+	bool ok = SUGeometryInputSetVertices(geom_input, 8, corners) == SU_ERROR_NONE;
+	for (size_t i = 0; ok && i < 6; i++) {
+		SULoopInputRef loop = SU_INVALID;
+		ok = SULoopInputCreate(&loop) == SU_ERROR_NONE;
+		for (size_t j = 0; ok && j < 4; j++) {
+			ok = SULoopInputAddVertexIndex(loop, sides[i][j]) == SU_ERROR_NONE;
+		}
+		size_t face_index = 0;
+		ok = ok && SUGeometryInputAddFace(geom_input, &loop, &face_index) == SU_ERROR_NONE;
+		if (SUIsValid(loop)) {
+			SULoopInputRelease(&loop);
+		}
+	}
+	SUEntitiesRef entities = SU_INVALID;
+	ok = ok && SUComponentDefinitionGetEntities(*def, &entities) == SU_ERROR_NONE;
+	ok = ok && SUEntitiesFill(entities, geom_input, true) == SU_ERROR_NONE;
+	SUGeometryInputRelease(&geom_input);
+	return ok;
+}
 
-	if (!sup_component_instance_move(var, point)) return false;
+// Cold rooms are blue, hot rooms are red
+static bool sup_heat_material(sup_town_impl *ti, double heat, SUMaterialRef *material) {
+	size_t bucket = (size_t) (heat * (HEAT_BUCKETS - 1) + 0.5);
+	if (bucket >= HEAT_BUCKETS) bucket = HEAT_BUCKETS - 1;
+	if (SUIsInvalid(ti->heat_materials[bucket])) {
+		SUMaterialRef created = SU_INVALID;
+		SU_CALL_RETURN(SUMaterialCreate(&created));
+		SUByte red = (SUByte) (255 * bucket / (HEAT_BUCKETS - 1));
+		SUColor color = {.red = red, .green = 48, .blue = (SUByte) (255 - red), .alpha = 255};
+		SU_CALL_RETURN(SUMaterialSetColor(created, &color));
+		char name[16];
+		snprintf(name, sizeof(name), "heat_%zu", bucket);
+		SU_CALL_RETURN(SUMaterialSetName(created, name));
+		SU_CALL_RETURN(SUModelAddMaterials(ti->model, 1, &created));
+		ti->heat_materials[bucket] = created;
+	}
+	*material = ti->heat_materials[bucket];
+	return true;
+}
+
+#define HEAT_MAX_FLOORS 10.0
+#define HEAT_MIN 0.05
+
+// Profiled rooms get a tower on their top floor, the hotter the room the taller and redder the tower
+static bool sup_create_heat_towers(sup_town_impl *ti) {
+	for (size_t i = 0; i <= ti->max_room_index; i++) {
+		sup_first_floor *floor = sup_first_floor_get(ti, i, false);
+		if (!floor || !floor->has_profile || floor->profile.heat <= 0.0) continue;
+
+		if (SUIsInvalid(ti->heat_def) && !sup_box_def_create(ti, "heat", &ti->heat_def)) return false;
+
+		SUComponentInstanceRef tower = SU_INVALID;
+		if (!sup_component_def_create_instance(ti->model, ti->heat_def, &tower)) return false;
+		char name[128];
+		if (floor->profile.samples) {
+			snprintf(name, sizeof(name), "%.3f ms, %llu samples",
+				(double) floor->profile.exclusive_ns / 1e6,
+				(unsigned long long) floor->profile.samples
+			);
+		} else {
+			snprintf(name, sizeof(name), "%.3f ms, %llu calls, %lld bytes",
+				(double) floor->profile.exclusive_ns / 1e6,
+				(unsigned long long) floor->profile.calls,
+				(long long) floor->profile.memory_bytes
+			);
+		}
+		SU_CALL_RETURN(SUComponentInstanceSetName(tower, name));
+
+		SUMaterialRef material = SU_INVALID;
+		if (!sup_heat_material(ti, floor->profile.heat, &material)) return false;
+		SU_CALL_RETURN(SUDrawingElementSetMaterial(SUComponentInstanceToDrawingElement(tower), material));
+
+		struct SUVector3D point = {0.0};
+		sketchup_room_location(ti, i, floor->last_visit_index + 1, &point);
+		double heat = floor->profile.heat < HEAT_MIN ? HEAT_MIN : floor->profile.heat;
+		struct SUTransformation transform = {0.0};
+		SU_CALL_RETURN(SUTransformationNonUniformScale(&transform,
+			ti->room_bbox.max_point.x,
+			ti->room_bbox.max_point.y,
+			ti->room_bbox.max_point.z * HEAT_MAX_FLOORS * heat
+		));
+		// Column-major, the translation is the last column
+		transform.values[12] = point.x;
+		transform.values[13] = point.y;
+		transform.values[14] = point.z;
+		SU_CALL_RETURN(SUComponentInstanceSetTransform(tower, &transform));
+	}
+	return true;
+}
+
+#define ROAD_MIN_WIDTH 24.0
+#define ROAD_MAX_WIDTH (BUILDING_PAD * 0.75)
+
+// Calls between rooms are dark roads in the streets, the busier the wider
+static bool sup_town_append_road(sketchup_town town, size_t from_room, size_t to_room, const sketchup_road *road) {
+	sup_town_impl *ti = TI(town);
+	if (SUIsInvalid(ti->road_def) && !sup_box_def_create(ti, "road", &ti->road_def)) return false;
+	if (SUIsInvalid(ti->road_material)) {
+		SU_CALL_RETURN(SUMaterialCreate(&ti->road_material));
+		SUColor color = {.red = 77, .green = 77, .blue = 82, .alpha = 255};
+		SU_CALL_RETURN(SUMaterialSetColor(ti->road_material, &color));
+		SU_CALL_RETURN(SUMaterialSetName(ti->road_material, "road"));
+		SU_CALL_RETURN(SUModelAddMaterials(ti->model, 1, &ti->road_material));
+	}
+
+	char name[128];
+	if (road->inclusive_ns) {
+		snprintf(name, sizeof(name), "%llu calls, %.3f ms", (unsigned long long) road->calls, (double) road->inclusive_ns / 1e6);
+	} else {
+		snprintf(name, sizeof(name), "%llu calls", (unsigned long long) road->calls);
+	}
+	double boxes[2][6];
+	size_t count = layout_road_boxes(&ti->layout, from_room, to_room, ROAD_MIN_WIDTH + road->width * (ROAD_MAX_WIDTH - ROAD_MIN_WIDTH), boxes);
+	for (size_t i = 0; i < count; i++) {
+		SUComponentInstanceRef leg = SU_INVALID;
+		if (!sup_component_def_create_instance(ti->model, ti->road_def, &leg)) return false;
+		SU_CALL_RETURN(SUComponentInstanceSetName(leg, name));
+		SU_CALL_RETURN(SUDrawingElementSetMaterial(SUComponentInstanceToDrawingElement(leg), ti->road_material));
+		struct SUTransformation transform = {0.0};
+		SU_CALL_RETURN(SUTransformationNonUniformScale(&transform, boxes[i][3], boxes[i][4], boxes[i][5]));
+		transform.values[12] = boxes[i][0];
+		transform.values[13] = boxes[i][1];
+		transform.values[14] = boxes[i][2];
+		SU_CALL_RETURN(SUComponentInstanceSetTransform(leg, &transform));
+	}
 	return true;
 }
 
 static bool sup_create_first_floors(sup_town_impl *ti) {
 	for (size_t i = 1 /* town center is 0 */; i <= ti->max_room_index; i++) {
-		sup_first_floor *floor = &ti->first_floors[i];
-		
+		sup_first_floor *floor = sup_first_floor_get(ti, i, false);
+		// Rooms that were never entered
+		if (!floor || !floor->name) continue;
+
 		SUComponentDefinitionRef def = (floor->last_visit_index == 0) ? ti->house_def : ti->room_def;
 		if (!sup_town_append_room_ex(ti, def, floor->name, i, 0)) return false;
 	}
@@ -452,11 +776,12 @@ static bool sup_create_first_floors(sup_town_impl *ti) {
 
 #define HUMAN_HEIGHT_INCHES 72.0
 
-bool sketchup_town_save(sketchup_town town, const char *file) {
+static bool sup_town_save(sketchup_town town, const char *file) {
 	sup_town_impl *ti = TI(town);
 
 	// Create instances for all the first floors
 	sup_create_first_floors(ti);
+	sup_create_heat_towers(ti);
 
 	// Set the scene
 	SUSceneRef scene = SU_INVALID;
@@ -487,9 +812,29 @@ bool sketchup_town_save(sketchup_town town, const char *file) {
 	return (res == SU_ERROR_NONE);
 }
 
-void sketchup_sdk_version(size_t bufsiz, char *version) {
+static void sup_sdk_version(size_t bufsiz, char *version) {
 	size_t major = 0;
 	size_t minor = 0;
 	SUGetAPIVersion(&major, &minor);
 	snprintf(version, bufsiz, "%zu.%zu", major, minor);
 }
+
+const sketchup_backend sketchup_backend_skp = {
+	.name = "sketchup",
+	.extension = "skp",
+	.startup = sup_startup,
+	.shutdown = sup_shutdown,
+	.town_ctor = sup_town_ctor,
+	.town_append_room = sup_town_append_room,
+	.town_save = sup_town_save,
+	.town_dtor = sup_town_dtor,
+	.town_set_districts = sup_town_set_districts,
+	.room_append_variable = sup_room_append_variable,
+	.room_set_profile = sup_room_set_profile,
+	.room_set_summary = sup_room_set_summary,
+	.town_append_road = sup_town_append_road,
+	.version = sup_sdk_version,
+	.cache_stats = sup_cache_stats_get,
+};
+
+#endif	/* HAVE_SKETCHUP_API */
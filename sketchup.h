@@ -2,10 +2,15 @@
 #define SKETCHUP_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+typedef struct sketchup_backend_s sketchup_backend;
+
 typedef struct sketchup_town_s {
     void *ptr;
+    const sketchup_backend *backend;
+    uint64_t ctor_ns;   // When the backend was done constructing it, the rest until the save is appending
 } sketchup_town;
 
 typedef struct sketchup_room_s {
@@ -25,29 +30,165 @@ enum sketchup_val_type {
     SKETCHUP_VAL_OBJECT,
     SKETCHUP_VAL_RESOURCE,
     SKETCHUP_VAL_REFERENCE,
+    SKETCHUP_VAL_TYPE_COUNT,
 };
 
+#define SKETCHUP_SHAPE_TRUNCATED (1 << 0) // A budget ran out, counts past it are extrapolated
+#define SKETCHUP_SHAPE_CYCLE (1 << 1)     // The value contains itself
+
+typedef struct sketchup_val_child_s {
+    const char *key;
+    enum sketchup_val_type type;
+} sketchup_val_child;
+
+// Deep capture of an array or object, within the budgets it was captured with
+typedef struct sketchup_val_shape_s {
+    uint64_t count;     // Elements or properties
+    uint64_t bytes;     // Approximate, including nested values
+    uint32_t depth;     // Levels of nesting that were seen
+    uint32_t flags;
+    uint32_t child_count;
+    const sketchup_val_child *children; // The first few keys or properties
+} sketchup_val_shape;
+
 typedef struct sketchup_val_s {
     enum sketchup_val_type type;
     void *ptr;
+    const sketchup_val_shape *shape; // NULL unless the value was captured deeply
 } sketchup_val;
 
-void sketchup_startup(void);
-void sketchup_shutdown(void);
+// Where a room's time and memory went, aggregated over all of its visits
+typedef struct sketchup_room_profile_s {
+    uint64_t calls;
+    uint64_t samples;   // Only set in sampling mode, where calls are not counted
+    uint64_t inclusive_ns;
+    uint64_t exclusive_ns;
+    int64_t memory_bytes;
+    double heat; // 0..1, exclusive time relative to the hottest room of the town
+} sketchup_room_profile;
+
+// A variable over all the visits that were folded into a summary floor
+typedef struct sketchup_var_summary_s {
+    const char *name;
+    uint64_t types[SKETCHUP_VAL_TYPE_COUNT]; // How often the variable had each type
+    bool has_range;     // Whether it was ever an int or a float
+    double min;
+    double max;
+} sketchup_var_summary;
+
+// The visits of a room past the floor cap, rendered as one floor at visit_index
+typedef struct sketchup_room_summary_s {
+    size_t visit_index;
+    uint64_t calls;
+    size_t var_count;
+    const sketchup_var_summary *vars;
+} sketchup_room_summary;
+
+typedef struct sketchup_cache_stats_s {
+    size_t hits;
+    size_t misses;
+    size_t assets;
+    size_t bytes;
+} sketchup_cache_stats;
+
+// A caller to callee edge of the call graph, rendered as a road between the two rooms
+typedef struct sketchup_road_s {
+    uint64_t calls;
+    uint64_t inclusive_ns;  // Only set when the calls were timed
+    double width;           // 0..1, calls relative to the busiest road of the town
+} sketchup_road;
+
+// A town merged from several traces, e.g. of concurrent threads, gives every trace a district of its
+// own. The rooms of a district are numbered from room_base on.
+typedef struct sketchup_district_s {
+    size_t room_base;
+    size_t room_count;
+} sketchup_district;
+
+// Durations in log2 buckets of microseconds: bucket 0 counts those under 1us, bucket i those under
+// 2^i us, and the last one everything longer
+#define SKETCHUP_HISTOGRAM_BUCKETS 24
 
-// sketchup_startup() must have been called before calling any of the functions below
-bool sketchup_town_ctor(sketchup_town *town);
+typedef struct sketchup_histogram_s {
+    size_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    size_t buckets[SKETCHUP_HISTOGRAM_BUCKETS];
+} sketchup_histogram;
+
+// The lifecycle of a town, as timed by the dispatcher
+enum sketchup_phase {
+    SKETCHUP_PHASE_CTOR = 0,
+    SKETCHUP_PHASE_APPEND,  // From the ctor to the save, i.e. every room, variable, profile and road
+    SKETCHUP_PHASE_SAVE,
+    SKETCHUP_PHASE_DTOR,
+    SKETCHUP_PHASE_COUNT,
+};
+
+typedef struct sketchup_backend_stats_s {
+    size_t towns;
+    size_t rooms;
+    size_t variables;
+    size_t saves;
+    size_t bytes;
+    size_t failures;    // Backend calls that returned false
+    sketchup_histogram phases[SKETCHUP_PHASE_COUNT];
+} sketchup_backend_stats;
+
+// Every town is rendered by a backend; the SketchUp one is only available when the SDK was found at build time
+struct sketchup_backend_s {
+    const char *name;
+    const char *extension; // Of the files it saves
+    void (*startup)(void);
+    void (*shutdown)(void);
+    bool (*town_ctor)(sketchup_town *town);
+    bool (*town_append_room)(sketchup_town town, const char *name, size_t room_index, size_t visit_index);
+    bool (*town_save)(sketchup_town town, const char *file);
+    bool (*town_dtor)(sketchup_town town);
+    // Called before the first room of a merged town is appended
+    bool (*town_set_districts)(sketchup_town town, const sketchup_district *districts, size_t count);
+    bool (*room_append_variable)(sketchup_town town, size_t room_index, size_t visit_index, size_t var_index, const char *name, sketchup_val val);
+    bool (*room_set_profile)(sketchup_town town, size_t room_index, const sketchup_room_profile *profile);
+    bool (*room_set_summary)(sketchup_town town, size_t room_index, const sketchup_room_summary *summary);
+    // Called after the rooms at both ends have been appended
+    bool (*town_append_road)(sketchup_town town, size_t from_room, size_t to_room, const sketchup_road *road);
+    void (*version)(size_t bufsiz, char *version);
+    // Optional, the model assets are loaded lazily on first use and cached for the lifetime of the process
+    void (*cache_stats)(sketchup_cache_stats *stats);
+};
+
+#ifdef HAVE_SKETCHUP_API
+extern const sketchup_backend sketchup_backend_skp;
+# define SKETCHUP_BACKEND_DEFAULT "sketchup"
+#else
+# define SKETCHUP_BACKEND_DEFAULT "null"
+#endif
+// Renders nothing, it only counts the calls and bytes it is handed
+extern const sketchup_backend sketchup_backend_null;
+// Binary glTF with the baked models/*.p3dm meshes, or cubes without them, available everywhere
+extern const sketchup_backend sketchup_backend_gltf;
+
+// Returns NULL for unknown or unavailable backends
+const sketchup_backend *sketchup_backend_find(const char *name);
+void sketchup_backend_stats_get(sketchup_backend_stats *stats);
+// Lock-free, so that the threads of a ZTS build can share a histogram
+void sketchup_histogram_add(sketchup_histogram *histogram, uint64_t ns);
+// Copies a histogram that other threads may be adding to, field by field
+void sketchup_histogram_get(const sketchup_histogram *histogram, sketchup_histogram *copy);
+
+// backend->startup() must have been called before calling any of the functions below
+bool sketchup_town_ctor(sketchup_town *town, const sketchup_backend *backend);
 bool sketchup_town_append_room(sketchup_town town, const char *name, size_t room_index, size_t visit_index);
 bool sketchup_town_save(sketchup_town town, const char *file);
 bool sketchup_town_dtor(sketchup_town town);
+bool sketchup_town_set_districts(sketchup_town town, const sketchup_district *districts, size_t count);
 
 bool sketchup_room_append_variable(sketchup_town town, size_t room_index, size_t visit_index, size_t var_index, const char *name, sketchup_val val);
-
-void sketchup_sdk_version(size_t bufsiz, char *version);
+// Called after all of the room's visits have been appended
+bool sketchup_room_set_profile(sketchup_town town, size_t room_index, const sketchup_room_profile *profile);
+bool sketchup_room_set_summary(sketchup_town town, size_t room_index, const sketchup_room_summary *summary);
+bool sketchup_town_append_road(sketchup_town town, size_t from_room, size_t to_room, const sketchup_road *road);
 
 #define SKETCHUP_NULL {0}
 
-// Arbitrary limit - not sure if this is necessary, but seems like we should have some kind of upper bounds limit
-#define SUP_MAX_ROOMS 5000
-
 #endif	/* SKETCHUP_H */
@@ -0,0 +1,134 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "sketchup.h"
+
+#include <string.h>
+
+#include "clock.h"
+
+static const sketchup_backend *sketchup_backends[] = {
+#ifdef HAVE_SKETCHUP_API
+	&sketchup_backend_skp,
+#endif
+	&sketchup_backend_gltf,
+	&sketchup_backend_null,
+};
+
+// Counted for every backend so that the capture cost can be compared with and without rendering.
+// The writer thread counts while requests read, so every field is only touched atomically.
+static sketchup_backend_stats sketchup_stats;
+
+static inline void sketchup_stats_add(size_t *counter, size_t n) {
+	__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+const sketchup_backend *sketchup_backend_find(const char *name) {
+	for (size_t i = 0; i < sizeof(sketchup_backends) / sizeof(sketchup_backends[0]); i++) {
+		if (strcmp(sketchup_backends[i]->name, name) == 0) {
+			return sketchup_backends[i];
+		}
+	}
+	return NULL;
+}
+
+void sketchup_histogram_get(const sketchup_histogram *histogram, sketchup_histogram *copy) {
+	copy->count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+	copy->total_ns = __atomic_load_n(&histogram->total_ns, __ATOMIC_RELAXED);
+	copy->max_ns = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+	for (size_t i = 0; i < SKETCHUP_HISTOGRAM_BUCKETS; i++) {
+		copy->buckets[i] = __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+	}
+}
+
+// Each field is read atomically, the fields together are not a snapshot while the writer is busy
+void sketchup_backend_stats_get(sketchup_backend_stats *stats) {
+	stats->towns = __atomic_load_n(&sketchup_stats.towns, __ATOMIC_RELAXED);
+	stats->rooms = __atomic_load_n(&sketchup_stats.rooms, __ATOMIC_RELAXED);
+	stats->variables = __atomic_load_n(&sketchup_stats.variables, __ATOMIC_RELAXED);
+	stats->saves = __atomic_load_n(&sketchup_stats.saves, __ATOMIC_RELAXED);
+	stats->bytes = __atomic_load_n(&sketchup_stats.bytes, __ATOMIC_RELAXED);
+	stats->failures = __atomic_load_n(&sketchup_stats.failures, __ATOMIC_RELAXED);
+	for (int phase = 0; phase < SKETCHUP_PHASE_COUNT; phase++) {
+		sketchup_histogram_get(&sketchup_stats.phases[phase], &stats->phases[phase]);
+	}
+}
+
+void sketchup_histogram_add(sketchup_histogram *histogram, uint64_t ns) {
+	size_t bucket = 0;
+	for (uint64_t us = ns / 1000; us && bucket < SKETCHUP_HISTOGRAM_BUCKETS - 1; us >>= 1) {
+		bucket++;
+	}
+	__atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&histogram->total_ns, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+	uint64_t max = __atomic_load_n(&histogram->max_ns, __ATOMIC_RELAXED);
+	while (ns > max && !__atomic_compare_exchange_n(&histogram->max_ns, &max, ns, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+// Every backend call goes through here, so failures are counted once for all of them
+static inline bool sketchup_counted(bool ok) {
+	if (!ok) sketchup_stats_add(&sketchup_stats.failures, 1);
+	return ok;
+}
+
+bool sketchup_town_ctor(sketchup_town *town, const sketchup_backend *backend) {
+	uint64_t start_ns = clock_now_ns();
+	town->backend = backend;
+	if (!sketchup_counted(backend->town_ctor(town))) return false;
+	town->ctor_ns = clock_now_ns();
+	sketchup_histogram_add(&sketchup_stats.phases[SKETCHUP_PHASE_CTOR], town->ctor_ns - start_ns);
+	sketchup_stats_add(&sketchup_stats.towns, 1);
+	return true;
+}
+
+bool sketchup_town_append_room(sketchup_town town, const char *name, size_t room_index, size_t visit_index) {
+	sketchup_stats_add(&sketchup_stats.rooms, 1);
+	sketchup_stats_add(&sketchup_stats.bytes, strlen(name) + 2 * sizeof(size_t));
+	return sketchup_counted(town.backend->town_append_room(town, name, room_index, visit_index));
+}
+
+bool sketchup_town_save(sketchup_town town, const char *file) {
+	uint64_t start_ns = clock_now_ns();
+	sketchup_histogram_add(&sketchup_stats.phases[SKETCHUP_PHASE_APPEND], start_ns - town.ctor_ns);
+	sketchup_stats_add(&sketchup_stats.saves, 1);
+	bool ok = sketchup_counted(town.backend->town_save(town, file));
+	sketchup_histogram_add(&sketchup_stats.phases[SKETCHUP_PHASE_SAVE], clock_now_ns() - start_ns);
+	return ok;
+}
+
+bool sketchup_town_dtor(sketchup_town town) {
+	uint64_t start_ns = clock_now_ns();
+	bool ok = sketchup_counted(town.backend->town_dtor(town));
+	sketchup_histogram_add(&sketchup_stats.phases[SKETCHUP_PHASE_DTOR], clock_now_ns() - start_ns);
+	return ok;
+}
+
+bool sketchup_town_set_districts(sketchup_town town, const sketchup_district *districts, size_t count) {
+	return sketchup_counted(town.backend->town_set_districts(town, districts, count));
+}
+
+bool sketchup_room_append_variable(sketchup_town town, size_t room_index, size_t visit_index, size_t var_index, const char *name, sketchup_val val) {
+	sketchup_stats_add(&sketchup_stats.variables, 1);
+	sketchup_stats_add(&sketchup_stats.bytes, strlen(name) + 3 * sizeof(size_t) + sizeof(sketchup_val));
+	if (val.shape) {
+		sketchup_stats_add(&sketchup_stats.bytes, sizeof(sketchup_val_shape) + val.shape->child_count * sizeof(sketchup_val_child));
+	}
+	return sketchup_counted(town.backend->room_append_variable(town, room_index, visit_index, var_index, name, val));
+}
+
+bool sketchup_room_set_profile(sketchup_town town, size_t room_index, const sketchup_room_profile *profile) {
+	sketchup_stats_add(&sketchup_stats.bytes, sizeof(size_t) + sizeof(sketchup_room_profile));
+	return sketchup_counted(town.backend->room_set_profile(town, room_index, profile));
+}
+
+bool sketchup_room_set_summary(sketchup_town town, size_t room_index, const sketchup_room_summary *summary) {
+	sketchup_stats_add(&sketchup_stats.bytes, sizeof(size_t) + sizeof(sketchup_room_summary) + summary->var_count * sizeof(sketchup_var_summary));
+	return sketchup_counted(town.backend->room_set_summary(town, room_index, summary));
+}
+
+bool sketchup_town_append_road(sketchup_town town, size_t from_room, size_t to_room, const sketchup_road *road) {
+	sketchup_stats_add(&sketchup_stats.bytes, 2 * sizeof(size_t) + sizeof(sketchup_road));
+	return sketchup_counted(town.backend->town_append_road(town, from_room, to_room, road));
+}
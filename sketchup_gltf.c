@@ -0,0 +1,694 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "sketchup.h"
+#include "layout.h"
+#include "mesh.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+// Writes the town as binary glTF 2.0 without the SketchUp SDK. Every asset is a mesh that is stored
+// once; rooms and variables are nodes that instance it with their own translation and scale. The nodes
+// are streamed to a temporary file as they are appended, so the memory used is bounded by the assets
+// and the number of rooms, not by the number of visits and variables. The meshes are the baked
+// models/*.p3dm (see tools/bake.c), or unit cubes where there are none.
+
+enum sup_gltf_mesh {
+	SUP_GLTF_TOWN_CENTER = 0,
+	SUP_GLTF_ROOM,
+	// One per enum sketchup_val_type
+	SUP_GLTF_VAR,
+	// One per heat bucket
+	SUP_GLTF_HEAT = SUP_GLTF_VAR + SKETCHUP_VAL_TYPE_COUNT,
+	SUP_GLTF_ROAD = SUP_GLTF_HEAT + 10,
+	SUP_GLTF_MESH_COUNT,
+};
+
+#define SUP_GLTF_HEAT_BUCKETS (SUP_GLTF_ROAD - SUP_GLTF_HEAT)
+
+typedef struct sup_gltf_material_s {
+	const char *name;
+	float color[4];
+} sup_gltf_material;
+
+// Indexed by enum sketchup_val_type
+static const sup_gltf_material sup_gltf_var_materials[SKETCHUP_VAL_TYPE_COUNT] = {
+	{"var", {0.6f, 0.6f, 0.6f, 1.0f}},
+	{"var_undef", {0.9f, 0.9f, 0.9f, 1.0f}},
+	{"var_null", {0.2f, 0.2f, 0.2f, 1.0f}},
+	{"var_false", {0.8f, 0.2f, 0.2f, 1.0f}},
+	{"var_true", {0.2f, 0.8f, 0.2f, 1.0f}},
+	{"var_long", {0.2f, 0.4f, 0.9f, 1.0f}},
+	{"var_double", {0.4f, 0.2f, 0.9f, 1.0f}},
+	{"var_string", {0.9f, 0.7f, 0.1f, 1.0f}},
+	{"var_array", {0.9f, 0.4f, 0.1f, 1.0f}},
+	{"var_object", {0.1f, 0.7f, 0.7f, 1.0f}},
+	{"var_resource", {0.5f, 0.3f, 0.1f, 1.0f}},
+	{"var_reference", {0.9f, 0.3f, 0.7f, 1.0f}},
+};
+
+// Inches, like the SketchUp models
+static const layout sup_gltf_layout = {
+	.room = {288.0, 288.0, 120.0},
+	.var = {24.0, 24.0, 24.0},
+};
+static const double sup_gltf_town_center_size[3] = {480.0, 480.0, 240.0};
+
+#define SHAPE_CHILD_SCALE 0.5
+#define ROAD_MIN_WIDTH 24.0
+#define ROAD_MAX_WIDTH (LAYOUT_BUILDING_PAD * 0.75)
+#define HEAT_MAX_FLOORS 10.0
+#define HEAT_MIN 0.05
+
+typedef struct sup_gltf_town_s {
+	// Instance nodes, each one preceded by a comma
+	FILE *nodes;
+	size_t node_count;
+	// Last visit + 1 per room, where the heat towers go
+	uint32_t *last_visits;
+	size_t room_count;
+	// sup_gltf_layout, plus the districts of a merged town
+	layout layout;
+	layout_district *districts;
+	bool failed;
+} sup_gltf_town;
+
+#define GT(var) ((sup_gltf_town *)var.ptr)
+
+static void sup_gltf_startup(void) {
+}
+
+static void sup_gltf_assets_release(void);
+
+static void sup_gltf_shutdown(void) {
+	sup_gltf_assets_release();
+}
+
+static bool sup_gltf_town_ctor(sketchup_town *town) {
+	sup_gltf_town *gt = (sup_gltf_town *)calloc(1, sizeof(sup_gltf_town));
+	if (!gt) return false;
+	gt->nodes = tmpfile();
+	if (!gt->nodes) {
+		free(gt);
+		return false;
+	}
+	gt->layout = sup_gltf_layout;
+	town->ptr = gt;
+	return true;
+}
+
+static bool sup_gltf_town_dtor(sketchup_town town) {
+	sup_gltf_town *gt = GT(town);
+	fclose(gt->nodes);
+	free(gt->last_visits);
+	free(gt->districts);
+	free(gt);
+	return true;
+}
+
+static bool sup_gltf_town_set_districts(sketchup_town town, const sketchup_district *districts, size_t count) {
+	sup_gltf_town *gt = GT(town);
+	layout_district *placed = (layout_district *)calloc(count, sizeof(layout_district));
+	if (!placed) return false;
+	for (size_t i = 0; i < count; i++) {
+		placed[i].room_base = districts[i].room_base;
+		placed[i].room_count = districts[i].room_count;
+	}
+	layout_districts_place(&gt->layout, placed, count);
+	free(gt->districts);
+	gt->districts = placed;
+	gt->layout.districts = placed;
+	gt->layout.district_count = count;
+	return true;
+}
+
+static void sup_gltf_write_string(FILE *out, const char *str) {
+	fputc('"', out);
+	for (const unsigned char *c = (const unsigned char *) str; *c; c++) {
+		if (*c == '"' || *c == '\\') {
+			fputc('\\', out);
+			fputc(*c, out);
+		} else if (*c < 0x20) {
+			fprintf(out, "\\u%04x", *c);
+		} else {
+			fputc(*c, out);
+		}
+	}
+	fputc('"', out);
+}
+
+static bool sup_gltf_node(sup_gltf_town *gt, const char *name, int mesh, const double translation[3], const double scale[3]) {
+	FILE *out = gt->nodes;
+	fputs(",{\"name\":", out);
+	sup_gltf_write_string(out, name);
+	fprintf(out, ",\"mesh\":%d,\"translation\":[%.9g,%.9g,%.9g],\"scale\":[%.9g,%.9g,%.9g]}", mesh,
+		translation[0], translation[1], translation[2],
+		scale[0], scale[1], scale[2]
+	);
+	if (ferror(out)) {
+		gt->failed = true;
+		return false;
+	}
+	gt->node_count++;
+	return true;
+}
+
+static bool sup_gltf_town_append_room(sketchup_town town, const char *name, size_t room_index, size_t visit_index) {
+	sup_gltf_town *gt = GT(town);
+	if (room_index >= gt->room_count) {
+		size_t count = gt->room_count ? gt->room_count : 64;
+		while (count <= room_index) count *= 2;
+		uint32_t *last_visits = (uint32_t *)realloc(gt->last_visits, count * sizeof(uint32_t));
+		if (!last_visits) return false;
+		memset(last_visits + gt->room_count, 0, (count - gt->room_count) * sizeof(uint32_t));
+		gt->last_visits = last_visits;
+		gt->room_count = count;
+	}
+	if (visit_index + 1 > gt->last_visits[room_index]) {
+		gt->last_visits[room_index] = (uint32_t) visit_index + 1;
+	}
+
+	double point[3];
+	layout_room_location(&gt->layout, room_index, visit_index, point);
+	if (room_index == 0) {
+		return sup_gltf_node(gt, name, SUP_GLTF_TOWN_CENTER, point, sup_gltf_town_center_size);
+	}
+	return sup_gltf_node(gt, name, SUP_GLTF_ROOM, point, sup_gltf_layout.room);
+}
+
+static bool sup_gltf_room_append_variable(sketchup_town town, size_t room_index, size_t visit_index, size_t var_index, const char *name, sketchup_val val) {
+	sup_gltf_town *gt = GT(town);
+	double point[3];
+	layout_var_location(&gt->layout, room_index, visit_index, var_index, point);
+	int type = (val.type < SKETCHUP_VAL_TYPE_COUNT) ? (int) val.type : SKETCHUP_VAL_UNSUPPORTED;
+	if (!val.shape) {
+		return sup_gltf_node(gt, name, SUP_GLTF_VAR + type, point, sup_gltf_layout.var);
+	}
+
+	char label[256];
+	snprintf(label, sizeof(label), "%s: %llu elements, ~%llu bytes, depth %u%s%s", name,
+		(unsigned long long) val.shape->count,
+		(unsigned long long) val.shape->bytes,
+		val.shape->depth,
+		(val.shape->flags & SKETCHUP_SHAPE_TRUNCATED) ? ", truncated" : "",
+		(val.shape->flags & SKETCHUP_SHAPE_CYCLE) ? ", cycle" : ""
+	);
+	if (!sup_gltf_node(gt, label, SUP_GLTF_VAR + type, point, sup_gltf_layout.var)) return false;
+
+	// The first keys or properties are stacked on top as smaller boxes
+	const double scale[3] = {
+		sup_gltf_layout.var[0] * SHAPE_CHILD_SCALE,
+		sup_gltf_layout.var[1] * SHAPE_CHILD_SCALE,
+		sup_gltf_layout.var[2] * SHAPE_CHILD_SCALE,
+	};
+	point[2] += sup_gltf_layout.var[2];
+	for (uint32_t i = 0; i < val.shape->child_count; i++) {
+		const sketchup_val_child *child = &val.shape->children[i];
+		int child_type = (child->type < SKETCHUP_VAL_TYPE_COUNT) ? (int) child->type : SKETCHUP_VAL_UNSUPPORTED;
+		if (!sup_gltf_node(gt, child->key, SUP_GLTF_VAR + child_type, point, scale)) return false;
+		point[2] += scale[2];
+	}
+	return true;
+}
+
+static bool sup_gltf_room_set_profile(sketchup_town town, size_t room_index, const sketchup_room_profile *profile) {
+	sup_gltf_town *gt = GT(town);
+	if (profile->heat <= 0.0 || room_index >= gt->room_count || !gt->last_visits[room_index]) return true;
+
+	char name[128];
+	if (profile->samples) {
+		snprintf(name, sizeof(name), "%.3f ms, %llu samples",
+			(double) profile->exclusive_ns / 1e6,
+			(unsigned long long) profile->samples
+		);
+	} else {
+		snprintf(name, sizeof(name), "%.3f ms, %llu calls, %lld bytes",
+			(double) profile->exclusive_ns / 1e6,
+			(unsigned long long) profile->calls,
+			(long long) profile->memory_bytes
+		);
+	}
+
+	size_t bucket = (size_t) (profile->heat * (SUP_GLTF_HEAT_BUCKETS - 1) + 0.5);
+	if (bucket >= SUP_GLTF_HEAT_BUCKETS) bucket = SUP_GLTF_HEAT_BUCKETS - 1;
+	double heat = profile->heat < HEAT_MIN ? HEAT_MIN : profile->heat;
+	double point[3];
+	// On top of the last floor of the room
+	layout_room_location(&gt->layout, room_index, gt->last_visits[room_index], point);
+	const double scale[3] = {
+		sup_gltf_layout.room[0],
+		sup_gltf_layout.room[1],
+		sup_gltf_layout.room[2] * HEAT_MAX_FLOORS * heat,
+	};
+	return sup_gltf_node(gt, name, SUP_GLTF_HEAT + (int) bucket, point, scale);
+}
+
+static const char *sup_gltf_val_type_names[SKETCHUP_VAL_TYPE_COUNT] = {
+	"unsupported", "undef", "null", "false", "true", "int", "float", "string", "array", "object", "resource", "reference",
+};
+
+static bool sup_gltf_room_set_summary(sketchup_town town, size_t room_index, const sketchup_room_summary *summary) {
+	char label[256];
+	snprintf(label, sizeof(label), "%llu more visits", (unsigned long long) summary->calls);
+	if (!sup_gltf_town_append_room(town, label, room_index, summary->visit_index)) return false;
+
+	for (size_t i = 0; i < summary->var_count; i++) {
+		const sketchup_var_summary *var = &summary->vars[i];
+		sketchup_val val = SKETCHUP_NULL;
+		size_t len = (size_t) snprintf(label, sizeof(label), "%s:", var->name);
+		for (int type = 0; type < SKETCHUP_VAL_TYPE_COUNT; type++) {
+			if (!var->types[type]) continue;
+			if (var->types[type] > var->types[val.type]) {
+				val.type = (enum sketchup_val_type) type;
+			}
+			if (len < sizeof(label)) {
+				len += (size_t) snprintf(label + len, sizeof(label) - len, " %llu %s", (unsigned long long) var->types[type], sup_gltf_val_type_names[type]);
+			}
+		}
+		if (var->has_range && len < sizeof(label)) {
+			snprintf(label + len, sizeof(label) - len, ", min %g, max %g", var->min, var->max);
+		}
+		if (!sup_gltf_room_append_variable(town, room_index, summary->visit_index, i, label, val)) return false;
+	}
+	return true;
+}
+
+static bool sup_gltf_town_append_road(sketchup_town town, size_t from_room, size_t to_room, const sketchup_road *road) {
+	sup_gltf_town *gt = GT(town);
+	char name[128];
+	if (road->inclusive_ns) {
+		snprintf(name, sizeof(name), "%llu calls, %.3f ms", (unsigned long long) road->calls, (double) road->inclusive_ns / 1e6);
+	} else {
+		snprintf(name, sizeof(name), "%llu calls", (unsigned long long) road->calls);
+	}
+	double boxes[2][6];
+	size_t count = layout_road_boxes(&gt->layout, from_room, to_room, ROAD_MIN_WIDTH + road->width * (ROAD_MAX_WIDTH - ROAD_MIN_WIDTH), boxes);
+	for (size_t i = 0; i < count; i++) {
+		if (!sup_gltf_node(gt, name, SUP_GLTF_ROAD, boxes[i], boxes[i] + 3)) return false;
+	}
+	return true;
+}
+
+// A unit cube with its origin in a corner, like the components of the SketchUp models
+#define SUP_GLTF_CUBE_VERTICES 24
+#define SUP_GLTF_CUBE_INDICES 36
+
+typedef struct sup_gltf_cube_s {
+	float positions[SUP_GLTF_CUBE_VERTICES][3];
+	float normals[SUP_GLTF_CUBE_VERTICES][3];
+	uint16_t indices[SUP_GLTF_CUBE_INDICES];
+} sup_gltf_cube;
+
+static void sup_gltf_cube_build(sup_gltf_cube *cube) {
+	// Corners of each side, counter-clockwise seen from outside
+	static const float sides[6][4][3] = {
+		{{0, 0, 0}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}},
+		{{0, 0, 1}, {1, 0, 1}, {1, 1, 1}, {0, 1, 1}},
+		{{0, 0, 0}, {1, 0, 0}, {1, 0, 1}, {0, 0, 1}},
+		{{1, 0, 0}, {1, 1, 0}, {1, 1, 1}, {1, 0, 1}},
+		{{1, 1, 0}, {0, 1, 0}, {0, 1, 1}, {1, 1, 1}},
+		{{0, 1, 0}, {0, 0, 0}, {0, 0, 1}, {0, 1, 1}},
+	};
+	static const float normals[6][3] = {
+		{0, 0, -1}, {0, 0, 1}, {0, -1, 0}, {1, 0, 0}, {0, 1, 0}, {-1, 0, 0},
+	};
+	for (int side = 0; side < 6; side++) {
+		for (int corner = 0; corner < 4; corner++) {
+			memcpy(cube->positions[side * 4 + corner], sides[side][corner], sizeof(float) * 3);
+			memcpy(cube->normals[side * 4 + corner], normals[side], sizeof(float) * 3);
+		}
+		uint16_t base = (uint16_t) (side * 4);
+		uint16_t *idx = &cube->indices[side * 6];
+		idx[0] = base;
+		idx[1] = base + 1;
+		idx[2] = base + 2;
+		idx[3] = base;
+		idx[4] = base + 2;
+		idx[5] = base + 3;
+	}
+}
+
+// The geometry of the baked assets, scaled into the unit cube so that the nodes scale them like the
+// cube. var_undef has no model of its own and shares the one of var, like in the SketchUp backend.
+// Heat towers and roads are always cubes.
+static const char *const sup_gltf_asset_files[SUP_GLTF_HEAT] = {
+	[SUP_GLTF_TOWN_CENTER] = "models/town_center.p3dm",
+	[SUP_GLTF_ROOM] = "models/room.p3dm",
+	[SUP_GLTF_VAR + SKETCHUP_VAL_UNSUPPORTED] = "models/var.p3dm",
+	[SUP_GLTF_VAR + SKETCHUP_VAL_UNDEF] = "models/var.p3dm",
+	[SUP_GLTF_VAR + SKETCHUP_VAL_NULL] = "models/var_null.p3dm",
+	[SUP_GLTF_VAR + SKETCHUP_VAL_FALSE] = "models/var_false.p3dm",
+	[SUP_GLTF_VAR + SKETCHUP_VAL_TRUE] = "models/var_true.p3dm",
+	[SUP_GLTF_VAR + SKETCHUP_VAL_LONG] = "models/var_long.p3dm",
+	[SUP_GLTF_VAR + SKETCHUP_VAL_DOUBLE] = "models/var_double.p3dm",
+	[SUP_GLTF_VAR + SKETCHUP_VAL_STRING] = "models/var_string.p3dm",
+	[SUP_GLTF_VAR + SKETCHUP_VAL_ARRAY] = "models/var_array.p3dm",
+	[SUP_GLTF_VAR + SKETCHUP_VAL_OBJECT] = "models/var_object.p3dm",
+	[SUP_GLTF_VAR + SKETCHUP_VAL_RESOURCE] = "models/var_resource.p3dm",
+	[SUP_GLTF_VAR + SKETCHUP_VAL_REFERENCE] = "models/var_reference.p3dm",
+};
+
+// Where a geometry is in the binary chunk, the cube is geometry 0
+typedef struct sup_gltf_geometry_s {
+	size_t positions;
+	size_t normals;
+	size_t indices;
+	uint32_t vertex_count;
+	uint32_t index_count;
+	bool short_indices;
+	float min[3];
+	float max[3];
+} sup_gltf_geometry;
+
+// Loaded the first time a town is saved and shared by all the towns of the process, like the
+// component definitions of the SketchUp backend
+typedef struct sup_gltf_assets_s {
+	bool loaded;
+	unsigned char *bin;
+	size_t bin_size;
+	size_t bin_cap;
+	sup_gltf_geometry geometries[SUP_GLTF_MESH_COUNT];
+	size_t geometry_count;
+	// Indexed by enum sup_gltf_mesh
+	size_t mesh_geometries[SUP_GLTF_MESH_COUNT];
+} sup_gltf_assets;
+
+static sup_gltf_assets sup_gltf_shared;
+static pthread_mutex_t sup_gltf_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool sup_gltf_bin_append(sup_gltf_assets *assets, const void *data, size_t size) {
+	if (assets->bin_size + size > assets->bin_cap) {
+		size_t cap = assets->bin_cap ? assets->bin_cap : 4096;
+		while (cap < assets->bin_size + size) cap *= 2;
+		unsigned char *bin = (unsigned char *)realloc(assets->bin, cap);
+		if (!bin) return false;
+		assets->bin = bin;
+		assets->bin_cap = cap;
+	}
+	memcpy(assets->bin + assets->bin_size, data, size);
+	assets->bin_size += size;
+	return true;
+}
+
+static bool sup_gltf_geometry_add(sup_gltf_assets *assets, const float *positions, const float *normals, uint32_t vertex_count,
+		const void *indices, uint32_t index_count, bool short_indices) {
+	sup_gltf_geometry *g = &assets->geometries[assets->geometry_count];
+	*g = (sup_gltf_geometry) {
+		.vertex_count = vertex_count,
+		.index_count = index_count,
+		.short_indices = short_indices,
+		.min = {INFINITY, INFINITY, INFINITY},
+		.max = {-INFINITY, -INFINITY, -INFINITY},
+	};
+	for (uint32_t i = 0; i < vertex_count; i++) {
+		for (int axis = 0; axis < 3; axis++) {
+			g->min[axis] = fminf(g->min[axis], positions[i * 3 + axis]);
+			g->max[axis] = fmaxf(g->max[axis], positions[i * 3 + axis]);
+		}
+	}
+	// Every section is a multiple of 4 bytes long, as the accessors need
+	size_t index_bytes = (size_t) index_count * (short_indices ? sizeof(uint16_t) : sizeof(uint32_t));
+	static const unsigned char padding[2] = {0};
+	g->positions = assets->bin_size;
+	g->normals = g->positions + (size_t) vertex_count * 3 * sizeof(float);
+	g->indices = g->normals + (size_t) vertex_count * 3 * sizeof(float);
+	if (!sup_gltf_bin_append(assets, positions, (size_t) vertex_count * 3 * sizeof(float))
+			|| !sup_gltf_bin_append(assets, normals, (size_t) vertex_count * 3 * sizeof(float))
+			|| !sup_gltf_bin_append(assets, indices, index_bytes)
+			|| !sup_gltf_bin_append(assets, padding, index_bytes % 4)) {
+		return false;
+	}
+	assets->geometry_count++;
+	return true;
+}
+
+// Flat shaded: the vertices of a face are shared by its triangles only, with the normal of the face
+static bool sup_gltf_geometry_load(sup_gltf_assets *assets, const mesh *m) {
+	double size[3];
+	for (int axis = 0; axis < 3; axis++) {
+		size[axis] = m->bbox[axis + 3] - m->bbox[axis];
+		if (!(size[axis] > 0.0)) size[axis] = 1.0;
+	}
+	mesh_triangles t;
+	mesh_triangles_init(&t);
+	float *positions = NULL, *normals = NULL;
+	uint32_t *stamps = (uint32_t *)calloc(m->vertex_count ? m->vertex_count : 1, 2 * sizeof(uint32_t));
+	uint32_t vertex_count = 0, vertex_cap = 0;
+	bool ok = stamps != NULL;
+	for (uint32_t face = 0; ok && face < m->face_count; face++) {
+		// The normal of the face once it has been scaled like its vertices
+		double normal[3], length = 0.0;
+		mesh_face_normal(m, face, normal);
+		for (int axis = 0; axis < 3; axis++) {
+			normal[axis] *= size[axis];
+			length += normal[axis] * normal[axis];
+		}
+		length = sqrt(length);
+		if (!(length > 0.0)) continue;
+
+		uint32_t first = t.index_count;
+		ok = mesh_face_triangulate(m, face, &t);
+		for (uint32_t i = first; ok && i < t.index_count; i++) {
+			uint32_t vertex = t.indices[i];
+			if (stamps[vertex * 2] != face + 1) {
+				if (vertex_count == vertex_cap) {
+					vertex_cap = vertex_cap ? vertex_cap * 2 : 256;
+					float *grown_positions = (float *)realloc(positions, (size_t) vertex_cap * 3 * sizeof(float));
+					if (grown_positions) positions = grown_positions;
+					float *grown_normals = (float *)realloc(normals, (size_t) vertex_cap * 3 * sizeof(float));
+					if (grown_normals) normals = grown_normals;
+					if (!grown_positions || !grown_normals) {
+						ok = false;
+						break;
+					}
+				}
+				for (int axis = 0; axis < 3; axis++) {
+					positions[vertex_count * 3 + axis] = (float) ((m->vertices[vertex * 3 + axis] - m->bbox[axis]) / size[axis]);
+					normals[vertex_count * 3 + axis] = (float) (normal[axis] / length);
+				}
+				stamps[vertex * 2] = face + 1;
+				stamps[vertex * 2 + 1] = vertex_count++;
+			}
+			// The triangles are renumbered in place, into the vertices written out
+			t.indices[i] = stamps[vertex * 2 + 1];
+		}
+	}
+	ok = ok && t.index_count && sup_gltf_geometry_add(assets, positions, normals, vertex_count, t.indices, t.index_count, false);
+	free(stamps);
+	free(positions);
+	free(normals);
+	mesh_triangles_free(&t);
+	return ok;
+}
+
+static void sup_gltf_assets_free(sup_gltf_assets *assets) {
+	free(assets->bin);
+	memset(assets, 0, sizeof(sup_gltf_assets));
+}
+
+static bool sup_gltf_assets_load(sup_gltf_assets *assets) {
+	sup_gltf_cube cube;
+	sup_gltf_cube_build(&cube);
+	if (!sup_gltf_geometry_add(assets, &cube.positions[0][0], &cube.normals[0][0], SUP_GLTF_CUBE_VERTICES, cube.indices, SUP_GLTF_CUBE_INDICES, true)) {
+		sup_gltf_assets_free(assets);
+		return false;
+	}
+	for (int i = 0; i < SUP_GLTF_MESH_COUNT; i++) {
+		const char *file = i < SUP_GLTF_HEAT ? sup_gltf_asset_files[i] : NULL;
+		assets->mesh_geometries[i] = 0;
+		if (!file) continue;
+		// Assets that share a file share its geometry
+		int same = 0;
+		while (same < i && (!sup_gltf_asset_files[same] || strcmp(sup_gltf_asset_files[same], file) != 0)) same++;
+		if (same < i) {
+			assets->mesh_geometries[i] = assets->mesh_geometries[same];
+			continue;
+		}
+		mesh m;
+		if (!mesh_open(&m, file)) continue;
+		size_t geometry = assets->geometry_count;
+		if (sup_gltf_geometry_load(assets, &m)) {
+			assets->mesh_geometries[i] = geometry;
+		}
+		mesh_close(&m);
+	}
+	assets->loaded = true;
+	return true;
+}
+
+static const sup_gltf_assets *sup_gltf_assets_get(void) {
+	pthread_mutex_lock(&sup_gltf_shared_lock);
+	bool loaded = sup_gltf_shared.loaded || sup_gltf_assets_load(&sup_gltf_shared);
+	pthread_mutex_unlock(&sup_gltf_shared_lock);
+	return loaded ? &sup_gltf_shared : NULL;
+}
+
+static void sup_gltf_assets_release(void) {
+	pthread_mutex_lock(&sup_gltf_shared_lock);
+	sup_gltf_assets_free(&sup_gltf_shared);
+	pthread_mutex_unlock(&sup_gltf_shared_lock);
+}
+
+static void sup_gltf_write_u32(FILE *out, uint32_t val) {
+	unsigned char buf[4] = {
+		(unsigned char) (val & 0xff),
+		(unsigned char) ((val >> 8) & 0xff),
+		(unsigned char) ((val >> 16) & 0xff),
+		(unsigned char) ((val >> 24) & 0xff),
+	};
+	fwrite(buf, 1, sizeof(buf), out);
+}
+
+static void sup_gltf_write_material(FILE *out, const char *name, const float color[4], bool *first) {
+	fprintf(out, "%s{\"name\":\"%s\",\"pbrMetallicRoughness\":{\"baseColorFactor\":[%.3f,%.3f,%.3f,%.3f],\"metallicFactor\":0}",
+		*first ? "" : ",", name, color[0], color[1], color[2], color[3]
+	);
+	fputs(color[3] < 1.0f ? ",\"alphaMode\":\"BLEND\",\"doubleSided\":true}" : "}", out);
+	*first = false;
+}
+
+static void sup_gltf_write_assets(FILE *out, const sup_gltf_assets *assets) {
+	// Every geometry has three accessors and buffer views: positions, normals and indices
+	fputs("],\"meshes\":[", out);
+	for (int mesh = 0; mesh < SUP_GLTF_MESH_COUNT; mesh++) {
+		size_t accessor = assets->mesh_geometries[mesh] * 3;
+		fprintf(out, "%s{\"primitives\":[{\"attributes\":{\"POSITION\":%zu,\"NORMAL\":%zu},\"indices\":%zu,\"material\":%d}]}",
+			mesh ? "," : "", accessor, accessor + 1, accessor + 2, mesh
+		);
+	}
+
+	// In the order of enum sup_gltf_mesh
+	fputs("],\"materials\":[", out);
+	bool first = true;
+	static const float town_center[4] = {0.85f, 0.8f, 0.7f, 0.35f};
+	static const float room[4] = {0.7f, 0.75f, 0.85f, 0.25f};
+	sup_gltf_write_material(out, "town_center", town_center, &first);
+	sup_gltf_write_material(out, "room", room, &first);
+	for (int type = 0; type < SKETCHUP_VAL_TYPE_COUNT; type++) {
+		sup_gltf_write_material(out, sup_gltf_var_materials[type].name, sup_gltf_var_materials[type].color, &first);
+	}
+	// Cold rooms are blue, hot rooms are red
+	for (int bucket = 0; bucket < SUP_GLTF_HEAT_BUCKETS; bucket++) {
+		char name[16];
+		snprintf(name, sizeof(name), "heat_%d", bucket);
+		float red = (float) bucket / (float) (SUP_GLTF_HEAT_BUCKETS - 1);
+		const float color[4] = {red, 0.19f, 1.0f - red, 1.0f};
+		sup_gltf_write_material(out, name, color, &first);
+	}
+	static const float road[4] = {0.3f, 0.3f, 0.32f, 1.0f};
+	sup_gltf_write_material(out, "road", road, &first);
+
+	fputs("],\"accessors\":[", out);
+	for (size_t i = 0; i < assets->geometry_count; i++) {
+		const sup_gltf_geometry *g = &assets->geometries[i];
+		fprintf(out, "%s{\"bufferView\":%zu,\"componentType\":5126,\"count\":%u,\"type\":\"VEC3\",\"min\":[%.9g,%.9g,%.9g],\"max\":[%.9g,%.9g,%.9g]},"
+			"{\"bufferView\":%zu,\"componentType\":5126,\"count\":%u,\"type\":\"VEC3\"},"
+			"{\"bufferView\":%zu,\"componentType\":%d,\"count\":%u,\"type\":\"SCALAR\"}",
+			i ? "," : "",
+			i * 3, g->vertex_count, g->min[0], g->min[1], g->min[2], g->max[0], g->max[1], g->max[2],
+			i * 3 + 1, g->vertex_count,
+			i * 3 + 2, g->short_indices ? 5123 : 5125, g->index_count
+		);
+	}
+	fputs("],\"bufferViews\":[", out);
+	for (size_t i = 0; i < assets->geometry_count; i++) {
+		const sup_gltf_geometry *g = &assets->geometries[i];
+		size_t vertex_bytes = (size_t) g->vertex_count * 3 * sizeof(float);
+		size_t index_bytes = (size_t) g->index_count * (g->short_indices ? sizeof(uint16_t) : sizeof(uint32_t));
+		fprintf(out, "%s{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu,\"target\":34962},"
+			"{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu,\"target\":34962},"
+			"{\"buffer\":0,\"byteOffset\":%zu,\"byteLength\":%zu,\"target\":34963}",
+			i ? "," : "",
+			g->positions, vertex_bytes,
+			g->normals, vertex_bytes,
+			g->indices, index_bytes
+		);
+	}
+	fprintf(out, "],\"buffers\":[{\"byteLength\":%zu}]}", assets->bin_size);
+}
+
+#define GLB_MAGIC 0x46546C67
+#define GLB_CHUNK_JSON 0x4E4F534A
+#define GLB_CHUNK_BIN 0x004E4942
+
+static bool sup_gltf_town_save(sketchup_town town, const char *file) {
+	sup_gltf_town *gt = GT(town);
+	if (gt->failed || fflush(gt->nodes) != 0) return false;
+
+	const sup_gltf_assets *assets = sup_gltf_assets_get();
+	if (!assets) return false;
+	FILE *out = fopen(file, "wb");
+	if (!out) return false;
+
+	// The header and the JSON chunk length are filled in once everything has been written
+	static const char placeholder[20] = {0};
+	fwrite(placeholder, 1, sizeof(placeholder), out);
+
+	// Inches to meters, and z up to y up
+	fputs("{\"asset\":{\"version\":\"2.0\",\"generator\":\"php_3d\"},\"scene\":0,\"scenes\":[{\"name\":\"PHP\",\"nodes\":[0]}],"
+		"\"nodes\":[{\"name\":\"town\",\"rotation\":[-0.70710678,0,0,0.70710678],\"scale\":[0.0254,0.0254,0.0254]", out);
+	if (gt->node_count) {
+		fputs(",\"children\":[", out);
+		for (size_t i = 1; i <= gt->node_count; i++) {
+			fprintf(out, "%s%zu", i > 1 ? "," : "", i);
+		}
+		fputc(']', out);
+	}
+	fputc('}', out);
+
+	rewind(gt->nodes);
+	char buf[8192];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), gt->nodes)) > 0) {
+		fwrite(buf, 1, len, out);
+	}
+	sup_gltf_write_assets(out, assets);
+
+	// Chunks are 4 byte aligned, JSON with spaces
+	long json_end = ftell(out);
+	while ((json_end - 20) % 4) {
+		fputc(' ', out);
+		json_end++;
+	}
+	sup_gltf_write_u32(out, (uint32_t) assets->bin_size);
+	sup_gltf_write_u32(out, GLB_CHUNK_BIN);
+	fwrite(assets->bin, 1, assets->bin_size, out);
+	long total = ftell(out);
+
+	fseek(out, 0, SEEK_SET);
+	sup_gltf_write_u32(out, GLB_MAGIC);
+	sup_gltf_write_u32(out, 2);
+	sup_gltf_write_u32(out, (uint32_t) total);
+	sup_gltf_write_u32(out, (uint32_t) (json_end - 20));
+	sup_gltf_write_u32(out, GLB_CHUNK_JSON);
+
+	bool ok = !ferror(out) && !ferror(gt->nodes);
+	return (fclose(out) == 0) && ok;
+}
+
+static void sup_gltf_version(size_t bufsiz, char *version) {
+	snprintf(version, bufsiz, "%s", "glTF 2.0");
+}
+
+const sketchup_backend sketchup_backend_gltf = {
+	.name = "gltf",
+	.extension = "glb",
+	.startup = sup_gltf_startup,
+	.shutdown = sup_gltf_shutdown,
+	.town_ctor = sup_gltf_town_ctor,
+	.town_append_room = sup_gltf_town_append_room,
+	.town_save = sup_gltf_town_save,
+	.town_dtor = sup_gltf_town_dtor,
+	.town_set_districts = sup_gltf_town_set_districts,
+	.room_append_variable = sup_gltf_room_append_variable,
+	.room_set_profile = sup_gltf_room_set_profile,
+	.room_set_summary = sup_gltf_room_set_summary,
+	.town_append_road = sup_gltf_town_append_road,
+	.version = sup_gltf_version,
+	.cache_stats = NULL,
+};
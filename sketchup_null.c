@@ -0,0 +1,69 @@
+#include "sketchup.h"
+
+#include <stdio.h>
+
+// The null backend lets the extension run without the SketchUp SDK. Every call succeeds and
+// is only counted by the dispatcher, which makes it a baseline for measuring capture overhead.
+static char sup_null_town;
+
+static void sup_null_startup(void) {}
+static void sup_null_shutdown(void) {}
+
+static bool sup_null_town_ctor(sketchup_town *town) {
+	town->ptr = &sup_null_town;
+	return true;
+}
+
+static bool sup_null_town_append_room(sketchup_town town, const char *name, size_t room_index, size_t visit_index) {
+	return true;
+}
+
+static bool sup_null_town_save(sketchup_town town, const char *file) {
+	return true;
+}
+
+static bool sup_null_town_dtor(sketchup_town town) {
+	return true;
+}
+
+static bool sup_null_town_set_districts(sketchup_town town, const sketchup_district *districts, size_t count) {
+	return true;
+}
+
+static bool sup_null_room_append_variable(sketchup_town town, size_t room_index, size_t visit_index, size_t var_index, const char *name, sketchup_val val) {
+	return true;
+}
+
+static bool sup_null_room_set_profile(sketchup_town town, size_t room_index, const sketchup_room_profile *profile) {
+	return true;
+}
+
+static bool sup_null_room_set_summary(sketchup_town town, size_t room_index, const sketchup_room_summary *summary) {
+	return true;
+}
+
+static bool sup_null_town_append_road(sketchup_town town, size_t from_room, size_t to_room, const sketchup_road *road) {
+	return true;
+}
+
+static void sup_null_version(size_t bufsiz, char *version) {
+	snprintf(version, bufsiz, "%s", "n/a");
+}
+
+const sketchup_backend sketchup_backend_null = {
+	.name = "null",
+	.extension = "skp",
+	.startup = sup_null_startup,
+	.shutdown = sup_null_shutdown,
+	.town_ctor = sup_null_town_ctor,
+	.town_append_room = sup_null_town_append_room,
+	.town_save = sup_null_town_save,
+	.town_dtor = sup_null_town_dtor,
+	.town_set_districts = sup_null_town_set_districts,
+	.room_append_variable = sup_null_room_append_variable,
+	.room_set_profile = sup_null_room_set_profile,
+	.room_set_summary = sup_null_room_set_summary,
+	.town_append_road = sup_null_town_append_road,
+	.version = sup_null_version,
+	.cache_stats = NULL,
+};
@@ -0,0 +1,38 @@
+--TEST--
+Capture with the null backend
+--EXTENSIONS--
+php_3d
+--INI--
+php_3d.generate_model=1
+php_3d.backend=null
+php_3d.exclude="function:php_3d_*"
+--FILE--
+<?php
+function add($a, $b) {
+    $c = $a + $b;
+    return $c;
+}
+class Foo {
+    public function bar(array $list) {
+        return count($list);
+    }
+}
+echo add(1, 2), "\n";
+echo (new Foo)->bar([1, 2, 3]), "\n";
+$stats = php_3d_stats();
+var_dump($stats['request']['recording']);
+// The main script, add() and Foo::bar(), whose $a, $b, $c and $list were recorded when they
+// returned. The variables of the main script follow when it returns.
+var_dump($stats['request']['rooms'], $stats['request']['visits'], $stats['request']['variables']);
+var_dump($stats['request']['failures']);
+var_dump($stats['backend']['name']);
+?>
+--EXPECT--
+3
+3
+bool(true)
+int(3)
+int(3)
+int(4)
+int(0)
+string(4) "null"
@@ -0,0 +1,31 @@
+--TEST--
+Scope the capture with php_3d_start() and php_3d_stop()
+--EXTENSIONS--
+php_3d
+--INI--
+php_3d.generate_model=1
+php_3d.backend=null
+php_3d.autostart=0
+--FILE--
+<?php
+function add($a, $b) {
+    return $a + $b;
+}
+var_dump(php_3d_is_recording());
+var_dump(php_3d_stop());
+var_dump(php_3d_start('checkout'));
+var_dump(php_3d_is_recording());
+echo add(1, 2), "\n";
+var_dump(php_3d_stop());
+var_dump(php_3d_is_recording());
+var_dump(php_3d_start());
+?>
+--EXPECT--
+bool(false)
+bool(false)
+bool(true)
+bool(true)
+3
+bool(true)
+bool(false)
+bool(true)
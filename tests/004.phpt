@@ -0,0 +1,63 @@
+--TEST--
+Report the cost of the capture with php_3d_stats()
+--EXTENSIONS--
+php_3d
+--INI--
+php_3d.generate_model=1
+php_3d.backend=null
+php_3d.max_floors=2
+--FILE--
+<?php
+function add($a, $b) {
+    $c = $a + $b;
+    return $c;
+}
+for ($i = 0; $i < 5; $i++) {
+    add($i, 1);
+}
+$stats = php_3d_stats();
+var_dump(array_keys($stats));
+var_dump($stats['request']['capturing'], $stats['request']['recording']);
+var_dump($stats['request']['rooms'] >= 1);
+var_dump($stats['request']['floors_folded'] >= 3);
+var_dump($stats['request']['variables'] >= 6);
+var_dump($stats['request']['failures']);
+var_dump($stats['process']['requests_captured'] >= 1);
+var_dump($stats['backend']['name']);
+var_dump(array_keys($stats['timings']));
+var_dump(count($stats['timings']['save']['buckets']));
+?>
+--EXPECT--
+array(5) {
+  [0]=>
+  string(7) "request"
+  [1]=>
+  string(7) "process"
+  [2]=>
+  string(6) "writer"
+  [3]=>
+  string(7) "backend"
+  [4]=>
+  string(7) "timings"
+}
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+bool(true)
+int(0)
+bool(true)
+string(4) "null"
+array(5) {
+  [0]=>
+  string(6) "finish"
+  [1]=>
+  string(4) "ctor"
+  [2]=>
+  string(6) "append"
+  [3]=>
+  string(4) "save"
+  [4]=>
+  string(4) "dtor"
+}
+int(24)
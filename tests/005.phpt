@@ -0,0 +1,28 @@
+--TEST--
+php_3d_start() picks up the running frames with the main script as room 0
+--EXTENSIONS--
+php_3d
+--INI--
+php_3d.generate_model=1
+php_3d.backend=null
+php_3d.autostart=0
+php_3d.exclude="function:php_3d_*"
+--FILE--
+<?php
+function handle() {
+    php_3d_start('checkout');
+    return add(1, 2);
+}
+function add($a, $b) {
+    return $a + $b;
+}
+echo handle(), "\n";
+$request = php_3d_stats()['request'];
+// The main script, handle() and add()
+var_dump($request['rooms']);
+var_dump($request['visits']);
+?>
+--EXPECT--
+3
+int(3)
+int(3)
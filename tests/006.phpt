@@ -0,0 +1,45 @@
+--TEST--
+Only observe the functions that php_3d.include and php_3d.exclude allow
+--EXTENSIONS--
+php_3d
+--INI--
+php_3d.generate_model=1
+php_3d.backend=null
+php_3d.include="ns:app\*"
+php_3d.exclude="class:*Test, function:__*, file:*006.PHP"
+--FILE--
+<?php
+namespace App\Controller {
+    class Home {
+        public function __construct() {}
+        public function index() {
+            return helper();
+        }
+    }
+    function helper() {
+        return 1;
+    }
+}
+namespace App\Tests {
+    class HomeTest {
+        public function run() {
+            return 2;
+        }
+    }
+}
+namespace Vendor\Lib {
+    function util() {
+        return 3;
+    }
+}
+namespace {
+    (new App\Controller\Home)->index();
+    (new App\Tests\HomeTest)->run();
+    Vendor\Lib\util();
+    // The main script, Home::index() and helper(): namespaces match case-insensitively, the
+    // constructor and the test class are excluded, and file patterns are case-sensitive
+    var_dump(php_3d_stats()['request']['rooms']);
+}
+?>
+--EXPECT--
+int(3)
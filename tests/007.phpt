@@ -0,0 +1,22 @@
+--TEST--
+Only observe the functions that are first called at least php_3d.min_depth frames deep
+--EXTENSIONS--
+php_3d
+--INI--
+php_3d.generate_model=1
+php_3d.backend=null
+php_3d.min_depth=2
+--FILE--
+<?php
+function outer() {
+    return inner();
+}
+function inner() {
+    return 1;
+}
+outer();
+// The main script is always observed, outer() is only 1 frame deep
+var_dump(php_3d_stats()['request']['rooms']);
+?>
+--EXPECT--
+int(2)
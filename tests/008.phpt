@@ -0,0 +1,40 @@
+--TEST--
+php_3d.output=trace saves the trace of the request instead of its town
+--EXTENSIONS--
+php_3d
+--FILE--
+<?php
+// The file is saved in RSHUTDOWN, so the request is run by a PHP process of its own
+$dir = sys_get_temp_dir() . '/php_3d_008.' . getmypid();
+@mkdir($dir);
+$script = $dir . '/script.php';
+file_put_contents($script, '<?php function add($a, $b) { return $a + $b; } echo add(1, 2), "\n";');
+$command = getenv('TEST_PHP_EXECUTABLE') . ' ' . getenv('TEST_PHP_EXTRA_ARGS')
+    . ' -d php_3d.generate_model=1 -d php_3d.output=trace -d php_3d.writer_queue_depth=0'
+    . ' -d ' . escapeshellarg('php_3d.output_file=' . $dir . '/php') . ' ' . escapeshellarg($script);
+echo shell_exec($command);
+
+// ZTS builds number every file
+$files = glob($dir . '/php*.p3dt');
+var_dump(count($files));
+$data = file_get_contents($files[0]);
+var_dump(substr($data, 0, 4));
+// The event count follows the magic, the version, the string count and the string bytes
+var_dump(unpack('P', $data, 24)[1] >= 4);
+var_dump(str_contains($data, "add\0"));
+var_dump(glob($dir . '/*.skp'));
+?>
+--CLEAN--
+<?php
+$dir = sys_get_temp_dir() . '/php_3d_008.' . getmypid();
+array_map('unlink', glob($dir . '/*'));
+@rmdir($dir);
+?>
+--EXPECT--
+3
+int(1)
+string(4) "P3DT"
+bool(true)
+bool(true)
+array(0) {
+}
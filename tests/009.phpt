@@ -0,0 +1,38 @@
+--TEST--
+php_3d.flush_events cuts the request into segment files named after php_3d.output_file
+--EXTENSIONS--
+php_3d
+--INI--
+php_3d.generate_model=1
+php_3d.backend=gltf
+php_3d.flush_events=100
+php_3d.writer_queue_depth=0
+php_3d.output_file="{PWD}/009.%p.%t.%s"
+--FILE--
+<?php
+function add($a, $b) {
+    return $a + $b;
+}
+$start = time();
+for ($i = 0; $i < 300; $i++) {
+    add($i, 1);
+}
+// With no queue the segments are saved as soon as they are cut
+$files = glob(__DIR__ . '/009.' . getmypid() . '.*.glb');
+var_dump(count($files) >= 2);
+$sequences = [];
+foreach ($files as $file) {
+    [, , $time, $sequence] = explode('.', basename($file));
+    if ($time < $start - 1 || $time > time()) echo "Wrong time in $file\n";
+    if (file_get_contents($file, false, null, 0, 4) !== 'glTF') echo "No glTF in $file\n";
+    $sequences[] = $sequence;
+}
+var_dump(count(array_unique($sequences)) === count($files));
+?>
+--CLEAN--
+<?php
+array_map('unlink', glob(__DIR__ . '/009.*.glb'));
+?>
+--EXPECT--
+bool(true)
+bool(true)
@@ -0,0 +1,24 @@
+--TEST--
+php_3d.delta_snapshots only records the variables that changed since the last visit
+--EXTENSIONS--
+php_3d
+--INI--
+php_3d.generate_model=1
+php_3d.backend=null
+php_3d.delta_snapshots=1
+--FILE--
+<?php
+function add($a, $b) {
+    $c = $a + $b;
+    return $c;
+}
+for ($i = 0; $i < 5; $i++) {
+    add(1, 2);
+}
+add(1, 3);
+// $a, $b and $c of the first visit, then $b and $c of the last, instead of 18. The other 13 are
+// only referenced and inherited by their floors.
+var_dump(php_3d_stats()['request']['variables']);
+?>
+--EXPECT--
+int(5)
@@ -0,0 +1,51 @@
+--TEST--
+php_3d.heatmap saves the calls, time and memory of every room with the trace
+--EXTENSIONS--
+php_3d
+--FILE--
+<?php
+// The profiles are added to the trace in RSHUTDOWN, so the request is run by a PHP process of its own
+$dir = sys_get_temp_dir() . '/php_3d_011.' . getmypid();
+@mkdir($dir);
+$script = $dir . '/script.php';
+file_put_contents($script, '<?php function work() { $s = ""; for ($i = 0; $i < 1000; $i++) { $s .= "x"; } return $s; }
+for ($i = 0; $i < 10; $i++) { work(); }');
+
+function run_traced(string $dir, string $script, int $heatmap): string {
+    $command = getenv('TEST_PHP_EXECUTABLE') . ' ' . getenv('TEST_PHP_EXTRA_ARGS')
+        . ' -d php_3d.generate_model=1 -d php_3d.output=trace -d php_3d.writer_queue_depth=0'
+        . ' -d php_3d.heatmap=' . $heatmap
+        . ' -d ' . escapeshellarg('php_3d.output_file=' . $dir . '/' . $heatmap) . ' ' . escapeshellarg($script);
+    shell_exec($command);
+    $files = glob($dir . '/' . $heatmap . '*.p3dt');
+    return $files ? file_get_contents($files[0]) : '';
+}
+
+// The profiles follow the header, the string offsets and the strings, each 8 byte aligned
+function room_profile(string $data, int $room): ?array {
+    $header = unpack('Vmagic/Vversion/Pstrings/Pstring_bytes/Pevents/Pblocks/Pprofiles', $data);
+    if ($room >= $header['profiles']) return null;
+    $align = fn($size) => ($size + 7) & ~7;
+    $offset = 88 + $align(($header['strings'] + 1) * 4) + $align($header['string_bytes']) + $room * 48;
+    return unpack('Pcalls/Psamples/Pinclusive_ns/Pexclusive_ns/qmemory_bytes/eheat', $data, $offset);
+}
+
+var_dump(room_profile(run_traced($dir, $script, 0), 1));
+// Room 0 is the main script, room 1 work()
+$data = run_traced($dir, $script, 1);
+var_dump(room_profile($data, 0)['calls']);
+$profile = room_profile($data, 1);
+var_dump($profile['calls']);
+var_dump($profile['inclusive_ns'] > 0 && $profile['exclusive_ns'] <= $profile['inclusive_ns']);
+?>
+--CLEAN--
+<?php
+$dir = sys_get_temp_dir() . '/php_3d_011.' . getmypid();
+array_map('unlink', glob($dir . '/*'));
+@rmdir($dir);
+?>
+--EXPECT--
+NULL
+int(1)
+int(10)
+bool(true)
@@ -0,0 +1,25 @@
+--TEST--
+php_3d.deep_capture stops capturing shapes once php_3d.capture_max_bytes is spent
+--EXTENSIONS--
+php_3d
+--INI--
+php_3d.generate_model=1
+php_3d.backend=null
+php_3d.deep_capture=1
+php_3d.capture_max_bytes=1
+--FILE--
+<?php
+function first(array $list) {
+    return $list[0];
+}
+for ($i = 0; $i < 4; $i++) {
+    first([$i, [1, 2, 3], 'key' => new stdClass]);
+}
+$request = php_3d_stats()['request'];
+// Only the first array is captured, the variables are still recorded
+var_dump($request['captures_skipped']);
+var_dump($request['variables']);
+?>
+--EXPECT--
+int(3)
+int(4)
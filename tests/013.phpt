@@ -0,0 +1,25 @@
+--TEST--
+php_3d.max_floors folds the visits past the cap into the summary floor
+--EXTENSIONS--
+php_3d
+--INI--
+php_3d.generate_model=1
+php_3d.backend=null
+php_3d.max_floors=3
+--FILE--
+<?php
+function countdown($n) {
+    return $n ? countdown($n - 1) : 0;
+}
+countdown(9);
+$request = php_3d_stats()['request'];
+// The main script and 3 of the 10 visits of countdown(), the other 7 are folded
+var_dump($request['visits']);
+var_dump($request['floors_folded']);
+// Only the visits with a floor record their $n
+var_dump($request['variables']);
+?>
+--EXPECT--
+int(4)
+int(7)
+int(3)
@@ -0,0 +1,198 @@
+// Triangulation of the flat meshes and their use as the glTF assets: every face of a few awkward
+// meshes must be covered by triangles of the same total area and winding, and a baked room.p3dm
+// must replace the cube of the rooms, while the other assets stay cubes. Builds without PHP:
+//
+//   $ cc -I. -o mesh_test tests/mesh.c arena.c layout.c mesh.c mesh_skp.c sketchup.c sketchup_backend.c sketchup_gltf.c sketchup_null.c trace.c trace_file.c -lm -lpthread
+//   $ ./mesh_test /tmp
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mesh.h"
+#include "sketchup.h"
+#include "trace.h"
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		return false; \
+	} \
+} while (0)
+
+static bool add_loop(mesh_builder *b, const double (*points)[3], uint32_t count, bool reverse) {
+	uint32_t indices[64];
+	for (uint32_t i = 0; i < count; i++) {
+		if (!mesh_builder_vertex(b, points[reverse ? count - 1 - i : i], &indices[i])) return false;
+	}
+	return mesh_builder_loop(b, indices, count);
+}
+
+// A face of the box seen from outside, counter-clockwise, at the given side and offset
+static bool add_quad(mesh_builder *b, int axis, double at, bool outward, const double from[2], const double to[2]) {
+	int u = (axis + 1) % 3, v = (axis + 2) % 3;
+	double points[4][3];
+	const double corners[4][2] = {{from[0], from[1]}, {to[0], from[1]}, {to[0], to[1]}, {from[0], to[1]}};
+	for (int i = 0; i < 4; i++) {
+		points[i][axis] = at;
+		points[i][u] = corners[i][0];
+		points[i][v] = corners[i][1];
+	}
+	return add_loop(b, (const double (*)[3]) points, 4, !outward);
+}
+
+// A 288 x 288 x 120 room with a window in its front wall and a concave L shaped roof with two holes
+static bool build_room(mesh_builder *b) {
+	mesh_builder_init(b);
+	const double lo[2] = {0, 0};
+	const double box[3] = {288, 288, 120};
+	for (int axis = 0; axis < 3; axis++) {
+		int u = (axis + 1) % 3, v = (axis + 2) % 3;
+		const double hi[2] = {box[u], box[v]};
+		if (!mesh_builder_face(b, MESH_NO_MATERIAL, MESH_NO_MATERIAL) || !add_quad(b, axis, 0, false, lo, hi)) return false;
+		if (axis == 1) {
+			// The wall at y = 0 has a window, which runs the other way around
+			const double window_lo[2] = {40, 100};
+			const double window_hi[2] = {80, 200};
+			if (!add_quad(b, axis, 0, true, window_lo, window_hi)) return false;
+		}
+		if (axis == 2) continue;
+		if (!mesh_builder_face(b, MESH_NO_MATERIAL, MESH_NO_MATERIAL) || !add_quad(b, axis, box[axis], true, lo, hi)) return false;
+	}
+	// The roof is an L, with a skylight in each arm
+	static const double roof[6][3] = {{0, 0, 120}, {288, 0, 120}, {288, 96, 120}, {96, 96, 120}, {96, 288, 120}, {0, 288, 120}};
+	static const double skylight_a[4][3] = {{200, 20, 120}, {260, 20, 120}, {260, 70, 120}, {200, 70, 120}};
+	static const double skylight_b[3][3] = {{20, 200, 120}, {70, 200, 120}, {45, 260, 120}};
+	return mesh_builder_face(b, MESH_NO_MATERIAL, MESH_NO_MATERIAL)
+		&& add_loop(b, roof, 6, false)
+		&& add_loop(b, skylight_a, 4, true)
+		&& add_loop(b, skylight_b, 3, true);
+}
+
+static double loop_area(const mesh *m, const mesh_loop *loop) {
+	double normal[3] = {0};
+	for (uint32_t i = 0; i < loop->index_count; i++) {
+		const double *cur = &m->vertices[m->indices[loop->index_start + i] * 3];
+		const double *nxt = &m->vertices[m->indices[loop->index_start + (i + 1) % loop->index_count] * 3];
+		normal[0] += (cur[1] - nxt[1]) * (cur[2] + nxt[2]);
+		normal[1] += (cur[2] - nxt[2]) * (cur[0] + nxt[0]);
+		normal[2] += (cur[0] - nxt[0]) * (cur[1] + nxt[1]);
+	}
+	return sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]) / 2;
+}
+
+// The triangles of every face add up to the area of its outer loop less its holes, and all of them
+// face the same way as the face
+static bool triangles_cover(const mesh *m) {
+	mesh_triangles t;
+	mesh_triangles_init(&t);
+	bool ok = true;
+	for (uint32_t face = 0; ok && face < m->face_count; face++) {
+		const mesh_face *f = &m->faces[face];
+		double expected = loop_area(m, &m->loops[f->loop_start]);
+		for (uint32_t l = 1; l < f->loop_count; l++) {
+			expected -= loop_area(m, &m->loops[f->loop_start + l]);
+		}
+		double normal[3];
+		mesh_face_normal(m, face, normal);
+
+		t.index_count = 0;
+		ok = mesh_face_triangulate(m, face, &t);
+		double area = 0;
+		for (uint32_t i = 0; ok && i < t.index_count; i += 3) {
+			const double *a = &m->vertices[t.indices[i] * 3], *b = &m->vertices[t.indices[i + 1] * 3], *c = &m->vertices[t.indices[i + 2] * 3];
+			double ab[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]}, ac[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+			double cross[3] = {ab[1] * ac[2] - ab[2] * ac[1], ab[2] * ac[0] - ab[0] * ac[2], ab[0] * ac[1] - ab[1] * ac[0]};
+			ok = cross[0] * normal[0] + cross[1] * normal[1] + cross[2] * normal[2] >= 0;
+			area += sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]) / 2;
+		}
+		if (ok && fabs(area - expected) > 1e-6 * expected) {
+			fprintf(stderr, "face %u: %u triangles of %g, expected %g\n", face, t.index_count / 3, area, expected);
+			ok = false;
+		}
+	}
+	mesh_triangles_free(&t);
+	CHECK(ok);
+	return true;
+}
+
+static bool glb_json(const char *file, char *json, size_t size) {
+	FILE *f = fopen(file, "rb");
+	if (!f) return false;
+	unsigned char header[20];
+	bool ok = fread(header, 1, sizeof(header), f) == sizeof(header);
+	uint32_t length = (uint32_t) header[12] | (uint32_t) header[13] << 8 | (uint32_t) header[14] << 16 | (uint32_t) header[15] << 24;
+	ok = ok && length < size && fread(json, 1, length, f) == length;
+	fclose(f);
+	if (ok) json[length] = '\0';
+	return ok;
+}
+
+// Renders a town of the main script and one room with a variable from within dir, which may be relative
+static bool render_town(const char *dir, char *json, size_t size) {
+	char cwd[1024];
+	const char *file = "mesh_test.glb";
+	CHECK(getcwd(cwd, sizeof(cwd)) && chdir(dir) == 0);
+	trace_buffer *trace = trace_ctor();
+	uint32_t main_id, name_id, var_id;
+	bool ok = trace && trace_intern(trace, "{main}", 6, &main_id) && trace_intern(trace, "handle", 6, &name_id) && trace_intern(trace, "a", 1, &var_id);
+	trace_event events[] = {
+		{.type = TRACE_ROOM_ENTER, .name_id = main_id},
+		{.type = TRACE_ROOM_ENTER, .name_id = name_id, .room_index = 1},
+		{.type = TRACE_VAR, .val_type = SKETCHUP_VAL_LONG, .name_id = var_id, .room_index = 1},
+		{.type = TRACE_ROOM_EXIT, .room_index = 1},
+		{.type = TRACE_ROOM_EXIT},
+	};
+	for (size_t i = 0; ok && i < sizeof(events) / sizeof(events[0]); i++) {
+		ok = trace_append(trace, &events[i]);
+	}
+	sketchup_backend_gltf.startup();
+	ok = ok && trace_render(trace, &sketchup_backend_gltf, file);
+	sketchup_backend_gltf.shutdown();
+	if (trace) trace_dtor(trace);
+	ok = ok && glb_json(file, json, size);
+	unlink(file);
+	CHECK(chdir(cwd) == 0);
+	CHECK(ok);
+	return true;
+}
+
+static bool gltf_assets(const mesh *room, const char *dir) {
+	static char json[1 << 20];
+	// Without models/ every asset is the cube
+	CHECK(render_town(dir, json, sizeof(json)));
+	CHECK(strstr(json, "\"POSITION\":3") == NULL);
+
+	char models[1024], baked[1100];
+	snprintf(models, sizeof(models), "%s/models", dir);
+	snprintf(baked, sizeof(baked), "%s/room.p3dm", models);
+	mkdir(models, 0700);
+	CHECK(mesh_write(room, baked));
+	bool ok = render_town(dir, json, sizeof(json));
+	unlink(baked);
+	rmdir(models);
+	CHECK(ok);
+	// The rooms use the baked mesh, scaled into the unit cube, the town center and variables the cube
+	CHECK(strstr(json, "{\"primitives\":[{\"attributes\":{\"POSITION\":3,\"NORMAL\":4},\"indices\":5,\"material\":1}]}"));
+	CHECK(strstr(json, "{\"primitives\":[{\"attributes\":{\"POSITION\":0,\"NORMAL\":1},\"indices\":2,\"material\":0}]}"));
+	CHECK(strstr(json, "\"min\":[0,0,0],\"max\":[1,1,1]},{\"bufferView\":4"));
+	CHECK(strstr(json, "\"POSITION\":6") == NULL);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	const char *dir = argc > 1 ? argv[1] : "/tmp";
+	mesh_builder b;
+	bool ok = build_room(&b);
+	mesh room;
+	mesh_builder_view(&b, &room);
+	const double bbox[6] = {0, 0, 0, 288, 288, 120};
+	memcpy(b.bbox, bbox, sizeof(bbox));
+	memcpy(room.bbox, bbox, sizeof(bbox));
+	ok = ok && triangles_cover(&room) && gltf_assets(&room, dir);
+	mesh_builder_free(&b);
+	puts(ok ? "OK" : "FAILED");
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,347 @@
+// Round trip of the trace file format: saves a trace, loads it again and compares every event and
+// side table, renders the call graph of the loaded trace as roads, then checks that truncated and
+// corrupt files are rejected, and that floors inherit the variables delta snapshots only referenced.
+// Builds without PHP:
+//
+//   $ cc -DHAVE_3D_ZLIB -I. -o trace_file_test tests/trace_file.c arena.c layout.c mesh.c mesh_skp.c sketchup.c sketchup_backend.c sketchup_gltf.c sketchup_null.c trace.c trace_file.c -lm -lpthread -lz
+//   $ ./trace_file_test /tmp
+//
+// Leave out -DHAVE_3D_ZLIB -lz to only test uncompressed files.
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+		return false; \
+	} \
+} while (0)
+
+// Enough rooms and visits for several event blocks, with room and visit going up and down so that
+// the deltas are negative too
+static trace_buffer *trace_fixture(void) {
+	trace_buffer *trace = trace_ctor();
+	if (!trace) return NULL;
+	char name[32];
+	uint32_t var_ids[4];
+	const char *vars[] = {"a", "list", "user", "ok"};
+	for (int i = 0; i < 4; i++) {
+		if (!trace_intern(trace, vars[i], strlen(vars[i]), &var_ids[i])) return NULL;
+	}
+	if (!trace_set_label(trace, "checkout", 8)) return NULL;
+
+	trace_shape_child children[] = {{var_ids[0], SKETCHUP_VAL_LONG}, {var_ids[2], SKETCHUP_VAL_STRING}};
+	trace_shape shape = {.count = 1000, .bytes = 123456, .depth = 3, .flags = SKETCHUP_SHAPE_TRUNCATED};
+	uint32_t shape_id;
+	shape.child_count = 2;
+	if (!trace_add_shape(trace, &shape, children, &shape_id)) return NULL;
+
+	uint32_t visits[300] = {0};
+	for (uint32_t i = 0; i < 3000; i++) {
+		uint32_t room = (i * 7919) % 300;
+		snprintf(name, sizeof(name), "fn_%u", room);
+		uint32_t name_id;
+		if (!trace_intern(trace, name, strlen(name), &name_id)) return NULL;
+		uint32_t visit = visits[room]++;
+		trace_event enter = {.type = TRACE_ROOM_ENTER, .name_id = name_id, .room_index = room, .visit_index = visit};
+		trace_event shaped = {.type = TRACE_SHAPE, .room_index = room, .visit_index = visit, .var_index = shape_id};
+		trace_event var = {.type = TRACE_VAR, .val_type = (uint8_t) (i % SKETCHUP_VAL_TYPE_COUNT), .name_id = var_ids[i % 4], .room_index = room, .visit_index = visit, .var_index = i % 4};
+		trace_event exit = {.type = TRACE_ROOM_EXIT, .room_index = room, .visit_index = visit};
+		if (!trace_append(trace, &enter) || (i % 10 == 0 && !trace_append(trace, &shaped))
+				|| !trace_append(trace, &var) || !trace_append(trace, &exit)) {
+			return NULL;
+		}
+	}
+
+	trace_var_summary summary_vars[2] = {{.name_id = var_ids[0], .has_range = true, .min = -1.5, .max = 1e9}, {.name_id = var_ids[1]}};
+	summary_vars[0].types[SKETCHUP_VAL_LONG] = 40;
+	summary_vars[1].types[SKETCHUP_VAL_ARRAY] = 40;
+	trace_summary summary = {.room_index = 7, .visit_index = 64, .calls = 40, .var_count = 2};
+	if (!trace_add_summary(trace, &summary, summary_vars)) return NULL;
+	for (uint32_t room = 0; room < 300; room += 3) {
+		sketchup_room_profile profile = {.calls = room + 1, .inclusive_ns = room * 1000ULL, .exclusive_ns = room * 10ULL, .memory_bytes = -(int64_t) room};
+		if (!trace_set_profile(trace, room, &profile)) return NULL;
+	}
+	// The self call is recursion and gets no road
+	trace_edge edges[] = {
+		{.caller = 0, .callee = 1, .calls = 100, .inclusive_ns = 2500000},
+		{.caller = 1, .callee = 299, .calls = 40},
+		{.caller = 299, .callee = 7, .calls = 1, .inclusive_ns = 999},
+		{.caller = 7, .callee = 7, .calls = 77},
+	};
+	if (!trace_set_edges(trace, edges, sizeof(edges) / sizeof(edges[0]))) return NULL;
+	return trace;
+}
+
+static bool events_equal(const trace_event *a, const trace_event *b) {
+	return a->type == b->type && a->val_type == b->val_type && a->name_id == b->name_id
+		&& a->room_index == b->room_index && a->visit_index == b->visit_index && a->var_index == b->var_index;
+}
+
+static bool same_events(const trace_buffer *a, const trace_buffer *b) {
+	if (a->event_count != b->event_count) return false;
+	const trace_chunk *ca = a->head, *cb = b->head;
+	size_t ia = 0, ib = 0;
+	for (size_t i = 0; i < a->event_count; i++, ia++, ib++) {
+		if (ia == ca->count) { ca = ca->next; ia = 0; }
+		if (ib == cb->count) { cb = cb->next; ib = 0; }
+		if (!events_equal(&ca->events[ia], &cb->events[ib])) return false;
+	}
+	return true;
+}
+
+static bool traces_equal(const trace_buffer *a, const trace_buffer *b) {
+	CHECK(same_events(a, b));
+	CHECK(a->has_label == b->has_label && a->label_id == b->label_id);
+
+	CHECK(a->string_count == b->string_count);
+	for (size_t i = 0; i < a->string_count; i++) {
+		CHECK(a->strings[i].len == b->strings[i].len && memcmp(a->strings[i].val, b->strings[i].val, a->strings[i].len) == 0);
+	}
+
+	CHECK(b->profile_count >= 300 - 2);
+	for (size_t i = 0; i < a->profile_count && i < b->profile_count; i++) {
+		const sketchup_room_profile *pa = &a->profiles[i], *pb = &b->profiles[i];
+		CHECK(pa->calls == pb->calls && pa->inclusive_ns == pb->inclusive_ns && pa->exclusive_ns == pb->exclusive_ns && pa->memory_bytes == pb->memory_bytes);
+	}
+
+	CHECK(a->shape_count == b->shape_count && a->shape_child_count == b->shape_child_count);
+	for (size_t i = 0; i < a->shape_count; i++) {
+		CHECK(a->shapes[i].count == b->shapes[i].count && a->shapes[i].bytes == b->shapes[i].bytes && a->shapes[i].depth == b->shapes[i].depth
+			&& a->shapes[i].child_offset == b->shapes[i].child_offset && a->shapes[i].child_count == b->shapes[i].child_count);
+	}
+	for (size_t i = 0; i < a->shape_child_count; i++) {
+		CHECK(a->shape_children[i].name_id == b->shape_children[i].name_id && a->shape_children[i].val_type == b->shape_children[i].val_type);
+	}
+
+	CHECK(a->summary_count == b->summary_count && a->var_summary_count == b->var_summary_count);
+	for (size_t i = 0; i < a->summary_count; i++) {
+		CHECK(a->summaries[i].room_index == b->summaries[i].room_index && a->summaries[i].visit_index == b->summaries[i].visit_index
+			&& a->summaries[i].calls == b->summaries[i].calls && a->summaries[i].var_count == b->summaries[i].var_count);
+	}
+	for (size_t i = 0; i < a->var_summary_count; i++) {
+		const trace_var_summary *va = &a->var_summaries[i], *vb = &b->var_summaries[i];
+		CHECK(va->name_id == vb->name_id && memcmp(va->types, vb->types, sizeof(va->types)) == 0
+			&& va->has_range == vb->has_range && va->min == vb->min && va->max == vb->max);
+	}
+
+	CHECK(a->edge_count == b->edge_count);
+	for (size_t i = 0; i < a->edge_count; i++) {
+		CHECK(a->edges[i].caller == b->edges[i].caller && a->edges[i].callee == b->edges[i].callee
+			&& a->edges[i].calls == b->edges[i].calls && a->edges[i].inclusive_ns == b->edges[i].inclusive_ns);
+	}
+	return true;
+}
+
+// The mapped file is scanned without loading it, and must yield the same events
+static bool cursor_matches(const trace_buffer *trace, const char *file) {
+	trace_file tf;
+	CHECK(trace_file_open(&tf, file));
+	CHECK(tf.event_count == trace->event_count && tf.block_count == (trace->event_count + TRACE_CHUNK_EVENTS - 1) / TRACE_CHUNK_EVENTS);
+	trace_cursor cursor;
+	trace_cursor_init(&cursor, &tf);
+	const trace_chunk *chunk = trace->head;
+	size_t i = 0, count = 0;
+	trace_event event;
+	bool ok = true;
+	while (ok && trace_cursor_next(&cursor, &event)) {
+		if (i == chunk->count) { chunk = chunk->next; i = 0; }
+		ok = events_equal(&event, &chunk->events[i++]);
+		count++;
+	}
+	ok = ok && !cursor.failed && count == trace->event_count;
+	trace_cursor_free(&cursor);
+	trace_file_close(&tf);
+	CHECK(ok);
+	return true;
+}
+
+static bool copy_file(const char *from, const char *to, long size, long flip) {
+	FILE *in = fopen(from, "rb");
+	FILE *out = fopen(to, "wb");
+	bool ok = in && out;
+	for (long i = 0; ok && i < size; i++) {
+		int c = fgetc(in);
+		if (c == EOF) break;
+		ok = fputc(i == flip ? c ^ 0x5A : c, out) != EOF;
+	}
+	if (in) fclose(in);
+	if (out) fclose(out);
+	return ok;
+}
+
+static long file_size(const char *file) {
+	FILE *f = fopen(file, "rb");
+	if (!f) return -1;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fclose(f);
+	return size;
+}
+
+static bool file_contains(const char *file, const char *needle) {
+	FILE *f = fopen(file, "rb");
+	if (!f) return false;
+	static char data[1 << 22];
+	size_t size = fread(data, 1, sizeof(data), f);
+	fclose(f);
+	return memmem(data, size, needle, strlen(needle)) != NULL;
+}
+
+// The loaded call graph is rendered as named roads, and recursion as none
+static bool roads_render(const trace_buffer *trace, const char *dir) {
+	char file[1024];
+	snprintf(file, sizeof(file), "%s/trace_file_test.glb", dir);
+	sketchup_backend_gltf.startup();
+	bool ok = trace_render(trace, &sketchup_backend_gltf, file);
+	sketchup_backend_gltf.shutdown();
+	CHECK(ok);
+	ok = file_contains(file, "\"100 calls, 2.500 ms\"") && file_contains(file, "\"40 calls\"")
+		&& file_contains(file, "\"1 calls, 0.001 ms\"") && !file_contains(file, "\"77 calls");
+	unlink(file);
+	CHECK(ok);
+	return true;
+}
+
+// The variables a town was handed, by floor
+typedef struct recorded_var_s {
+	size_t room_index;
+	size_t visit_index;
+	size_t var_index;
+	char name[16];
+	enum sketchup_val_type type;
+	uint64_t shape_count;
+} recorded_var;
+
+static recorded_var recorded[16];
+static size_t recorded_count;
+
+static bool record_variable(sketchup_town town, size_t room_index, size_t visit_index, size_t var_index, const char *name, sketchup_val val) {
+	(void) town;
+	if (recorded_count == sizeof(recorded) / sizeof(recorded[0])) return false;
+	recorded_var *var = &recorded[recorded_count++];
+	*var = (recorded_var) {room_index, visit_index, var_index, {0}, val.type, val.shape ? val.shape->count : 0};
+	snprintf(var->name, sizeof(var->name), "%s", name);
+	return true;
+}
+
+static const recorded_var *recorded_find(size_t visit_index, size_t var_index) {
+	for (size_t i = 0; i < recorded_count; i++) {
+		if (recorded[i].visit_index == visit_index && recorded[i].var_index == var_index) return &recorded[i];
+	}
+	return NULL;
+}
+
+// With php_3d.delta_snapshots the floors of a room inherit the variables that did not change since
+// the floor before, deep captures included, also after a round trip through a trace file
+static bool delta_inherit(const char *dir) {
+	trace_buffer *trace = trace_ctor();
+	CHECK(trace);
+	uint32_t name_id, items_id, n_id, shape_id;
+	trace_shape shape = {.count = 1000, .bytes = 4096, .depth = 1};
+	bool ok = trace_intern(trace, "count", 5, &name_id) && trace_intern(trace, "items", 5, &items_id) && trace_intern(trace, "n", 1, &n_id)
+		&& trace_add_shape(trace, &shape, NULL, &shape_id);
+	trace_event events[] = {
+		{.type = TRACE_ROOM_ENTER, .name_id = name_id},
+		{.type = TRACE_SHAPE, .var_index = shape_id},
+		{.type = TRACE_VAR, .val_type = SKETCHUP_VAL_ARRAY, .name_id = items_id},
+		{.type = TRACE_VAR, .val_type = SKETCHUP_VAL_LONG, .name_id = n_id, .var_index = 1},
+		{.type = TRACE_ROOM_EXIT},
+		{.type = TRACE_ROOM_ENTER, .name_id = name_id, .visit_index = 1},
+		{.type = TRACE_VAR_SAME, .visit_index = 1},
+		{.type = TRACE_VAR, .val_type = SKETCHUP_VAL_DOUBLE, .name_id = n_id, .visit_index = 1, .var_index = 1},
+		{.type = TRACE_ROOM_EXIT, .visit_index = 1},
+		{.type = TRACE_ROOM_ENTER, .name_id = name_id, .visit_index = 2},
+		{.type = TRACE_VAR_SAME, .visit_index = 2},
+		{.type = TRACE_VAR_SAME, .visit_index = 2, .var_index = 1},
+		{.type = TRACE_ROOM_EXIT, .visit_index = 2},
+	};
+	for (size_t i = 0; ok && i < sizeof(events) / sizeof(events[0]); i++) {
+		ok = trace_append(trace, &events[i]);
+	}
+	char file[1024];
+	snprintf(file, sizeof(file), "%s/trace_file_test.delta.p3dt", dir);
+	ok = ok && trace_save(trace, file, 0);
+	trace_dtor(trace);
+	CHECK(ok);
+	trace = trace_load(file);
+	unlink(file);
+	CHECK(trace);
+
+	sketchup_backend recorder = sketchup_backend_null;
+	recorder.room_append_variable = record_variable;
+	recorded_count = 0;
+	snprintf(file, sizeof(file), "%s/trace_file_test.delta", dir);
+	ok = trace_render(trace, &recorder, file);
+	trace_dtor(trace);
+	CHECK(ok);
+
+	CHECK(recorded_count == 6);
+	const recorded_var *items = recorded_find(1, 0), *n = recorded_find(1, 1);
+	CHECK(items && strcmp(items->name, "items") == 0 && items->type == SKETCHUP_VAL_ARRAY && items->shape_count == 1000);
+	CHECK(n && strcmp(n->name, "n") == 0 && n->type == SKETCHUP_VAL_DOUBLE);
+	items = recorded_find(2, 0);
+	n = recorded_find(2, 1);
+	CHECK(items && strcmp(items->name, "items") == 0 && items->type == SKETCHUP_VAL_ARRAY && items->shape_count == 1000);
+	CHECK(n && n->type == SKETCHUP_VAL_DOUBLE);
+	return true;
+}
+
+static bool round_trip(const trace_buffer *trace, const char *dir, int level) {
+	char file[1024], broken[1024];
+	snprintf(file, sizeof(file), "%s/trace_file_test.%d.p3dt", dir, level);
+	snprintf(broken, sizeof(broken), "%s/trace_file_test.%d.broken.p3dt", dir, level);
+	CHECK(trace_save(trace, file, level));
+	long size = file_size(file);
+	printf("level %d: %zu events in %ld bytes, %.2f bytes per event\n", level, trace->event_count, size, (double) size / (double) trace->event_count);
+
+	trace_buffer *loaded = trace_load(file);
+	CHECK(loaded);
+	bool ok = traces_equal(trace, loaded) && (level || roads_render(loaded, dir));
+	trace_dtor(loaded);
+	CHECK(ok);
+	CHECK(cursor_matches(trace, file));
+
+	// Cut anywhere, from within the header to the last block. The padding after the last block is
+	// up to 7 bytes and not needed, so size - 8 is the last cut that loses data for sure
+	long cuts[] = {0, 7, 32, size / 4, size / 2, size - 100, size - 8};
+	for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++) {
+		CHECK(copy_file(file, broken, cuts[i], -1));
+		loaded = trace_load(broken);
+		if (loaded) trace_dtor(loaded);
+		CHECK(!loaded);
+	}
+	// A corrupt byte in the last event block is rejected, or at least decoded within bounds into
+	// other events when the varint it hit is still valid
+	CHECK(copy_file(file, broken, size, size - 20));
+	loaded = trace_load(broken);
+	if (loaded) {
+		ok = !same_events(trace, loaded);
+		trace_dtor(loaded);
+		CHECK(ok);
+	}
+
+	unlink(broken);
+	unlink(file);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	const char *dir = argc > 1 ? argv[1] : ".";
+	trace_buffer *trace = trace_fixture();
+	if (!trace) {
+		fprintf(stderr, "Failed to build the trace\n");
+		return 1;
+	}
+	bool ok = round_trip(trace, dir, 0) && delta_inherit(dir);
+#ifdef HAVE_3D_ZLIB
+	ok = ok && round_trip(trace, dir, 6);
+#endif
+	trace_dtor(trace);
+	puts(ok ? "OK" : "FAILED");
+	return ok ? 0 : 1;
+}
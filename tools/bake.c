@@ -0,0 +1,54 @@
+// Bakes the .skp model assets into .p3dm flat meshes that the SketchUp backend mmaps instead of
+// walking the .skp on first use:
+//
+//   $ cc -DHAVE_SKETCHUP_API -I. -F ~/Library/Frameworks -framework SketchUpAPI -o bake tools/bake.c mesh.c mesh_skp.c
+//   $ ./bake models/*.skp
+#include <stdio.h>
+#include <string.h>
+
+#include <SketchUpAPI/initialize.h>
+
+#include "mesh.h"
+#include "mesh_skp.h"
+
+static bool bake(const char *file) {
+	char out[1024];
+	size_t len = strlen(file);
+	if (len < 4 || strcmp(file + len - 4, ".skp") != 0 || len - 4 + sizeof(".p3dm") > sizeof(out)) {
+		fprintf(stderr, "%s: not a .skp file\n", file);
+		return false;
+	}
+	snprintf(out, sizeof(out), "%.*s.p3dm", (int) (len - 4), file);
+
+	mesh_builder b;
+	mesh_builder_init(&b);
+	if (!mesh_skp_load(&b, file)) {
+		fprintf(stderr, "%s: failed to load\n", file);
+		mesh_builder_free(&b);
+		return false;
+	}
+	mesh m;
+	mesh_builder_view(&b, &m);
+	bool ok = mesh_write(&m, out);
+	if (ok) {
+		printf("%s: %u vertices, %u faces, %u materials, %zu bytes\n", out, m.vertex_count, m.face_count, m.material_count, mesh_bytes(&m));
+	} else {
+		fprintf(stderr, "%s: failed to write\n", out);
+	}
+	mesh_builder_free(&b);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s model.skp...\n", argv[0]);
+		return 2;
+	}
+	SUInitialize();
+	int status = 0;
+	for (int i = 1; i < argc; i++) {
+		if (!bake(argv[i])) status = 1;
+	}
+	SUTerminate();
+	return status;
+}
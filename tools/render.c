@@ -0,0 +1,143 @@
+// Renders trace files saved with php_3d.output=trace into towns, e.g. on a machine that has the
+// SketchUp C API while the traces were captured on Linux servers:
+//
+//   $ cc -DHAVE_SKETCHUP_API -DHAVE_3D_ZLIB -I. -F ~/Library/Frameworks -framework SketchUpAPI -lm -lpthread -lz -o render tools/render.c arena.c layout.c mesh.c mesh_skp.c sketchup.c sketchup_backend.c sketchup_gltf.c sketchup_null.c trace.c trace_file.c
+//   $ ./render -b sketchup traces/*.p3dt
+//
+// Every town is saved next to its trace with the extension of the backend. With -i the traces are
+// only scanned and their rooms, visits and variables counted, straight from the mapped files. With
+// -m town all the traces are merged into one town, each one a district of its own, e.g. the
+// requests that the threads of a ZTS server handled at the same time.
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "sketchup.h"
+#include "trace.h"
+
+static bool render(const sketchup_backend *backend, const char *file) {
+	char out[1024];
+	const char *dot = strrchr(file, '.');
+	const char *slash = strrchr(file, '/');
+	size_t stem = (dot && (!slash || dot > slash)) ? (size_t) (dot - file) : strlen(file);
+	if (snprintf(out, sizeof(out), "%.*s.%s", (int) stem, file, backend->extension) >= (int) sizeof(out)) {
+		fprintf(stderr, "%s: file name too long\n", file);
+		return false;
+	}
+
+	trace_buffer *trace = trace_load(file);
+	if (!trace) {
+		fprintf(stderr, "%s: not a trace file of version %d\n", file, TRACE_FILE_VERSION);
+		return false;
+	}
+	bool ok = trace_render(trace, backend, out);
+	if (ok) {
+		printf("%s: %zu events, %zu strings\n", out, trace->event_count, trace->string_count);
+	} else {
+		fprintf(stderr, "%s: failed to render\n", out);
+	}
+	trace_dtor(trace);
+	return ok;
+}
+
+static bool merge(const sketchup_backend *backend, const char *out, char **files, int count) {
+	trace_buffer **traces = (trace_buffer **)calloc((size_t) count, sizeof(trace_buffer *));
+	if (!traces) return false;
+	bool ok = true;
+	for (int i = 0; i < count && ok; i++) {
+		traces[i] = trace_load(files[i]);
+		if (!traces[i]) {
+			fprintf(stderr, "%s: not a trace file of version %d\n", files[i], TRACE_FILE_VERSION);
+			ok = false;
+		}
+	}
+	if (ok) {
+		ok = trace_render_districts((const trace_buffer *const *) traces, (size_t) count, backend, out);
+		if (ok) {
+			printf("%s: %d districts\n", out, count);
+		} else {
+			fprintf(stderr, "%s: failed to render\n", out);
+		}
+	}
+	for (int i = 0; i < count; i++) {
+		if (traces[i]) trace_dtor(traces[i]);
+	}
+	free(traces);
+	return ok;
+}
+
+static bool info(const char *file) {
+	trace_file tf;
+	if (!trace_file_open(&tf, file)) {
+		fprintf(stderr, "%s: not a trace file of version %d\n", file, TRACE_FILE_VERSION);
+		return false;
+	}
+	uint64_t rooms = 0, visits = 0, vars = 0;
+	trace_cursor cursor;
+	trace_cursor_init(&cursor, &tf);
+	trace_event event;
+	while (trace_cursor_next(&cursor, &event)) {
+		if (event.type == TRACE_ROOM_ENTER) {
+			visits++;
+			if (event.visit_index == 0) rooms++;
+		} else if (event.type == TRACE_VAR || event.type == TRACE_VAR_SAME) {
+			vars++;
+		}
+	}
+	bool ok = !cursor.failed;
+	trace_cursor_free(&cursor);
+	if (ok) {
+		printf("%s: %" PRIu64 " events in %" PRIu64 " blocks, %" PRIu64 " strings, %" PRIu64 " rooms, %" PRIu64 " visits, %" PRIu64 " variables, %zu bytes\n",
+			file, tf.event_count, tf.block_count, tf.string_count, rooms, visits, vars, tf.map_size);
+	} else {
+		fprintf(stderr, "%s: corrupt event block\n", file);
+	}
+	trace_file_close(&tf);
+	return ok;
+}
+
+int main(int argc, char **argv) {
+	const char *name = SKETCHUP_BACKEND_DEFAULT;
+	const char *merged = NULL;
+	bool scan = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "b:im:")) != -1) {
+		if (opt == 'b') {
+			name = optarg;
+		} else if (opt == 'm') {
+			merged = optarg;
+		} else if (opt == 'i') {
+			scan = true;
+		} else {
+			optind = argc + 1;
+			break;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "Usage: %s [-b backend] [-m town | -i] trace.p3dt...\n", argv[0]);
+		return 2;
+	}
+	int status = 0;
+	if (scan) {
+		for (int i = optind; i < argc; i++) {
+			if (!info(argv[i])) status = 1;
+		}
+		return status;
+	}
+	const sketchup_backend *backend = sketchup_backend_find(name);
+	if (!backend) {
+		fprintf(stderr, "Unknown backend \"%s\"\n", name);
+		return 2;
+	}
+
+	backend->startup();
+	if (merged) {
+		status = merge(backend, merged, argv + optind, argc - optind) ? 0 : 1;
+	}
+	for (int i = optind; i < argc && !merged; i++) {
+		if (!render(backend, argv[i])) status = 1;
+	}
+	backend->shutdown();
+	return status;
+}
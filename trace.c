@@ -0,0 +1,505 @@
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+trace_buffer *trace_ctor(void) {
+	return (trace_buffer *)calloc(1, sizeof(trace_buffer));
+}
+
+void trace_dtor(trace_buffer *trace) {
+	trace_chunk *chunk = trace->head;
+	while (chunk) {
+		trace_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	for (size_t i = 0; i < trace->string_count; i++) {
+		free(trace->strings[i].val);
+	}
+	free(trace->strings);
+	free(trace->string_hash);
+	free(trace->profiles);
+	free(trace->shapes);
+	free(trace->shape_children);
+	free(trace->summaries);
+	free(trace->var_summaries);
+	free(trace->edges);
+	free(trace);
+}
+
+bool trace_append_slow(trace_buffer *trace, const trace_event *event) {
+	trace_chunk *chunk = (trace_chunk *)malloc(sizeof(trace_chunk));
+	if (!chunk) return false;
+	chunk->next = NULL;
+	chunk->count = 0;
+	if (trace->tail) {
+		trace->tail->next = chunk;
+	} else {
+		trace->head = chunk;
+	}
+	trace->tail = chunk;
+	return trace_append(trace, event);
+}
+
+// FNV-1a
+static uint64_t trace_hash(const char *str, size_t len) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= (unsigned char) str[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash ? hash : 1;
+}
+
+static bool trace_string_hash_grow(trace_buffer *trace) {
+	size_t cap = trace->string_hash_cap ? trace->string_hash_cap * 2 : 256;
+	uint32_t *table = (uint32_t *)calloc(cap, sizeof(uint32_t));
+	if (!table) return false;
+	// Rehashing needs the hash of every string, which is cheap compared to how rarely we grow
+	for (size_t id = 0; id < trace->string_count; id++) {
+		size_t slot = trace_hash(trace->strings[id].val, trace->strings[id].len) & (cap - 1);
+		while (table[slot]) slot = (slot + 1) & (cap - 1);
+		table[slot] = (uint32_t) id + 1;
+	}
+	free(trace->string_hash);
+	trace->string_hash = table;
+	trace->string_hash_cap = cap;
+	return true;
+}
+
+bool trace_intern(trace_buffer *trace, const char *str, size_t len, uint32_t *id) {
+	uint64_t h = trace_hash(str, len);
+	if ((trace->string_count + 1) * 2 > trace->string_hash_cap) {
+		if (!trace_string_hash_grow(trace)) return false;
+	}
+
+	size_t mask = trace->string_hash_cap - 1;
+	size_t slot = h & mask;
+	while (trace->string_hash[slot]) {
+		const trace_string *s = &trace->strings[trace->string_hash[slot] - 1];
+		if (s->len == len && memcmp(s->val, str, len) == 0) {
+			*id = trace->string_hash[slot] - 1;
+			return true;
+		}
+		slot = (slot + 1) & mask;
+	}
+
+	if (trace->string_count == trace->string_cap) {
+		size_t cap = trace->string_cap ? trace->string_cap * 2 : 64;
+		trace_string *strings = (trace_string *)realloc(trace->strings, cap * sizeof(trace_string));
+		if (!strings) return false;
+		trace->strings = strings;
+		trace->string_cap = cap;
+	}
+	char *val = (char *)malloc(len + 1);
+	if (!val) return false;
+	memcpy(val, str, len);
+	val[len] = '\0';
+
+	*id = (uint32_t) trace->string_count;
+	trace->strings[trace->string_count++] = (trace_string) {val, len};
+	trace->string_hash[slot] = *id + 1;
+	return true;
+}
+
+const char *trace_string_get(const trace_buffer *trace, uint32_t id) {
+	return (id < trace->string_count) ? trace->strings[id].val : "";
+}
+
+bool trace_add_shape(trace_buffer *trace, const trace_shape *shape, const trace_shape_child *children, uint32_t *id) {
+	uint32_t child_count = shape->child_count < TRACE_SHAPE_MAX_CHILDREN ? shape->child_count : TRACE_SHAPE_MAX_CHILDREN;
+	if (trace->shape_count == trace->shape_cap) {
+		size_t cap = trace->shape_cap ? trace->shape_cap * 2 : 64;
+		trace_shape *shapes = (trace_shape *)realloc(trace->shapes, cap * sizeof(trace_shape));
+		if (!shapes) return false;
+		trace->shapes = shapes;
+		trace->shape_cap = cap;
+	}
+	if (trace->shape_child_count + child_count > trace->shape_child_cap) {
+		size_t cap = trace->shape_child_cap ? trace->shape_child_cap * 2 : 256;
+		while (cap < trace->shape_child_count + child_count) cap *= 2;
+		trace_shape_child *shape_children = (trace_shape_child *)realloc(trace->shape_children, cap * sizeof(trace_shape_child));
+		if (!shape_children) return false;
+		trace->shape_children = shape_children;
+		trace->shape_child_cap = cap;
+	}
+
+	trace_shape *added = &trace->shapes[trace->shape_count];
+	*added = *shape;
+	added->child_offset = (uint32_t) trace->shape_child_count;
+	added->child_count = child_count;
+	if (child_count) {
+		memcpy(trace->shape_children + trace->shape_child_count, children, child_count * sizeof(trace_shape_child));
+		trace->shape_child_count += child_count;
+	}
+	*id = (uint32_t) trace->shape_count++;
+	return true;
+}
+
+bool trace_add_summary(trace_buffer *trace, const trace_summary *summary, const trace_var_summary *vars) {
+	if (trace->summary_count == trace->summary_cap) {
+		size_t cap = trace->summary_cap ? trace->summary_cap * 2 : 16;
+		trace_summary *summaries = (trace_summary *)realloc(trace->summaries, cap * sizeof(trace_summary));
+		if (!summaries) return false;
+		trace->summaries = summaries;
+		trace->summary_cap = cap;
+	}
+	if (trace->var_summary_count + summary->var_count > trace->var_summary_cap) {
+		size_t cap = trace->var_summary_cap ? trace->var_summary_cap * 2 : 64;
+		while (cap < trace->var_summary_count + summary->var_count) cap *= 2;
+		trace_var_summary *var_summaries = (trace_var_summary *)realloc(trace->var_summaries, cap * sizeof(trace_var_summary));
+		if (!var_summaries) return false;
+		trace->var_summaries = var_summaries;
+		trace->var_summary_cap = cap;
+	}
+
+	trace_summary *added = &trace->summaries[trace->summary_count++];
+	*added = *summary;
+	added->var_offset = (uint32_t) trace->var_summary_count;
+	if (summary->var_count) {
+		memcpy(trace->var_summaries + trace->var_summary_count, vars, summary->var_count * sizeof(trace_var_summary));
+		trace->var_summary_count += summary->var_count;
+	}
+	return true;
+}
+
+static bool trace_replay_summaries(const trace_buffer *trace, sketchup_town town, size_t room_base) {
+	bool ok = true;
+	sketchup_var_summary *vars = NULL;
+	size_t vars_cap = 0;
+	for (size_t i = 0; i < trace->summary_count; i++) {
+		const trace_summary *summary = &trace->summaries[i];
+		if (summary->var_count > vars_cap) {
+			sketchup_var_summary *grown = (sketchup_var_summary *)realloc(vars, summary->var_count * sizeof(sketchup_var_summary));
+			if (!grown) {
+				ok = false;
+				break;
+			}
+			vars = grown;
+			vars_cap = summary->var_count;
+		}
+		for (uint32_t v = 0; v < summary->var_count; v++) {
+			const trace_var_summary *var = &trace->var_summaries[summary->var_offset + v];
+			vars[v].name = trace_string_get(trace, var->name_id);
+			memcpy(vars[v].types, var->types, sizeof(vars[v].types));
+			vars[v].has_range = var->has_range;
+			vars[v].min = var->min;
+			vars[v].max = var->max;
+		}
+		sketchup_room_summary room_summary = {
+			.visit_index = summary->visit_index,
+			.calls = summary->calls,
+			.var_count = summary->var_count,
+			.vars = vars,
+		};
+		ok &= sketchup_room_set_summary(town, room_base + summary->room_index, &room_summary);
+	}
+	free(vars);
+	return ok;
+}
+
+bool trace_set_profile(trace_buffer *trace, uint32_t room_index, const sketchup_room_profile *profile) {
+	if (room_index >= trace->profile_count) {
+		size_t count = trace->profile_count ? trace->profile_count : 64;
+		while (count <= room_index) count *= 2;
+		sketchup_room_profile *profiles = (sketchup_room_profile *)realloc(trace->profiles, count * sizeof(sketchup_room_profile));
+		if (!profiles) return false;
+		memset(profiles + trace->profile_count, 0, (count - trace->profile_count) * sizeof(sketchup_room_profile));
+		trace->profiles = profiles;
+		trace->profile_count = count;
+	}
+	trace->profiles[room_index] = *profile;
+	return true;
+}
+
+bool trace_set_edges(trace_buffer *trace, const trace_edge *edges, size_t count) {
+	trace_edge *copy = NULL;
+	if (count) {
+		copy = (trace_edge *)malloc(count * sizeof(trace_edge));
+		if (!copy) return false;
+		memcpy(copy, edges, count * sizeof(trace_edge));
+	}
+	free(trace->edges);
+	trace->edges = copy;
+	trace->edge_count = count;
+	return true;
+}
+
+// Roads are as wide as their share of the calls of the busiest road, recursion has none
+static bool trace_replay_edges(const trace_buffer *trace, sketchup_town town, size_t room_base) {
+	uint64_t busiest = 0;
+	for (size_t i = 0; i < trace->edge_count; i++) {
+		if (trace->edges[i].caller != trace->edges[i].callee && trace->edges[i].calls > busiest) {
+			busiest = trace->edges[i].calls;
+		}
+	}
+	bool ok = true;
+	for (size_t i = 0; i < trace->edge_count; i++) {
+		const trace_edge *edge = &trace->edges[i];
+		if (edge->caller == edge->callee) continue;
+		sketchup_road road = {
+			.calls = edge->calls,
+			.inclusive_ns = edge->inclusive_ns,
+			.width = busiest ? (double) edge->calls / (double) busiest : 0.0,
+		};
+		ok &= sketchup_town_append_road(town, room_base + edge->caller, room_base + edge->callee, &road);
+	}
+	return ok;
+}
+
+bool trace_set_label(trace_buffer *trace, const char *label, size_t len) {
+	uint32_t id;
+	if (!trace_intern(trace, label, len, &id)) return false;
+	trace_event event = {
+		.type = TRACE_LABEL,
+		.name_id = id,
+	};
+	if (!trace_append(trace, &event)) return false;
+	trace->has_label = true;
+	trace->label_id = id;
+	return true;
+}
+
+// Rooms are compared by exclusive time, or by calls when nothing was timed, e.g. in an aggregate
+static uint64_t trace_profile_weight(const sketchup_room_profile *profile, bool timed) {
+	return timed ? profile->exclusive_ns : profile->calls;
+}
+
+static bool trace_replay_profiles(const trace_buffer *trace, sketchup_town town, size_t room_base) {
+	bool timed = false;
+	for (size_t i = 0; i < trace->profile_count && !timed; i++) {
+		timed = trace->profiles[i].exclusive_ns != 0;
+	}
+	uint64_t hottest = 0;
+	for (size_t i = 0; i < trace->profile_count; i++) {
+		uint64_t weight = trace_profile_weight(&trace->profiles[i], timed);
+		if (weight > hottest) {
+			hottest = weight;
+		}
+	}
+
+	bool ok = true;
+	for (size_t i = 0; i < trace->profile_count; i++) {
+		sketchup_room_profile profile = trace->profiles[i];
+		if (!profile.calls && !profile.samples) continue;
+		profile.heat = hottest ? (double) trace_profile_weight(&profile, timed) / (double) hottest : 0.0;
+		ok &= sketchup_room_set_profile(town, room_base + i, &profile);
+	}
+	return ok;
+}
+
+// The last recorded value of every variable of every room, which the TRACE_VAR_SAME events of delta
+// snapshots refer to. Open addressing on room and variable.
+typedef struct trace_var_memo_slot_s {
+	uint64_t key;       // (room << 32 | var) + 1, 0 is empty
+	uint32_t name_id;
+	uint32_t shape_id;  // + 1, 0 without a deep capture
+	uint8_t val_type;
+} trace_var_memo_slot;
+
+typedef struct trace_var_memo_s {
+	trace_var_memo_slot *slots;
+	size_t count;
+	size_t cap;
+} trace_var_memo;
+
+static uint64_t trace_var_memo_key(uint32_t room_index, uint32_t var_index) {
+	return ((uint64_t) room_index << 32 | var_index) + 1;
+}
+
+static size_t trace_var_memo_slot_of(const trace_var_memo *memo, uint64_t key) {
+	size_t mask = memo->cap - 1;
+	size_t slot = (size_t) ((key * 11400714819323198485ULL) >> 32) & mask;
+	while (memo->slots[slot].key && memo->slots[slot].key != key) slot = (slot + 1) & mask;
+	return slot;
+}
+
+static trace_var_memo_slot *trace_var_memo_find(const trace_var_memo *memo, uint32_t room_index, uint32_t var_index) {
+	if (!memo->cap) return NULL;
+	trace_var_memo_slot *found = &memo->slots[trace_var_memo_slot_of(memo, trace_var_memo_key(room_index, var_index))];
+	return found->key ? found : NULL;
+}
+
+static bool trace_var_memo_set(trace_var_memo *memo, uint32_t room_index, uint32_t var_index, const trace_var_memo_slot *val) {
+	if ((memo->count + 1) * 2 > memo->cap) {
+		size_t cap = memo->cap ? memo->cap * 2 : 256;
+		trace_var_memo grown = {(trace_var_memo_slot *)calloc(cap, sizeof(trace_var_memo_slot)), memo->count, cap};
+		if (!grown.slots) return false;
+		for (size_t i = 0; i < memo->cap; i++) {
+			if (memo->slots[i].key) {
+				grown.slots[trace_var_memo_slot_of(&grown, memo->slots[i].key)] = memo->slots[i];
+			}
+		}
+		free(memo->slots);
+		*memo = grown;
+	}
+	uint64_t key = trace_var_memo_key(room_index, var_index);
+	trace_var_memo_slot *slot = &memo->slots[trace_var_memo_slot_of(memo, key)];
+	if (!slot->key) memo->count++;
+	*slot = *val;
+	slot->key = key;
+	return true;
+}
+
+// Only traces recorded with php_3d.delta_snapshots refer to earlier values
+static bool trace_has_var_refs(const trace_buffer *trace) {
+	for (const trace_chunk *chunk = trace->head; chunk; chunk = chunk->next) {
+		for (size_t i = 0; i < chunk->count; i++) {
+			if (chunk->events[i].type == TRACE_VAR_SAME) return true;
+		}
+	}
+	return false;
+}
+
+static void trace_val_shape(const trace_buffer *trace, const trace_shape *captured, sketchup_val_shape *shape, sketchup_val_child *children) {
+	shape->count = captured->count;
+	shape->bytes = captured->bytes;
+	shape->depth = captured->depth;
+	shape->flags = captured->flags;
+	shape->child_count = captured->child_count;
+	for (uint32_t c = 0; c < captured->child_count; c++) {
+		const trace_shape_child *child = &trace->shape_children[captured->child_offset + c];
+		children[c].key = trace_string_get(trace, child->name_id);
+		children[c].type = (enum sketchup_val_type) child->val_type;
+	}
+	shape->children = children;
+}
+
+// Appends the rooms of the trace numbered from room_base on, 0 unless the town is merged
+static bool trace_replay_at(const trace_buffer *trace, sketchup_town town, size_t room_base) {
+	bool ok = true;
+	// The shape of the next variable, if it was captured deeply
+	const trace_shape *pending = NULL;
+	sketchup_val_shape shape = {0};
+	sketchup_val_child children[TRACE_SHAPE_MAX_CHILDREN];
+	trace_var_memo memo = {0};
+	bool memoize = trace_has_var_refs(trace);
+	for (const trace_chunk *chunk = trace->head; chunk; chunk = chunk->next) {
+		for (size_t i = 0; i < chunk->count; i++) {
+			const trace_event *event = &chunk->events[i];
+			switch (event->type) {
+				case TRACE_ROOM_ENTER: {
+					uint32_t name_id = (event->room_index == 0 && trace->has_label) ? trace->label_id : event->name_id;
+					ok &= sketchup_town_append_room(town, trace_string_get(trace, name_id), room_base + event->room_index, event->visit_index);
+					break;
+				}
+				case TRACE_SHAPE:
+					pending = event->var_index < trace->shape_count ? &trace->shapes[event->var_index] : NULL;
+					break;
+				case TRACE_VAR: {
+					sketchup_val val = SKETCHUP_NULL;
+					val.type = (enum sketchup_val_type) event->val_type;
+					if (memoize) {
+						trace_var_memo_slot last = {
+							.name_id = event->name_id,
+							.shape_id = pending ? (uint32_t) (pending - trace->shapes) + 1 : 0,
+							.val_type = event->val_type,
+						};
+						ok &= trace_var_memo_set(&memo, event->room_index, event->var_index, &last);
+					}
+					if (pending) {
+						trace_val_shape(trace, pending, &shape, children);
+						val.shape = &shape;
+						pending = NULL;
+					}
+					ok &= sketchup_room_append_variable(town, room_base + event->room_index, event->visit_index, event->var_index, trace_string_get(trace, event->name_id), val);
+					break;
+				}
+				case TRACE_VAR_SAME: {
+					// Inherits the value of the room's previous floors
+					const trace_var_memo_slot *last = trace_var_memo_find(&memo, event->room_index, event->var_index);
+					if (!last) break;
+					sketchup_val val = SKETCHUP_NULL;
+					val.type = (enum sketchup_val_type) last->val_type;
+					if (last->shape_id) {
+						trace_val_shape(trace, &trace->shapes[last->shape_id - 1], &shape, children);
+						val.shape = &shape;
+					}
+					ok &= sketchup_room_append_variable(town, room_base + event->room_index, event->visit_index, event->var_index, trace_string_get(trace, last->name_id), val);
+					break;
+				}
+				case TRACE_ROOM_EXIT:
+				default:
+					break;
+			}
+		}
+	}
+	free(memo.slots);
+	// Summary floors go on top of the last recorded visit, and the heat towers on top of them
+	ok = trace_replay_summaries(trace, town, room_base) && ok;
+	ok = trace_replay_profiles(trace, town, room_base) && ok;
+	return trace_replay_edges(trace, town, room_base) && ok;
+}
+
+bool trace_replay(const trace_buffer *trace, sketchup_town town) {
+	return trace_replay_at(trace, town, 0);
+}
+
+size_t trace_room_count(const trace_buffer *trace) {
+	size_t count = 0;
+	// The profiles are allocated in steps, only the rooms that have one count
+	for (size_t i = 0; i < trace->profile_count; i++) {
+		if (trace->profiles[i].calls || trace->profiles[i].samples) {
+			count = i + 1;
+		}
+	}
+	for (const trace_chunk *chunk = trace->head; chunk; chunk = chunk->next) {
+		for (size_t i = 0; i < chunk->count; i++) {
+			if (chunk->events[i].type == TRACE_ROOM_ENTER && chunk->events[i].room_index >= count) {
+				count = (size_t) chunk->events[i].room_index + 1;
+			}
+		}
+	}
+	for (size_t i = 0; i < trace->summary_count; i++) {
+		if (trace->summaries[i].room_index >= count) {
+			count = (size_t) trace->summaries[i].room_index + 1;
+		}
+	}
+	for (size_t i = 0; i < trace->edge_count; i++) {
+		const trace_edge *edge = &trace->edges[i];
+		size_t last = edge->caller > edge->callee ? edge->caller : edge->callee;
+		if (last >= count) {
+			count = last + 1;
+		}
+	}
+	return count;
+}
+
+bool trace_render_districts(const trace_buffer *const *traces, size_t count, const sketchup_backend *backend, const char *file) {
+	sketchup_district *districts = (sketchup_district *)calloc(count ? count : 1, sizeof(sketchup_district));
+	if (!districts) return false;
+	// Room 0 of the merged town is its own town center, the districts are numbered after it
+	size_t room_base = 1;
+	for (size_t i = 0; i < count; i++) {
+		districts[i].room_base = room_base;
+		districts[i].room_count = trace_room_count(traces[i]);
+		room_base += districts[i].room_count;
+	}
+
+	sketchup_town town = SKETCHUP_NULL;
+	if (!sketchup_town_ctor(&town, backend)) {
+		free(districts);
+		return false;
+	}
+	char name[64];
+	snprintf(name, sizeof(name), "%zu districts", count);
+	bool ok = sketchup_town_set_districts(town, districts, count);
+	ok = ok && sketchup_town_append_room(town, name, 0, 0);
+	for (size_t i = 0; ok && i < count; i++) {
+		ok = trace_replay_at(traces[i], town, districts[i].room_base);
+	}
+	ok = sketchup_town_save(town, file) && ok;
+	ok = sketchup_town_dtor(town) && ok;
+	free(districts);
+	return ok;
+}
+
+bool trace_render(const trace_buffer *trace, const sketchup_backend *backend, const char *file) {
+	sketchup_town town = SKETCHUP_NULL;
+	if (!sketchup_town_ctor(&town, backend)) return false;
+	bool ok = trace_replay(trace, town);
+	ok = sketchup_town_save(town, file) && ok;
+	ok = sketchup_town_dtor(town) && ok;
+	return ok;
+}
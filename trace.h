@@ -0,0 +1,233 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "sketchup.h"
+
+// A trace is the "runtime movie" of a request: an append-only list of fixed-size events that the
+// observer records while PHP is running. The town is built from it in one pass once the request is over.
+enum trace_event_type {
+    TRACE_ROOM_ENTER = 1,
+    TRACE_ROOM_EXIT,
+    TRACE_VAR,
+    TRACE_SHAPE,        // var_index is a shape id, it belongs to the TRACE_VAR that follows
+    TRACE_LABEL,        // name_id names the town center from here on
+    TRACE_VAR_SAME,     // The variable var_index of the room still has the value it was last recorded with
+};
+
+typedef struct trace_event_s {
+    uint8_t type;       // enum trace_event_type
+    uint8_t val_type;   // enum sketchup_val_type for TRACE_VAR
+    uint16_t reserved;
+    uint32_t name_id;   // Room name for TRACE_ROOM_ENTER, variable name for TRACE_VAR
+    uint32_t room_index;
+    uint32_t visit_index;
+    uint32_t var_index;
+} trace_event;
+
+typedef struct trace_string_s {
+    char *val;
+    size_t len;
+} trace_string;
+
+typedef struct trace_shape_s {
+    uint64_t count;
+    uint64_t bytes;
+    uint32_t depth;
+    uint32_t flags;     // SKETCHUP_SHAPE_*
+    uint32_t child_offset;
+    uint32_t child_count;
+} trace_shape;
+
+typedef struct trace_shape_child_s {
+    uint32_t name_id;
+    uint32_t val_type;
+} trace_shape_child;
+
+#define TRACE_SHAPE_MAX_CHILDREN 64
+
+// The visits of a room past the floor cap
+typedef struct trace_summary_s {
+    uint32_t room_index;
+    uint32_t visit_index;
+    uint64_t calls;
+    uint32_t var_offset;
+    uint32_t var_count;
+} trace_summary;
+
+typedef struct trace_var_summary_s {
+    uint32_t name_id;
+    uint64_t types[SKETCHUP_VAL_TYPE_COUNT];
+    bool has_range;
+    double min;
+    double max;
+} trace_var_summary;
+
+// How often one room called another, and how long those calls took when they were timed
+typedef struct trace_edge_s {
+    uint32_t caller;    // Room index
+    uint32_t callee;
+    uint64_t calls;
+    uint64_t inclusive_ns;
+} trace_edge;
+
+#define TRACE_CHUNK_EVENTS 4096
+
+typedef struct trace_chunk_s {
+    struct trace_chunk_s *next;
+    size_t count;
+    trace_event events[TRACE_CHUNK_EVENTS];
+} trace_chunk;
+
+typedef struct trace_buffer_s {
+    trace_chunk *head;
+    trace_chunk *tail;
+    size_t event_count;
+    // Set by the last TRACE_LABEL event
+    bool has_label;
+    uint32_t label_id;
+    // Interned names; an event only refers to them by id
+    trace_string *strings;
+    size_t string_count;
+    size_t string_cap;
+    uint32_t *string_hash; // Open addressing: id + 1, 0 is empty
+    size_t string_hash_cap;
+    // Indexed by room, only filled in when the request was profiled
+    sketchup_room_profile *profiles;
+    size_t profile_count;
+    // Deep captures, only filled in with php_3d.deep_capture
+    trace_shape *shapes;
+    size_t shape_count;
+    size_t shape_cap;
+    trace_shape_child *shape_children;
+    size_t shape_child_count;
+    size_t shape_child_cap;
+    // Only filled in when php_3d.max_floors capped a room
+    trace_summary *summaries;
+    size_t summary_count;
+    size_t summary_cap;
+    trace_var_summary *var_summaries;
+    size_t var_summary_count;
+    size_t var_summary_cap;
+    // Only filled in with php_3d.call_graph
+    trace_edge *edges;
+    size_t edge_count;
+} trace_buffer;
+
+trace_buffer *trace_ctor(void);
+void trace_dtor(trace_buffer *trace);
+
+// Returns the id of the name, adding it to the string table if it is new
+bool trace_intern(trace_buffer *trace, const char *str, size_t len, uint32_t *id);
+const char *trace_string_get(const trace_buffer *trace, uint32_t id);
+
+// At most TRACE_SHAPE_MAX_CHILDREN children are kept
+bool trace_add_shape(trace_buffer *trace, const trace_shape *shape, const trace_shape_child *children, uint32_t *id);
+
+bool trace_add_summary(trace_buffer *trace, const trace_summary *summary, const trace_var_summary *vars);
+
+bool trace_set_profile(trace_buffer *trace, uint32_t room_index, const sketchup_room_profile *profile);
+
+// Replaces the call graph of the trace
+bool trace_set_edges(trace_buffer *trace, const trace_edge *edges, size_t count);
+
+// Names the town center, i.e. room 0, instead of its function
+bool trace_set_label(trace_buffer *trace, const char *label, size_t len);
+
+bool trace_append_slow(trace_buffer *trace, const trace_event *event);
+
+static inline bool trace_append(trace_buffer *trace, const trace_event *event) {
+    trace_chunk *chunk = trace->tail;
+    if (chunk && chunk->count < TRACE_CHUNK_EVENTS) {
+        chunk->events[chunk->count++] = *event;
+        trace->event_count++;
+        return true;
+    }
+    return trace_append_slow(trace, event);
+}
+
+// Builds the town from the recorded events
+bool trace_replay(const trace_buffer *trace, sketchup_town town);
+// Builds a town with the given backend and saves it to file
+bool trace_render(const trace_buffer *trace, const sketchup_backend *backend, const char *file);
+// Builds one town out of several traces, each one a district of its own, and saves it to file
+bool trace_render_districts(const trace_buffer *const *traces, size_t count, const sketchup_backend *backend, const char *file);
+// One more than the highest room index of the trace
+size_t trace_room_count(const trace_buffer *trace);
+
+// Writes the trace to a file that tools/render.c turns into a town later, possibly on another machine.
+// Names are only stored once in a string table and the events are split into blocks of columns:
+// type, value type, name, room, visit and variable, the integers as varints and room and visit as
+// deltas to the previous event. A block can be zlib compressed when the extension was built with zlib.
+#define TRACE_FILE_MAGIC 0x54443350 // "P3DT"
+#define TRACE_FILE_VERSION 4
+
+// level is the zlib level of the event blocks, 0 stores them uncompressed
+bool trace_save(const trace_buffer *trace, const char *file, int level);
+// Returns NULL if the file is missing, truncated or of another version
+trace_buffer *trace_load(const char *file);
+
+// A trace file mapped read-only. Strings and side tables point into the map, and events are decoded
+// straight from it, so scanning many files allocates nothing but the map.
+typedef struct trace_file_s {
+    const uint8_t *map;
+    size_t map_size;
+    uint64_t string_count;
+    const uint32_t *string_offsets; // string_count + 1 offsets into strings
+    const char *strings;            // NUL terminated
+    uint64_t event_count;
+    uint64_t block_count;
+    const sketchup_room_profile *profiles;
+    uint64_t profile_count;
+    const trace_shape *shapes;
+    uint64_t shape_count;
+    const trace_shape_child *shape_children;
+    uint64_t shape_child_count;
+    const trace_summary *summaries;
+    uint64_t summary_count;
+    const trace_var_summary *var_summaries;
+    uint64_t var_summary_count;
+    const trace_edge *edges;
+    uint64_t edge_count;
+    const uint8_t *blocks;
+} trace_file;
+
+enum trace_column {
+    TRACE_COLUMN_TYPE = 0,
+    TRACE_COLUMN_VAL_TYPE,
+    TRACE_COLUMN_NAME,
+    TRACE_COLUMN_ROOM,
+    TRACE_COLUMN_VISIT,
+    TRACE_COLUMN_VAR,
+    TRACE_COLUMN_COUNT,
+};
+
+typedef struct trace_cursor_s {
+    const trace_file *file;
+    const uint8_t *next_block;
+    uint64_t blocks_left;
+    uint32_t remaining;     // Events left in the current block
+    const uint8_t *columns[TRACE_COLUMN_COUNT];
+    const uint8_t *column_ends[TRACE_COLUMN_COUNT];
+    uint32_t room_index;    // Delta bases, reset at every block
+    uint32_t visit_index;
+    // Only allocated once a compressed block is met
+    uint8_t *scratch;
+    size_t scratch_cap;
+    bool failed;
+} trace_cursor;
+
+// Returns false if the file is missing, truncated or of another version
+bool trace_file_open(trace_file *tf, const char *file);
+void trace_file_close(trace_file *tf);
+const char *trace_file_string(const trace_file *tf, uint32_t id);
+
+void trace_cursor_init(trace_cursor *cursor, const trace_file *tf);
+// Returns false after the last event, and when a block is corrupt, in which case cursor->failed is set
+bool trace_cursor_next(trace_cursor *cursor, trace_event *event);
+void trace_cursor_free(trace_cursor *cursor);
+
+#endif	/* TRACE_H */
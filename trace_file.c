@@ -0,0 +1,491 @@
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "trace.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_3D_ZLIB
+# include <zlib.h>
+#endif
+
+// File layout, in host byte order, every section 8 byte aligned so that the side tables can be
+// used straight from the map:
+//   trace_file_header
+//   uint32_t string_offsets[string_count + 1]
+//   char strings[string_bytes]             NUL terminated, in id order
+//   sketchup_room_profile profiles[profile_count]
+//   trace_shape shapes[shape_count]
+//   trace_shape_child shape_children[shape_child_count]
+//   trace_summary summaries[summary_count]
+//   trace_var_summary var_summaries[var_summary_count]
+//   trace_edge edges[edge_count]
+//   block_count times: trace_file_block, then its columns, back to back and maybe compressed
+typedef struct trace_file_header_s {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t string_count;
+	uint64_t string_bytes;
+	uint64_t event_count;
+	uint64_t block_count;
+	uint64_t profile_count;
+	uint64_t shape_count;
+	uint64_t shape_child_count;
+	uint64_t summary_count;
+	uint64_t var_summary_count;
+	uint64_t edge_count;
+} trace_file_header;
+
+#define TRACE_BLOCK_ZLIB (1 << 0)
+
+typedef struct trace_file_block_s {
+	uint32_t event_count;
+	uint32_t flags;
+	uint32_t raw_size;      // Of the columns
+	uint32_t stored_size;   // Of the columns as they follow, raw_size unless compressed
+	uint32_t column_sizes[TRACE_COLUMN_COUNT];
+} trace_file_block;
+
+#define TRACE_FILE_ALIGN(size) (((size) + 7) & ~((uint64_t) 7))
+// A varint of a uint32_t takes at most 5 bytes
+#define TRACE_VARINT_MAX 5
+#define TRACE_BLOCK_MAX_RAW (TRACE_CHUNK_EVENTS * (2 + 4 * TRACE_VARINT_MAX))
+
+static inline size_t trace_varint_put(uint8_t *out, uint32_t val) {
+	size_t len = 0;
+	while (val >= 0x80) {
+		out[len++] = (uint8_t) (val | 0x80);
+		val >>= 7;
+	}
+	out[len++] = (uint8_t) val;
+	return len;
+}
+
+static inline bool trace_varint_get(const uint8_t **in, const uint8_t *end, uint32_t *val) {
+	uint32_t result = 0;
+	for (unsigned shift = 0; shift < 7 * TRACE_VARINT_MAX && *in < end; shift += 7) {
+		uint8_t byte = *(*in)++;
+		result |= (uint32_t) (byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*val = result;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Deltas of rooms and visits are mostly small in either direction
+static inline uint32_t trace_zigzag(uint32_t from, uint32_t to) {
+	int32_t delta = (int32_t) (to - from);
+	return ((uint32_t) delta << 1) ^ (uint32_t) (delta >> 31);
+}
+
+static inline uint32_t trace_unzigzag(uint32_t from, uint32_t zigzag) {
+	return from + ((zigzag >> 1) ^ -(zigzag & 1));
+}
+
+// Pads a section of size bytes to the alignment
+static bool trace_file_pad(FILE *out, uint64_t size) {
+	static const uint8_t padding[8] = {0};
+	size_t pad = TRACE_FILE_ALIGN(size) - size;
+	return !pad || fwrite(padding, 1, pad, out) == pad;
+}
+
+static bool trace_file_write(FILE *out, const void *data, uint64_t size) {
+	if (size && fwrite(data, 1, size, out) != size) return false;
+	return trace_file_pad(out, size);
+}
+
+typedef struct trace_encoder_s {
+	uint8_t *columns[TRACE_COLUMN_COUNT];
+	uint8_t *raw;
+	uint8_t *compressed;
+	size_t compressed_cap;
+} trace_encoder;
+
+static void trace_encoder_free(trace_encoder *enc) {
+	for (int c = 0; c < TRACE_COLUMN_COUNT; c++) {
+		free(enc->columns[c]);
+	}
+	free(enc->raw);
+	free(enc->compressed);
+}
+
+static bool trace_encoder_init(trace_encoder *enc, int level) {
+	memset(enc, 0, sizeof(trace_encoder));
+	bool ok = true;
+	for (int c = 0; c < TRACE_COLUMN_COUNT; c++) {
+		ok = ok && (enc->columns[c] = (uint8_t *)malloc(TRACE_CHUNK_EVENTS * TRACE_VARINT_MAX));
+	}
+	ok = ok && (enc->raw = (uint8_t *)malloc(TRACE_BLOCK_MAX_RAW));
+#ifdef HAVE_3D_ZLIB
+	if (ok && level > 0) {
+		enc->compressed_cap = compressBound(TRACE_BLOCK_MAX_RAW);
+		ok = (enc->compressed = (uint8_t *)malloc(enc->compressed_cap));
+	}
+#else
+	(void) level;
+#endif
+	if (!ok) trace_encoder_free(enc);
+	return ok;
+}
+
+static bool trace_file_write_block(FILE *out, trace_encoder *enc, const trace_chunk *chunk, int level) {
+	trace_file_block block = {.event_count = (uint32_t) chunk->count};
+	size_t sizes[TRACE_COLUMN_COUNT] = {0};
+	uint32_t room_index = 0, visit_index = 0;
+	for (size_t i = 0; i < chunk->count; i++) {
+		const trace_event *event = &chunk->events[i];
+		enc->columns[TRACE_COLUMN_TYPE][sizes[TRACE_COLUMN_TYPE]++] = event->type;
+		enc->columns[TRACE_COLUMN_VAL_TYPE][sizes[TRACE_COLUMN_VAL_TYPE]++] = event->val_type;
+		sizes[TRACE_COLUMN_NAME] += trace_varint_put(enc->columns[TRACE_COLUMN_NAME] + sizes[TRACE_COLUMN_NAME], event->name_id);
+		sizes[TRACE_COLUMN_ROOM] += trace_varint_put(enc->columns[TRACE_COLUMN_ROOM] + sizes[TRACE_COLUMN_ROOM], trace_zigzag(room_index, event->room_index));
+		sizes[TRACE_COLUMN_VISIT] += trace_varint_put(enc->columns[TRACE_COLUMN_VISIT] + sizes[TRACE_COLUMN_VISIT], trace_zigzag(visit_index, event->visit_index));
+		sizes[TRACE_COLUMN_VAR] += trace_varint_put(enc->columns[TRACE_COLUMN_VAR] + sizes[TRACE_COLUMN_VAR], event->var_index);
+		room_index = event->room_index;
+		visit_index = event->visit_index;
+	}
+	for (int c = 0; c < TRACE_COLUMN_COUNT; c++) {
+		memcpy(enc->raw + block.raw_size, enc->columns[c], sizes[c]);
+		block.column_sizes[c] = (uint32_t) sizes[c];
+		block.raw_size += (uint32_t) sizes[c];
+	}
+
+	const uint8_t *stored = enc->raw;
+	block.stored_size = block.raw_size;
+#ifdef HAVE_3D_ZLIB
+	uLongf compressed_size = enc->compressed_cap;
+	// Blocks that do not shrink are stored as they are
+	if (level > 0 && compress2(enc->compressed, &compressed_size, enc->raw, block.raw_size, level) == Z_OK && compressed_size < block.raw_size) {
+		stored = enc->compressed;
+		block.stored_size = (uint32_t) compressed_size;
+		block.flags |= TRACE_BLOCK_ZLIB;
+	}
+#else
+	(void) level;
+#endif
+	return trace_file_write(out, &block, sizeof(block)) && trace_file_write(out, stored, block.stored_size);
+}
+
+bool trace_save(const trace_buffer *trace, const char *file, int level) {
+	trace_file_header header = {
+		.magic = TRACE_FILE_MAGIC,
+		.version = TRACE_FILE_VERSION,
+		.string_count = trace->string_count,
+		.event_count = trace->event_count,
+		.profile_count = trace->profile_count,
+		.shape_count = trace->shape_count,
+		.shape_child_count = trace->shape_child_count,
+		.summary_count = trace->summary_count,
+		.var_summary_count = trace->var_summary_count,
+		.edge_count = trace->edge_count,
+	};
+	for (const trace_chunk *chunk = trace->head; chunk; chunk = chunk->next) {
+		header.block_count++;
+	}
+	uint32_t *offsets = (uint32_t *)malloc((trace->string_count + 1) * sizeof(uint32_t));
+	if (!offsets) return false;
+	for (size_t i = 0; i < trace->string_count; i++) {
+		offsets[i] = (uint32_t) header.string_bytes;
+		header.string_bytes += trace->strings[i].len + 1;
+	}
+	offsets[trace->string_count] = (uint32_t) header.string_bytes;
+	trace_encoder enc;
+	if (header.string_bytes > UINT32_MAX || !trace_encoder_init(&enc, level)) {
+		free(offsets);
+		return false;
+	}
+
+	FILE *out = fopen(file, "wb");
+	if (!out) {
+		free(offsets);
+		trace_encoder_free(&enc);
+		return false;
+	}
+	bool ok = trace_file_write(out, &header, sizeof(header))
+		&& trace_file_write(out, offsets, (trace->string_count + 1) * sizeof(uint32_t));
+	// The string bytes are one section, only padded at its end
+	for (size_t i = 0; ok && i < trace->string_count; i++) {
+		ok = fwrite(trace->strings[i].val, 1, trace->strings[i].len + 1, out) == trace->strings[i].len + 1;
+	}
+	ok = ok
+		&& trace_file_pad(out, header.string_bytes)
+		&& trace_file_write(out, trace->profiles, trace->profile_count * sizeof(sketchup_room_profile))
+		&& trace_file_write(out, trace->shapes, trace->shape_count * sizeof(trace_shape))
+		&& trace_file_write(out, trace->shape_children, trace->shape_child_count * sizeof(trace_shape_child))
+		&& trace_file_write(out, trace->summaries, trace->summary_count * sizeof(trace_summary))
+		&& trace_file_write(out, trace->var_summaries, trace->var_summary_count * sizeof(trace_var_summary))
+		&& trace_file_write(out, trace->edges, trace->edge_count * sizeof(trace_edge));
+	for (const trace_chunk *chunk = trace->head; ok && chunk; chunk = chunk->next) {
+		ok = trace_file_write_block(out, &enc, chunk, level);
+	}
+	free(offsets);
+	trace_encoder_free(&enc);
+	return (fclose(out) == 0) && ok;
+}
+
+// Points *ptr at the next section of count elements, if it fits into the map
+static bool trace_file_section(const trace_file *tf, uint64_t *offset, uint64_t count, size_t size, const void **ptr) {
+	if (count > (tf->map_size - *offset) / size) return false;
+	*ptr = tf->map + *offset;
+	*offset += TRACE_FILE_ALIGN(count * size);
+	return *offset <= tf->map_size;
+}
+
+// Every id and offset of the side tables must stay within the tables, they are used without checking
+static bool trace_file_validate(const trace_file *tf) {
+	uint32_t string_bytes = tf->string_offsets[tf->string_count];
+	if (tf->string_offsets[0] != 0) return false;
+	for (uint64_t i = 0; i < tf->string_count; i++) {
+		uint32_t end = tf->string_offsets[i + 1];
+		if (end <= tf->string_offsets[i] || end > string_bytes || tf->strings[end - 1] != '\0') return false;
+	}
+	for (uint64_t i = 0; i < tf->shape_count; i++) {
+		const trace_shape *shape = &tf->shapes[i];
+		if (shape->child_count > TRACE_SHAPE_MAX_CHILDREN) return false;
+		if ((uint64_t) shape->child_offset + shape->child_count > tf->shape_child_count) return false;
+	}
+	for (uint64_t i = 0; i < tf->shape_child_count; i++) {
+		if (tf->shape_children[i].val_type >= SKETCHUP_VAL_TYPE_COUNT) return false;
+	}
+	for (uint64_t i = 0; i < tf->summary_count; i++) {
+		const trace_summary *summary = &tf->summaries[i];
+		if ((uint64_t) summary->var_offset + summary->var_count > tf->var_summary_count) return false;
+	}
+	for (uint64_t i = 0; i < tf->var_summary_count; i++) {
+		uint8_t has_range;
+		memcpy(&has_range, &tf->var_summaries[i].has_range, 1);
+		if (has_range > 1) return false;
+	}
+	return true;
+}
+
+bool trace_file_open(trace_file *tf, const char *file) {
+	memset(tf, 0, sizeof(trace_file));
+	int fd = open(file, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(trace_file_header)) {
+		close(fd);
+		return false;
+	}
+	void *map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return false;
+	tf->map = (const uint8_t *)map;
+	tf->map_size = (size_t) st.st_size;
+
+	const trace_file_header *h = (const trace_file_header *)map;
+	uint64_t offset = sizeof(trace_file_header);
+	bool ok = h->magic == TRACE_FILE_MAGIC
+		&& h->version == TRACE_FILE_VERSION
+		&& h->string_count < UINT32_MAX
+		&& trace_file_section(tf, &offset, h->string_count + 1, sizeof(uint32_t), (const void **) &tf->string_offsets)
+		&& tf->string_offsets[h->string_count] == h->string_bytes
+		&& trace_file_section(tf, &offset, h->string_bytes, 1, (const void **) &tf->strings)
+		&& trace_file_section(tf, &offset, h->profile_count, sizeof(sketchup_room_profile), (const void **) &tf->profiles)
+		&& trace_file_section(tf, &offset, h->shape_count, sizeof(trace_shape), (const void **) &tf->shapes)
+		&& trace_file_section(tf, &offset, h->shape_child_count, sizeof(trace_shape_child), (const void **) &tf->shape_children)
+		&& trace_file_section(tf, &offset, h->summary_count, sizeof(trace_summary), (const void **) &tf->summaries)
+		&& trace_file_section(tf, &offset, h->var_summary_count, sizeof(trace_var_summary), (const void **) &tf->var_summaries)
+		&& trace_file_section(tf, &offset, h->edge_count, sizeof(trace_edge), (const void **) &tf->edges);
+	if (ok) {
+		tf->string_count = h->string_count;
+		tf->event_count = h->event_count;
+		tf->block_count = h->block_count;
+		tf->profile_count = h->profile_count;
+		tf->shape_count = h->shape_count;
+		tf->shape_child_count = h->shape_child_count;
+		tf->summary_count = h->summary_count;
+		tf->var_summary_count = h->var_summary_count;
+		tf->edge_count = h->edge_count;
+		tf->blocks = tf->map + offset;
+		ok = trace_file_validate(tf);
+	}
+	if (!ok) {
+		trace_file_close(tf);
+		return false;
+	}
+	return true;
+}
+
+void trace_file_close(trace_file *tf) {
+	if (tf->map) {
+		munmap((void *) tf->map, tf->map_size);
+	}
+	memset(tf, 0, sizeof(trace_file));
+}
+
+const char *trace_file_string(const trace_file *tf, uint32_t id) {
+	return (id < tf->string_count) ? tf->strings + tf->string_offsets[id] : "";
+}
+
+void trace_cursor_init(trace_cursor *cursor, const trace_file *tf) {
+	memset(cursor, 0, sizeof(trace_cursor));
+	cursor->file = tf;
+	cursor->next_block = tf->blocks;
+	cursor->blocks_left = tf->block_count;
+}
+
+void trace_cursor_free(trace_cursor *cursor) {
+	free(cursor->scratch);
+	cursor->scratch = NULL;
+	cursor->scratch_cap = 0;
+}
+
+static bool trace_cursor_block(trace_cursor *cursor) {
+	const uint8_t *end = cursor->file->map + cursor->file->map_size;
+	if ((size_t) (end - cursor->next_block) < sizeof(trace_file_block)) return false;
+	trace_file_block block;
+	memcpy(&block, cursor->next_block, sizeof(block));
+	const uint8_t *payload = cursor->next_block + sizeof(block);
+	if (block.stored_size > (size_t) (end - payload) || block.raw_size > TRACE_BLOCK_MAX_RAW || block.event_count > TRACE_CHUNK_EVENTS) return false;
+	uint64_t columns_size = 0;
+	for (int c = 0; c < TRACE_COLUMN_COUNT; c++) {
+		columns_size += block.column_sizes[c];
+	}
+	if (columns_size != block.raw_size) return false;
+
+	const uint8_t *raw = payload;
+	if (block.flags & TRACE_BLOCK_ZLIB) {
+#ifdef HAVE_3D_ZLIB
+		if (cursor->scratch_cap < block.raw_size) {
+			uint8_t *scratch = (uint8_t *)realloc(cursor->scratch, TRACE_BLOCK_MAX_RAW);
+			if (!scratch) return false;
+			cursor->scratch = scratch;
+			cursor->scratch_cap = TRACE_BLOCK_MAX_RAW;
+		}
+		uLongf raw_size = block.raw_size;
+		if (uncompress(cursor->scratch, &raw_size, payload, block.stored_size) != Z_OK || raw_size != block.raw_size) return false;
+		raw = cursor->scratch;
+#else
+		return false;
+#endif
+	} else if (block.stored_size != block.raw_size) {
+		return false;
+	}
+
+	for (int c = 0; c < TRACE_COLUMN_COUNT; c++) {
+		cursor->columns[c] = raw;
+		raw += block.column_sizes[c];
+		cursor->column_ends[c] = raw;
+	}
+	cursor->remaining = block.event_count;
+	cursor->room_index = 0;
+	cursor->visit_index = 0;
+	cursor->blocks_left--;
+	size_t stored = (size_t) TRACE_FILE_ALIGN(block.stored_size);
+	cursor->next_block = (stored <= (size_t) (end - payload)) ? payload + stored : end;
+	return true;
+}
+
+bool trace_cursor_next(trace_cursor *cursor, trace_event *event) {
+	while (cursor->remaining == 0) {
+		if (cursor->failed || cursor->blocks_left == 0) return false;
+		if (!trace_cursor_block(cursor)) {
+			cursor->failed = true;
+			return false;
+		}
+	}
+
+	const uint8_t **col = cursor->columns;
+	const uint8_t *const *ends = cursor->column_ends;
+	uint32_t room_delta, visit_delta;
+	if (col[TRACE_COLUMN_TYPE] == ends[TRACE_COLUMN_TYPE] || col[TRACE_COLUMN_VAL_TYPE] == ends[TRACE_COLUMN_VAL_TYPE]
+			|| !trace_varint_get(&col[TRACE_COLUMN_NAME], ends[TRACE_COLUMN_NAME], &event->name_id)
+			|| !trace_varint_get(&col[TRACE_COLUMN_ROOM], ends[TRACE_COLUMN_ROOM], &room_delta)
+			|| !trace_varint_get(&col[TRACE_COLUMN_VISIT], ends[TRACE_COLUMN_VISIT], &visit_delta)
+			|| !trace_varint_get(&col[TRACE_COLUMN_VAR], ends[TRACE_COLUMN_VAR], &event->var_index)) {
+		cursor->failed = true;
+		cursor->remaining = 0;
+		return false;
+	}
+	event->type = *col[TRACE_COLUMN_TYPE]++;
+	event->val_type = *col[TRACE_COLUMN_VAL_TYPE]++;
+	event->reserved = 0;
+	event->room_index = cursor->room_index = trace_unzigzag(cursor->room_index, room_delta);
+	event->visit_index = cursor->visit_index = trace_unzigzag(cursor->visit_index, visit_delta);
+	cursor->remaining--;
+	return true;
+}
+
+// Copies a side table of the map into the trace, which owns and frees it
+static bool trace_load_table(void **dest, const void *src, uint64_t count, size_t size) {
+	*dest = NULL;
+	if (count == 0) return true;
+	*dest = malloc(count * size);
+	if (!*dest) return false;
+	memcpy(*dest, src, count * size);
+	return true;
+}
+
+trace_buffer *trace_load(const char *file) {
+	trace_file tf;
+	if (!trace_file_open(&tf, file)) return NULL;
+	trace_buffer *trace = trace_ctor();
+	if (!trace) {
+		trace_file_close(&tf);
+		return NULL;
+	}
+
+	bool ok = true;
+	for (uint64_t i = 0; ok && i < tf.string_count; i++) {
+		uint32_t id;
+		// Interning must hand out the ids in file order again
+		ok = trace_intern(trace, trace_file_string(&tf, (uint32_t) i), tf.string_offsets[i + 1] - tf.string_offsets[i] - 1, &id) && id == i;
+	}
+
+	// Rooms and visits are numbered densely, so they cannot outnumber the records of the file, which
+	// keeps a corrupt file from making the backend allocate for billions of rooms
+	uint64_t records = tf.event_count + tf.profile_count + tf.summary_count + tf.edge_count;
+	trace_cursor cursor;
+	trace_cursor_init(&cursor, &tf);
+	trace_event event;
+	while (ok && trace_cursor_next(&cursor, &event)) {
+		ok = event.room_index < records
+			&& event.visit_index < records
+			&& (event.type != TRACE_VAR || event.val_type < SKETCHUP_VAL_TYPE_COUNT)
+			&& trace_append(trace, &event);
+		if (ok && event.type == TRACE_LABEL) {
+			trace->has_label = true;
+			trace->label_id = event.name_id;
+		}
+	}
+	ok = ok && !cursor.failed && trace->event_count == tf.event_count;
+	trace_cursor_free(&cursor);
+	for (uint64_t i = 0; ok && i < tf.summary_count; i++) {
+		ok = tf.summaries[i].room_index < records;
+	}
+	for (uint64_t i = 0; ok && i < tf.edge_count; i++) {
+		ok = tf.edges[i].caller < records && tf.edges[i].callee < records;
+	}
+
+	if (ok) {
+		ok = trace_load_table((void **) &trace->profiles, tf.profiles, tf.profile_count, sizeof(sketchup_room_profile))
+			&& trace_load_table((void **) &trace->shapes, tf.shapes, tf.shape_count, sizeof(trace_shape))
+			&& trace_load_table((void **) &trace->shape_children, tf.shape_children, tf.shape_child_count, sizeof(trace_shape_child))
+			&& trace_load_table((void **) &trace->summaries, tf.summaries, tf.summary_count, sizeof(trace_summary))
+			&& trace_load_table((void **) &trace->var_summaries, tf.var_summaries, tf.var_summary_count, sizeof(trace_var_summary))
+			&& trace_load_table((void **) &trace->edges, tf.edges, tf.edge_count, sizeof(trace_edge));
+		// Whatever was allocated is freed by trace_dtor, also on failure
+		trace->profile_count = trace->profiles ? tf.profile_count : 0;
+		trace->shape_count = trace->shape_cap = trace->shapes ? tf.shape_count : 0;
+		trace->shape_child_count = trace->shape_child_cap = trace->shape_children ? tf.shape_child_count : 0;
+		trace->summary_count = trace->summary_cap = trace->summaries ? tf.summary_count : 0;
+		trace->var_summary_count = trace->var_summary_cap = trace->var_summaries ? tf.var_summary_count : 0;
+		trace->edge_count = trace->edges ? tf.edge_count : 0;
+	}
+	trace_file_close(&tf);
+
+	if (!ok) {
+		trace_dtor(trace);
+		return NULL;
+	}
+	return trace;
+}
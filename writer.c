@@ -0,0 +1,234 @@
+#include "writer.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Most traces merged into one town, so that a burst can't hold the writer up forever
+#define WRITER_MERGE_MAX 64
+
+typedef struct writer_job_s {
+	trace_buffer *trace;
+	char *file;
+} writer_job;
+
+typedef struct writer_s {
+	pid_t pid;
+	bool running;
+	bool stopping;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	// Ring buffer
+	writer_job *jobs;
+	size_t depth;
+	size_t head;
+	size_t count;
+	enum writer_policy policy;
+	const sketchup_backend *backend;
+	int compression;
+	uint64_t merge_window_ns;
+	writer_stats stats;
+} writer;
+
+static writer writer_instance;
+// Threads of a ZTS build may all enqueue the first trace of the process at once
+static pthread_mutex_t writer_start_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void writer_job_free(writer_job *job) {
+	trace_dtor(job->trace);
+	free(job->file);
+}
+
+// Without a backend the trace is saved as is, to be rendered later by tools/render.c
+static bool writer_write(const writer *w, const trace_buffer *trace, const char *file) {
+	return w->backend ? trace_render(trace, w->backend, file) : trace_save(trace, file, w->compression);
+}
+
+// Called with the lock held and a job in the queue
+static writer_job writer_pop(writer *w) {
+	writer_job job = w->jobs[w->head];
+	w->head = (w->head + 1) % w->depth;
+	w->count--;
+	pthread_cond_signal(&w->not_full);
+	return job;
+}
+
+// Called with the lock held. Adds the traces that are queued within the merge window after the
+// first one, e.g. by the other threads of a ZTS build.
+static size_t writer_collect(writer *w, writer_job *batch, size_t count) {
+	if (!w->merge_window_ns || !w->backend) return count;
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	uint64_t ns = (uint64_t) deadline.tv_nsec + w->merge_window_ns;
+	deadline.tv_sec += (time_t) (ns / 1000000000ULL);
+	deadline.tv_nsec = (long) (ns % 1000000000ULL);
+	while (count < WRITER_MERGE_MAX && !w->stopping) {
+		int err = 0;
+		while (w->count == 0 && !w->stopping && err != ETIMEDOUT) {
+			err = pthread_cond_timedwait(&w->not_empty, &w->lock, &deadline);
+		}
+		if (w->count == 0) break;
+		batch[count++] = writer_pop(w);
+	}
+	return count;
+}
+
+// The writer thread is the only one that ever calls into the backend, which is what keeps the
+// SketchUp API, its asset cache and the backend stats on a single thread in ZTS builds
+static void *writer_main(void *arg) {
+	writer *w = (writer *)arg;
+	writer_job batch[WRITER_MERGE_MAX];
+	pthread_mutex_lock(&w->lock);
+	while (true) {
+		while (w->count == 0 && !w->stopping) {
+			pthread_cond_wait(&w->not_empty, &w->lock);
+		}
+		if (w->count == 0) break;
+
+		batch[0] = writer_pop(w);
+		size_t count = writer_collect(w, batch, 1);
+		pthread_mutex_unlock(&w->lock);
+
+		bool ok;
+		if (count == 1) {
+			ok = writer_write(w, batch[0].trace, batch[0].file);
+		} else {
+			// Every trace is a district of the town, which is named after the first one
+			const trace_buffer *traces[WRITER_MERGE_MAX];
+			for (size_t i = 0; i < count; i++) {
+				traces[i] = batch[i].trace;
+			}
+			ok = trace_render_districts(traces, count, w->backend, batch[0].file);
+		}
+		for (size_t i = 0; i < count; i++) {
+			writer_job_free(&batch[i]);
+		}
+
+		pthread_mutex_lock(&w->lock);
+		if (ok) {
+			w->stats.written += count;
+		} else {
+			w->stats.failed += count;
+		}
+		if (count > 1) {
+			w->stats.merged += count;
+		}
+	}
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+void writer_startup(size_t depth, enum writer_policy policy, const sketchup_backend *backend, int compression, uint64_t merge_window_ns) {
+	writer *w = &writer_instance;
+	memset(w, 0, sizeof(writer));
+	w->depth = depth;
+	w->policy = policy;
+	w->backend = backend;
+	w->compression = compression;
+	w->merge_window_ns = merge_window_ns;
+}
+
+static bool writer_start(writer *w) {
+	// Whatever was inherited through fork() belongs to the parent
+	w->pid = getpid();
+	w->running = false;
+	w->stopping = false;
+	w->head = 0;
+	w->count = 0;
+	w->stats = (writer_stats) {0};
+	free(w->jobs);
+	w->jobs = (writer_job *)calloc(w->depth, sizeof(writer_job));
+	if (!w->jobs) return false;
+
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_cond_init(&w->not_empty, NULL);
+	pthread_cond_init(&w->not_full, NULL);
+	if (pthread_create(&w->thread, NULL, writer_main, w) != 0) {
+		return false;
+	}
+	w->running = true;
+	return true;
+}
+
+void writer_shutdown(void) {
+	writer *w = &writer_instance;
+	if (w->running && w->pid == getpid()) {
+		pthread_mutex_lock(&w->lock);
+		w->stopping = true;
+		pthread_cond_signal(&w->not_empty);
+		pthread_mutex_unlock(&w->lock);
+		pthread_join(w->thread, NULL);
+		pthread_cond_destroy(&w->not_full);
+		pthread_cond_destroy(&w->not_empty);
+		pthread_mutex_destroy(&w->lock);
+	}
+	w->running = false;
+	free(w->jobs);
+	w->jobs = NULL;
+}
+
+enum writer_result writer_enqueue(trace_buffer *trace, const char *file) {
+	writer *w = &writer_instance;
+	if (w->depth == 0) {
+		// Only ever on the request thread, ZTS builds always have a queue
+		bool ok = writer_write(w, trace, file);
+		trace_dtor(trace);
+		if (ok) {
+			w->stats.written++;
+		} else {
+			w->stats.failed++;
+		}
+		return ok ? WRITER_QUEUED : WRITER_FAILED;
+	}
+	pthread_mutex_lock(&writer_start_lock);
+	bool started = (w->running && w->pid == getpid()) || writer_start(w);
+	pthread_mutex_unlock(&writer_start_lock);
+	if (!started) {
+		trace_dtor(trace);
+		return WRITER_FAILED;
+	}
+
+	writer_job job = {trace, strdup(file)};
+	if (!job.file) {
+		trace_dtor(trace);
+		return WRITER_FAILED;
+	}
+
+	pthread_mutex_lock(&w->lock);
+	if (w->count == w->depth && w->policy == WRITER_POLICY_BLOCK) {
+		while (w->count == w->depth) {
+			pthread_cond_wait(&w->not_full, &w->lock);
+		}
+	}
+	if (w->count == w->depth) {
+		w->stats.dropped++;
+		pthread_mutex_unlock(&w->lock);
+		writer_job_free(&job);
+		return WRITER_DROPPED;
+	}
+	w->jobs[(w->head + w->count) % w->depth] = job;
+	w->count++;
+	w->stats.queued++;
+	pthread_cond_signal(&w->not_empty);
+	pthread_mutex_unlock(&w->lock);
+	return WRITER_QUEUED;
+}
+
+void writer_stats_get(writer_stats *stats) {
+	writer *w = &writer_instance;
+	if (w->depth == 0) {
+		*stats = w->stats;
+		return;
+	}
+	if (!w->running || w->pid != getpid()) {
+		*stats = (writer_stats) {0};
+		return;
+	}
+	pthread_mutex_lock(&w->lock);
+	*stats = w->stats;
+	pthread_mutex_unlock(&w->lock);
+}
@@ -0,0 +1,45 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "sketchup.h"
+#include "trace.h"
+
+// A bounded queue of finished traces that a background thread renders and saves, so that
+// building and serializing the town does not hold up the request that recorded it.
+enum writer_policy {
+    WRITER_POLICY_DROP = 0, // Discard the trace when the queue is full
+    WRITER_POLICY_BLOCK,    // Wait for the writer to make room
+};
+
+enum writer_result {
+    WRITER_QUEUED = 0,  // Or written right away with a queue depth of 0
+    WRITER_DROPPED,     // The queue was full under WRITER_POLICY_DROP, as configured
+    WRITER_FAILED,
+};
+
+typedef struct writer_stats_s {
+    size_t queued;
+    size_t written;
+    size_t dropped;
+    size_t failed;
+    size_t merged;      // Traces that were rendered as a district of a merged town
+} writer_stats;
+
+// Without a backend the traces are saved to trace files instead of being rendered, compressed with
+// the given zlib level. With a merge window the traces queued within it after the first one are
+// rendered into the same town, each one as a district of its own.
+void writer_startup(size_t depth, enum writer_policy policy, const sketchup_backend *backend, int compression, uint64_t merge_window_ns);
+// Drains the queue and joins the writer thread
+void writer_shutdown(void);
+
+// Takes ownership of the trace, also when it is dropped. With a queue depth of 0 the trace is rendered right away. The thread is started lazily so that it
+// is owned by the process that actually serves requests, e.g. an FPM worker rather than the master.
+enum writer_result writer_enqueue(trace_buffer *trace, const char *file);
+
+void writer_stats_get(writer_stats *stats);
+
+#endif	/* WRITER_H */